@@ -1,6 +1,7 @@
 #ifndef ACCELERATION_H
 #define ACCELERATION_H
 #include "ruuvi_error.h"
+#include <stddef.h>
 
 #define ACCELERATION_INVALID RUUVI_FLOAT_INVALID
 
@@ -12,4 +13,11 @@ typedef struct
   float z_mg;
 }ruuvi_acceleration_data_t;
 
+// Buffer for buffer_get. Count is maximum number of samples as input, number of samples read as output.
+typedef struct
+{
+  size_t count;
+  ruuvi_acceleration_data_t* data;
+}ruuvi_acceleration_buffer_t;
+
 #endif
\ No newline at end of file
@@ -18,6 +18,7 @@
 
 #include "lis2dh12_reg.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -62,6 +63,12 @@ typedef struct {
 
 static lis2dh12 dev;
 
+/* FIFO burst buffer */
+#define LIS2DH12_INTERFACE_FIFO_SAMPLES     32
+#define LIS2DH12_INTERFACE_FIFO_SAMPLE_SIZE 6 // bytes, x, y, z
+static uint8_t fifo_raw[LIS2DH12_INTERFACE_FIFO_SAMPLES * LIS2DH12_INTERFACE_FIFO_SAMPLE_SIZE];
+static bool fifo_enabled = false;
+
 // Check that self-test values differ enough
 static ruuvi_status_t lis2dh12_verify_selftest_difference(axis3bit16_t* new, axis3bit16_t* old)
 {
@@ -181,6 +188,7 @@ ruuvi_status_t lis2dh12_interface_init(ruuvi_sensor_t* acceleration_sensor)
     acceleration_sensor->interrupt_set  = lis2dh12_interface_interrupt_set;
     acceleration_sensor->interrupt_get  = lis2dh12_interface_interrupt_get;
     acceleration_sensor->data_get       = lis2dh12_interface_data_get;
+    acceleration_sensor->buffer_get     = lis2dh12_interface_buffer_get;
  }
   
   return err_code;
@@ -432,19 +440,11 @@ ruuvi_status_t lis2dh12_interface_interrupt_get(uint8_t number, float* threshold
   return RUUVI_ERROR_NOT_IMPLEMENTED;
 }
 
-ruuvi_status_t lis2dh12_interface_data_get(void* data)
+// Convert raw sample to mg with current scale and resolution
+static ruuvi_status_t lis2dh12_convert(const axis3bit16_t* const raw, ruuvi_acceleration_data_t* const p_acceleration)
 {
-  if(NULL == data) { return RUUVI_ERROR_NULL; }
-  PLATFORM_LOG_DEBUG("Getting data");
-
   ruuvi_status_t err_code = RUUVI_SUCCESS;
-  axis3bit16_t raw_acceleration;
-  memset(raw_acceleration.u8bit, 0x00, 3*sizeof(int16_t));
-  err_code |= lis2dh12_acceleration_raw_get(&(dev.ctx), raw_acceleration.u8bit);
-
-  ruuvi_acceleration_data_t* p_acceleration = (ruuvi_acceleration_data_t*)data;
   float acceleration[3] = {0};
-  PLATFORM_LOG_DEBUG("SPI Read");
 
     // Compensate data with resolution, scale
   for(size_t ii = 0; ii < 3; ii++)
@@ -455,13 +455,13 @@ ruuvi_status_t lis2dh12_interface_data_get(void* data)
       switch(dev.resolution)
       {
         case LIS2DH12_LP_8bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_2g_LP_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_2g_LP_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DH12_NM_10bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_2g_NM_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_2g_NM_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DH12_HR_12bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_2g_HR_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_2g_HR_TO_mg(raw->i16bit[ii]);
         break;
         default:
         acceleration[ii] = ACCELERATION_INVALID;
@@ -474,13 +474,13 @@ ruuvi_status_t lis2dh12_interface_data_get(void* data)
       switch(dev.resolution)
       {
         case LIS2DH12_LP_8bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_4g_LP_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_4g_LP_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DH12_NM_10bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_4g_NM_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_4g_NM_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DH12_HR_12bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_4g_HR_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_4g_HR_TO_mg(raw->i16bit[ii]);
         break;
         default:
         acceleration[ii] = ACCELERATION_INVALID;
@@ -493,13 +493,13 @@ ruuvi_status_t lis2dh12_interface_data_get(void* data)
       switch(dev.resolution)
       {
         case LIS2DH12_LP_8bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_8g_LP_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_8g_LP_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DH12_NM_10bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_8g_NM_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_8g_NM_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DH12_HR_12bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_8g_HR_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_8g_HR_TO_mg(raw->i16bit[ii]);
         break;
         default:
         acceleration[ii] = ACCELERATION_INVALID;
@@ -512,13 +512,13 @@ ruuvi_status_t lis2dh12_interface_data_get(void* data)
       switch(dev.resolution)
       {
         case LIS2DH12_LP_8bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_16g_LP_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_16g_LP_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DH12_NM_10bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_16g_NM_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_16g_NM_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DH12_HR_12bit:
-        acceleration[ii] = LIS2DH12_FROM_FS_16g_HR_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DH12_FROM_FS_16g_HR_TO_mg(raw->i16bit[ii]);
         break;
         default:
         acceleration[ii] = ACCELERATION_INVALID;
@@ -536,8 +536,88 @@ ruuvi_status_t lis2dh12_interface_data_get(void* data)
   p_acceleration->x_mg = acceleration[0];
   p_acceleration->y_mg = acceleration[1];
   p_acceleration->z_mg = acceleration[2];
+  return err_code;
+}
+
+ruuvi_status_t lis2dh12_interface_data_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  PLATFORM_LOG_DEBUG("Getting data");
+
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  axis3bit16_t raw_acceleration;
+  memset(raw_acceleration.u8bit, 0x00, 3*sizeof(int16_t));
+  err_code |= lis2dh12_acceleration_raw_get(&(dev.ctx), raw_acceleration.u8bit);
+
+  PLATFORM_LOG_DEBUG("SPI Read");
+  err_code |= lis2dh12_convert(&raw_acceleration, (ruuvi_acceleration_data_t*)data);
   PLATFORM_LOG_DEBUG("Ready, err_code %d", err_code);
   return err_code;
 }
 
+/**
+ * Set samplerate above range of ruuvi_sensor_samplerate_t, e.g. for FIFO bursts which are decimated in software.
+ * Rate is rounded up to 400, 1344 or 1620 Hz and selected rate is written back.
+ * 1620 Hz requires 8 bit low-power resolution and 1344 Hz requires 10 or 12 bits, set resolution first.
+ */
+ruuvi_status_t lis2dh12_interface_samplerate_hz_set(uint16_t* const samplerate)
+{
+  if(NULL == samplerate) { return RUUVI_ERROR_NULL; }
+  bool low_power = (LIS2DH12_LP_8bit == dev.resolution);
+
+  if(400 >= *samplerate)                     { dev.samplerate = LIS2DH12_ODR_400Hz;                    *samplerate = 400;  }
+  else if(low_power && 1620 >= *samplerate)  { dev.samplerate = LIS2DH12_ODR_1kHz620_LP;               *samplerate = 1620; }
+  else if(!low_power && 1344 >= *samplerate) { dev.samplerate = LIS2DH12_ODR_5kHz376_LP_1kHz344_NM_HP; *samplerate = 1344; }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  if(RUUVI_SENSOR_MODE_CONTINOUS == dev.mode) { return lis2dh12_data_rate_set(&(dev.ctx), dev.samplerate); }
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Enable or disable FIFO in stream mode, samples are read with buffer_get. FIFO is emptied.
+ * FIFO holds 32 samples, i.e. 20 ms at 1620 Hz. Oldest samples are lost if FIFO is not read in time.
+ */
+ruuvi_status_t lis2dh12_interface_fifo_use(const bool enable)
+{
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  err_code |= lis2dh12_fifo_mode_set(&(dev.ctx), LIS2DH12_BYPASS_MODE);
+  err_code |= lis2dh12_fifo_set(&(dev.ctx), enable ? PROPERTY_ENABLE : PROPERTY_DISABLE);
+  if(enable) { err_code |= lis2dh12_fifo_mode_set(&(dev.ctx), LIS2DH12_DYNAMIC_STREAM_MODE); }
+  if(RUUVI_SUCCESS == err_code) { fifo_enabled = enable; }
+  return err_code;
+}
+
+/**
+ * Drain FIFO into ruuvi_acceleration_buffer_t with a single burst read.
+ * Samples which do not fit into given buffer are left in FIFO.
+ */
+ruuvi_status_t lis2dh12_interface_buffer_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_acceleration_buffer_t* p_buffer = (ruuvi_acceleration_buffer_t*) data;
+  if(NULL == p_buffer->data) { return RUUVI_ERROR_NULL; }
+  if(!fifo_enabled) { return RUUVI_ERROR_INVALID_STATE; }
+
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  uint8_t level = 0;
+  uint8_t overrun = 0;
+  err_code |= lis2dh12_fifo_data_level_get(&(dev.ctx), &level);
+  err_code |= lis2dh12_fifo_ovr_flag_get(&(dev.ctx), &overrun);
+  if(overrun) { level = LIS2DH12_INTERFACE_FIFO_SAMPLES; }
+  size_t samples = (level < p_buffer->count) ? level : p_buffer->count;
+  p_buffer->count = 0;
+  if(RUUVI_SUCCESS != err_code || 0 == samples) { return err_code; }
+
+  // Address rolls over from OUT_Z_H to OUT_X_L while FIFO is enabled, so samples are read in one transaction
+  err_code |= lis2dh12_read_reg(&(dev.ctx), LIS2DH12_OUT_X_L, fifo_raw, samples * LIS2DH12_INTERFACE_FIFO_SAMPLE_SIZE);
+  for(size_t ii = 0; ii < samples && RUUVI_SUCCESS == err_code; ii++)
+  {
+    axis3bit16_t raw_acceleration;
+    memcpy(raw_acceleration.u8bit, &fifo_raw[ii * LIS2DH12_INTERFACE_FIFO_SAMPLE_SIZE], LIS2DH12_INTERFACE_FIFO_SAMPLE_SIZE);
+    err_code |= lis2dh12_convert(&raw_acceleration, &(p_buffer->data[p_buffer->count++]));
+  }
+  return err_code;
+}
+
 #endif
\ No newline at end of file
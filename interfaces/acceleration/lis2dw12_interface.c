@@ -18,6 +18,7 @@
 
 #include "lis2dw12_reg.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -61,6 +62,12 @@ typedef struct {
 
 static lis2dw12 dev;
 
+/* FIFO burst buffer */
+#define LIS2DW12_INTERFACE_FIFO_SAMPLES     32
+#define LIS2DW12_INTERFACE_FIFO_SAMPLE_SIZE 6 // bytes, x, y, z
+static uint8_t fifo_raw[LIS2DW12_INTERFACE_FIFO_SAMPLES * LIS2DW12_INTERFACE_FIFO_SAMPLE_SIZE];
+static bool fifo_enabled = false;
+
 // Check that self-test values differ enough
 static ruuvi_status_t lis2dw12_verify_selftest_difference(axis3bit16_t* new, axis3bit16_t* old, bool negative)
 {
@@ -186,6 +193,7 @@ ruuvi_status_t lis2dw12_interface_init(ruuvi_sensor_t* acceleration_sensor)
     acceleration_sensor->interrupt_set  = lis2dw12_interface_interrupt_set;
     acceleration_sensor->interrupt_get  = lis2dw12_interface_interrupt_get;
     acceleration_sensor->data_get       = lis2dw12_interface_data_get;
+    acceleration_sensor->buffer_get     = lis2dw12_interface_buffer_get;
  }
   
   return err_code;
@@ -307,6 +315,7 @@ ruuvi_status_t lis2dw12_interface_resolution_get(ruuvi_sensor_resolution_t* reso
     break;
 
     case LIS2DW12_CONT_LOW_PWR_LOW_NOISE_4:
+    case LIS2DW12_HIGH_PERFORMANCE:
     *resolution = 14;
     break;
 
@@ -428,19 +437,11 @@ ruuvi_status_t lis2dw12_interface_interrupt_get(uint8_t number, float* threshold
   return RUUVI_ERROR_NOT_IMPLEMENTED;
 }
 
-ruuvi_status_t lis2dw12_interface_data_get(void* data)
+// Convert raw sample to mg with current scale and resolution
+static ruuvi_status_t lis2dw12_convert(const axis3bit16_t* const raw, ruuvi_acceleration_data_t* const p_acceleration)
 {
-  if(NULL == data) { return RUUVI_ERROR_NULL; }
-  PLATFORM_LOG_DEBUG("Getting data");
-
   ruuvi_status_t err_code = RUUVI_SUCCESS;
-  axis3bit16_t raw_acceleration;
-  memset(raw_acceleration.u8bit, 0x00, 3*sizeof(int16_t));
-  err_code |= lis2dw12_acceleration_raw_get(&(dev.ctx), raw_acceleration.u8bit);
-
-  ruuvi_acceleration_data_t* p_acceleration = (ruuvi_acceleration_data_t*)data;
   float acceleration[3] = {0};
-  PLATFORM_LOG_DEBUG("SPI Read");
 
     // Compensate data with resolution, scale
   for(size_t ii = 0; ii < 3; ii++)
@@ -451,10 +452,11 @@ ruuvi_status_t lis2dw12_interface_data_get(void* data)
       switch(dev.mode)
       {
         case LIS2DW12_CONT_LOW_PWR_12bit:
-        acceleration[ii] = LIS2DW12_FROM_FS_2g_LP1_TO_mg(raw_acceleration.i16bit[ii]);
+        acceleration[ii] = LIS2DW12_FROM_FS_2g_LP1_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DW12_CONT_LOW_PWR_LOW_NOISE_4:
-        acceleration[ii] = LIS2DW12_FROM_FS_2g_TO_mg(raw_acceleration.i16bit[ii]);
+        case LIS2DW12_HIGH_PERFORMANCE:
+        acceleration[ii] = LIS2DW12_FROM_FS_2g_TO_mg(raw->i16bit[ii]);
         break;
         default:
         acceleration[ii] = ACCELERATION_INVALID;
@@ -466,10 +468,12 @@ ruuvi_status_t lis2dw12_interface_data_get(void* data)
       case LIS2DW12_4g:
       switch(dev.mode)
       {
-        acceleration[ii] = LIS2DW12_FROM_FS_4g_LP1_TO_mg(raw_acceleration.i16bit[ii]);
+        case LIS2DW12_CONT_LOW_PWR_12bit:
+        acceleration[ii] = LIS2DW12_FROM_FS_4g_LP1_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DW12_CONT_LOW_PWR_LOW_NOISE_4:
-        acceleration[ii] = LIS2DW12_FROM_FS_4g_TO_mg(raw_acceleration.i16bit[ii]);
+        case LIS2DW12_HIGH_PERFORMANCE:
+        acceleration[ii] = LIS2DW12_FROM_FS_4g_TO_mg(raw->i16bit[ii]);
         break;
         default:
         acceleration[ii] = ACCELERATION_INVALID;
@@ -481,10 +485,12 @@ ruuvi_status_t lis2dw12_interface_data_get(void* data)
       case LIS2DW12_8g:
       switch(dev.mode)
       {
-        acceleration[ii] = LIS2DW12_FROM_FS_8g_LP1_TO_mg(raw_acceleration.i16bit[ii]);
+        case LIS2DW12_CONT_LOW_PWR_12bit:
+        acceleration[ii] = LIS2DW12_FROM_FS_8g_LP1_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DW12_CONT_LOW_PWR_LOW_NOISE_4:
-        acceleration[ii] = LIS2DW12_FROM_FS_8g_TO_mg(raw_acceleration.i16bit[ii]);
+        case LIS2DW12_HIGH_PERFORMANCE:
+        acceleration[ii] = LIS2DW12_FROM_FS_8g_TO_mg(raw->i16bit[ii]);
         break;
         default:
         acceleration[ii] = ACCELERATION_INVALID;
@@ -496,10 +502,12 @@ ruuvi_status_t lis2dw12_interface_data_get(void* data)
       case LIS2DW12_16g:
       switch(dev.mode)
       {
-        acceleration[ii] = LIS2DW12_FROM_FS_16g_LP1_TO_mg(raw_acceleration.i16bit[ii]);
+        case LIS2DW12_CONT_LOW_PWR_12bit:
+        acceleration[ii] = LIS2DW12_FROM_FS_16g_LP1_TO_mg(raw->i16bit[ii]);
         break;
         case LIS2DW12_CONT_LOW_PWR_LOW_NOISE_4:
-        acceleration[ii] = LIS2DW12_FROM_FS_16g_TO_mg(raw_acceleration.i16bit[ii]);
+        case LIS2DW12_HIGH_PERFORMANCE:
+        acceleration[ii] = LIS2DW12_FROM_FS_16g_TO_mg(raw->i16bit[ii]);
         break;
         default:
         acceleration[ii] = ACCELERATION_INVALID;
@@ -517,8 +525,87 @@ ruuvi_status_t lis2dw12_interface_data_get(void* data)
   p_acceleration->x_mg = acceleration[0];
   p_acceleration->y_mg = acceleration[1];
   p_acceleration->z_mg = acceleration[2];
+  return err_code;
+}
+
+ruuvi_status_t lis2dw12_interface_data_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  PLATFORM_LOG_DEBUG("Getting data");
+
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  axis3bit16_t raw_acceleration;
+  memset(raw_acceleration.u8bit, 0x00, 3*sizeof(int16_t));
+  err_code |= lis2dw12_acceleration_raw_get(&(dev.ctx), raw_acceleration.u8bit);
+
+  PLATFORM_LOG_DEBUG("SPI Read");
+  err_code |= lis2dw12_convert(&raw_acceleration, (ruuvi_acceleration_data_t*)data);
   PLATFORM_LOG_DEBUG("Ready, err_code %d", err_code);
   return err_code;
 }
 
+/**
+ * Set samplerate above range of ruuvi_sensor_samplerate_t, e.g. for FIFO bursts which are decimated in software.
+ * Rate is rounded up to 400, 800 or 1600 Hz and selected rate is written back.
+ * Low-power modes are limited to 200 Hz, so sensor is switched to 14 bit high-performance mode.
+ */
+ruuvi_status_t lis2dw12_interface_samplerate_hz_set(uint16_t* const samplerate)
+{
+  if(NULL == samplerate) { return RUUVI_ERROR_NULL; }
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+
+  if(400 >= *samplerate)       { dev.samplerate = LIS2DW12_XL_ODR_400Hz; *samplerate = 400;  }
+  else if(800 >= *samplerate)  { dev.samplerate = LIS2DW12_XL_ODR_800Hz; *samplerate = 800;  }
+  else if(1600 >= *samplerate) { dev.samplerate = LIS2DW12_XL_ODR_1k6Hz; *samplerate = 1600; }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  dev.mode = LIS2DW12_HIGH_PERFORMANCE;
+  err_code |= lis2dw12_power_mode_set(&(dev.ctx), dev.mode);
+  if(RUUVI_SENSOR_MODE_CONTINOUS == dev.opmode) { err_code |= lis2dw12_data_rate_set(&(dev.ctx), dev.samplerate); }
+  return err_code;
+}
+
+/**
+ * Enable or disable FIFO in stream mode, samples are read with buffer_get. FIFO is emptied.
+ * FIFO holds 32 samples, i.e. 20 ms at 1600 Hz. Oldest samples are lost if FIFO is not read in time.
+ */
+ruuvi_status_t lis2dw12_interface_fifo_use(const bool enable)
+{
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  err_code |= lis2dw12_fifo_mode_set(&(dev.ctx), LIS2DW12_BYPASS_MODE);
+  if(enable) { err_code |= lis2dw12_fifo_mode_set(&(dev.ctx), LIS2DW12_STREAM_MODE); }
+  if(RUUVI_SUCCESS == err_code) { fifo_enabled = enable; }
+  return err_code;
+}
+
+/**
+ * Drain FIFO into ruuvi_acceleration_buffer_t with a single burst read.
+ * Samples which do not fit into given buffer are left in FIFO.
+ */
+ruuvi_status_t lis2dw12_interface_buffer_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_acceleration_buffer_t* p_buffer = (ruuvi_acceleration_buffer_t*) data;
+  if(NULL == p_buffer->data) { return RUUVI_ERROR_NULL; }
+  if(!fifo_enabled) { return RUUVI_ERROR_INVALID_STATE; }
+
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  uint8_t level = 0;
+  err_code |= lis2dw12_fifo_data_level_get(&(dev.ctx), &level);
+  if(LIS2DW12_INTERFACE_FIFO_SAMPLES < level) { level = LIS2DW12_INTERFACE_FIFO_SAMPLES; }
+  size_t samples = (level < p_buffer->count) ? level : p_buffer->count;
+  p_buffer->count = 0;
+  if(RUUVI_SUCCESS != err_code || 0 == samples) { return err_code; }
+
+  // Address rolls over from OUT_Z_H to OUT_X_L while FIFO is enabled, so samples are read in one transaction
+  err_code |= lis2dw12_read_reg(&(dev.ctx), LIS2DW12_OUT_X_L, fifo_raw, samples * LIS2DW12_INTERFACE_FIFO_SAMPLE_SIZE);
+  for(size_t ii = 0; ii < samples && RUUVI_SUCCESS == err_code; ii++)
+  {
+    axis3bit16_t raw_acceleration;
+    memcpy(raw_acceleration.u8bit, &fifo_raw[ii * LIS2DW12_INTERFACE_FIFO_SAMPLE_SIZE], LIS2DW12_INTERFACE_FIFO_SAMPLE_SIZE);
+    err_code |= lis2dw12_convert(&raw_acceleration, &(p_buffer->data[p_buffer->count++]));
+  }
+  return err_code;
+}
+
 #endif
\ No newline at end of file
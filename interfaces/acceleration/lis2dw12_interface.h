@@ -6,6 +6,8 @@
 #define LIS2DW12_INTERFACE_H
 #include "ruuvi_error.h"
 #include "ruuvi_sensor.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 ruuvi_status_t lis2dw12_interface_init(ruuvi_sensor_t* acceleration_sensor);
 ruuvi_status_t lis2dw12_interface_uninit(ruuvi_sensor_t* acceleration_sensor);
@@ -22,5 +24,10 @@ ruuvi_status_t lis2dw12_interface_mode_get(ruuvi_sensor_mode_t*);
 ruuvi_status_t lis2dw12_interface_interrupt_set(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
 ruuvi_status_t lis2dw12_interface_interrupt_get(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
 ruuvi_status_t lis2dw12_interface_data_get(void* data);
+ruuvi_status_t lis2dw12_interface_buffer_get(void* data);
+
+// FIFO bursts at samplerates above 255 Hz, see dsp_decimator.h for downsampling
+ruuvi_status_t lis2dw12_interface_samplerate_hz_set(uint16_t* const samplerate);
+ruuvi_status_t lis2dw12_interface_fifo_use(const bool enable);
 
 #endif
\ No newline at end of file
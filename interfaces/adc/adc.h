@@ -3,6 +3,9 @@
 
 #include "ruuvi_error.h"
 #include "ruuvi_sensor.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define ADC_INVALID RUUVI_FLOAT_INVALID
 
@@ -19,17 +22,70 @@ typedef enum{
   AIN_9,
   AIN_BATTERY
 }adc_channel_t;
+#define ADC_CHANNEL_COUNT (AIN_BATTERY + 1)
 
-// ruuvi_status_t adc_channel_set(adc_channel_t channel);
+// Latest result of each channel in millivolts, ADC_INVALID if channel is not in use.
+typedef struct
+{
+  float channel_mv[ADC_CHANNEL_COUNT];
+}ruuvi_adc_data_t;
+
+/**
+ * Called in interrupt context when a block of continuous samples is ready.
+ * samples: raw conversion results, interleaved in scan order, i.e. scans * channels values
+ * order:   adc_channel_t of each position in a scan
+ * Block must be processed before the next block is completed.
+ */
+typedef void(*adc_block_handler_t)(const int16_t* samples, const size_t scans, const adc_channel_t* order, const uint8_t channels);
 
-//TODO: Sensor interface functions
 ruuvi_status_t adc_init(ruuvi_sensor_t* adc);
+ruuvi_status_t adc_uninit(ruuvi_sensor_t* adc);
+ruuvi_status_t adc_samplerate_set(ruuvi_sensor_samplerate_t* samplerate);
+ruuvi_status_t adc_samplerate_get(ruuvi_sensor_samplerate_t* samplerate);
+ruuvi_status_t adc_resolution_set(ruuvi_sensor_resolution_t* resolution);
+ruuvi_status_t adc_resolution_get(ruuvi_sensor_resolution_t* resolution);
+ruuvi_status_t adc_scale_set(ruuvi_sensor_scale_t* scale);
+ruuvi_status_t adc_scale_get(ruuvi_sensor_scale_t* scale);
+ruuvi_status_t adc_dsp_set(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter);
+ruuvi_status_t adc_dsp_get(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter);
+ruuvi_status_t adc_mode_set(ruuvi_sensor_mode_t* mode);
+ruuvi_status_t adc_mode_get(ruuvi_sensor_mode_t* mode);
+ruuvi_status_t adc_interrupt_set(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
+ruuvi_status_t adc_interrupt_get(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
+// Fills ruuvi_adc_data_t
+ruuvi_status_t adc_data_get(void* data);
+
+/**
+ * Add or remove channel from scan. Battery channel is in use after init.
+ */
+ruuvi_status_t adc_channel_use(const adc_channel_t channel, const bool enable);
+
+/**
+ * Scan rate in continuous mode, in Hz. Rates above 250 Hz are not representable through samplerate_set.
+ */
+ruuvi_status_t adc_scan_rate_set(const uint32_t rate_hz);
+ruuvi_status_t adc_scan_rate_get(uint32_t* const rate_hz);
 
-// Start sampling given channel
+/**
+ * Deliver continuous samples in blocks of given number of scans. NULL handler only updates latest values.
+ */
+ruuvi_status_t adc_block_handler_set(const adc_block_handler_t handler, const uint16_t scans);
+
+// Start sampling given channel. Channel is added to scan if it is not in use yet.
 ruuvi_status_t adc_sample_asynchronous(adc_channel_t channel);
 
 // read latest data from given channel
 float adc_get_data(adc_channel_t channel);
 
+/**
+ * Battery voltage under load, e.g. right after radio TX. Sample is taken at once, call it from a wakeup
+ * which happens anyway, such as radio notification. Returns RUUVI_ERROR_BUSY while a scan is in progress,
+ * and regular samples return RUUVI_ERROR_BUSY while a loaded sample is in progress.
+ * adc_battery_loaded_get returns the minimum since adc_battery_loaded_reset, idle voltage is adc_get_data(AIN_BATTERY).
+ */
+ruuvi_status_t adc_battery_loaded_sample(void);
+float adc_battery_loaded_get(void);
+void adc_battery_loaded_reset(void);
+
 
-#endif
\ No newline at end of file
+#endif
@@ -12,13 +12,33 @@ typedef enum{
   CONNECTABLE_SCANNABLE
 }ble4_advertisement_type_t;
 
+#define BLE4_ADVERTISEMENT_PROFILES 4
+
+// Advertising settings prepared in advance, e.g. fast and slow advertising on motion
+typedef struct{
+  int16_t interval_ms;
+  int8_t  power_dbm;
+  ble4_advertisement_type_t type;
+}ble4_advertisement_profile_t;
+
 // Functions for setting up advertisement constants
-// Each change takes effect immediately
+// Each change takes effect immediately if not advertising, interval and type otherwise between advertising events.
+// Failure to restart advertising there is returned by next call of these, message_put or process_asynchronous,
+// which start advertising again.
 ruuvi_status_t ble4_advertisement_set_interval(int16_t ms);
 ruuvi_status_t ble4_advertisement_set_power(int8_t dbm);
 ruuvi_status_t ble4_advertisement_set_type(ble4_advertisement_type_t advertisement_type);
 ruuvi_status_t ble4_advertisement_set_manufacturer_id(uint16_t id);
 
+// Store profile at index 0 ... BLE4_ADVERTISEMENT_PROFILES - 1. Values are validated here, not on select.
+ruuvi_status_t ble4_advertisement_profile_set(uint8_t index, const ble4_advertisement_profile_t* profile);
+// Switch to stored profile. Only settings which differ from current ones are applied.
+ruuvi_status_t ble4_advertisement_profile_select(uint8_t index);
+
+// Messages rotate on air by data format, i.e. first byte of payload. Weight is relative share of
+// advertising events for a format, default 1. Takes effect on next message of the format.
+ruuvi_status_t ble4_advertisement_set_weight(uint8_t data_format, uint8_t weight);
+
 // Functions for implementing communication api - static functions are commented out
 ruuvi_status_t ble4_advertisement_init(ruuvi_communication_channel_t* channel);
 ruuvi_status_t ble4_advertisement_uninit(ruuvi_communication_channel_t* channel);
@@ -31,7 +51,24 @@ ruuvi_status_t ble4_advertisement_uninit(ruuvi_communication_channel_t* channel)
 // Configure if Scan response should include NUS. Might truncate name
 ruuvi_status_t ble4_advertisement_scan_response_nus_advertise(bool advertise);
 
+// Sample battery voltage under radio load right after each radio event, in radio notification. Requires ADC.
+ruuvi_status_t ble4_advertisement_battery_loaded_sample(bool enable);
+
+// Called in interrupt context ahead of each advertising event, NULL to disable. Start an asynchronous sensor read here
+// and message_put the result from its completion, it goes on air in the next advertising event.
+// Not called while advertising is stopped, e.g. during a GATT connection.
+ruuvi_status_t ble4_advertisement_set_before_tx(ruuvi_communication_fp cb);
+
+// Called in interrupt context on each scan request, NULL to disable. Write a detailed payload, e.g. full precision values
+// or diagnostic counters, into msg->payload, up to msg->payload_length bytes, and set msg->payload_length.
+// Payload goes into scan response as manufacturer data, starting from next advertising event. Requires scannable type.
+ruuvi_status_t ble4_advertisement_set_on_scan_request(ruuvi_communication_xfer_fp cb);
+
 //XXX Used by nrf5 sdk to restart advertisements after connection.
 void ble4_advertisement_restart(void);
 
+// Used by ble4_set_name, scan response is encoded again into the idle set on next advertising event,
+// or on next message_put if not advertising.
+void ble4_advertisement_scan_response_invalidate(void);
+
 #endif
\ No newline at end of file
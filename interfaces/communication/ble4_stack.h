@@ -8,7 +8,7 @@
 ruuvi_status_t ble4_stack_init(void);
 
 // Sets name to softdevice. Calling this function alone won't update 
-// advertised name, the effect will take place after next call to process()
+// advertised name, the effect will take place after next advertisement message_put
 ruuvi_status_t ble4_set_name(uint8_t* name, uint8_t name_length, bool include_serial);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+/**
+ * Send-on-delta filter, see communication_deadband.h.
+ */
+#include "application_config.h"
+#if COMMUNICATION_DEADBAND
+#include "ruuvi_error.h"
+#include "communication.h"
+#include "communication_deadband.h"
+#include <string.h>
+
+// Raw field value, sign extended
+static int64_t communication_deadband_field_get(const uint8_t* const payload, const communication_deadband_field_t* const field)
+{
+  uint32_t raw = 0;
+  for(uint8_t ii = 0; ii < field->size; ii++)
+  {
+    uint8_t byte = field->little_endian ? payload[field->offset + field->size - 1 - ii] : payload[field->offset + ii];
+    raw = (raw << 8) | byte;
+  }
+  if(!field->is_signed) { return raw; }
+  uint8_t shift = 32 - (8 * field->size);
+  return (int32_t)(raw << shift) >> shift;
+}
+
+// Field cut by end of payload is compared as plain bytes
+static bool communication_deadband_fits(const communication_deadband_field_t* const field, const size_t length)
+{
+  return (size_t)field->offset + field->size <= length;
+}
+
+// True if byte belongs to some field which fits into payload
+static bool communication_deadband_covered(const communication_deadband_t* const filter, const size_t index, const size_t length)
+{
+  for(uint8_t ii = 0; ii < filter->field_count; ii++)
+  {
+    const communication_deadband_field_t* field = &(filter->fields[ii]);
+    if(!communication_deadband_fits(field, length)) { continue; }
+    if(index >= field->offset && index < (size_t)field->offset + field->size) { return true; }
+  }
+  return false;
+}
+
+ruuvi_status_t communication_deadband_init(communication_deadband_t* const filter, const communication_deadband_field_t* const fields,
+                                           const uint8_t field_count, const uint8_t max_skips)
+{
+  if(NULL == filter || (NULL == fields && 0 != field_count)) { return RUUVI_ERROR_NULL; }
+  for(uint8_t ii = 0; ii < field_count; ii++)
+  {
+    uint8_t size = fields[ii].size;
+    if(1 != size && 2 != size && 4 != size) { return RUUVI_ERROR_INVALID_PARAM; }
+    if(COMMUNICATION_DEADBAND_PAYLOAD_MAX < (size_t)fields[ii].offset + size) { return RUUVI_ERROR_INVALID_PARAM; }
+  }
+  filter->fields = fields;
+  filter->field_count = field_count;
+  filter->max_skips = max_skips;
+  communication_deadband_reset(filter);
+  return RUUVI_SUCCESS;
+}
+
+void communication_deadband_reset(communication_deadband_t* const filter)
+{
+  if(NULL == filter) { return; }
+  filter->skips = 0;
+  filter->valid = false;
+  filter->length = 0;
+}
+
+bool communication_deadband_changed(const communication_deadband_t* const filter, const ruuvi_communication_message_t* const msg)
+{
+  if(NULL == filter || NULL == msg || NULL == msg->payload) { return true; }
+  if(!filter->valid || msg->payload_length != filter->length) { return true; }
+
+  for(uint8_t ii = 0; ii < filter->field_count; ii++)
+  {
+    const communication_deadband_field_t* field = &(filter->fields[ii]);
+    if(!communication_deadband_fits(field, msg->payload_length)) { continue; }
+    int64_t delta = communication_deadband_field_get(msg->payload, field) - communication_deadband_field_get(filter->baseline, field);
+    if(0 > delta) { delta = -delta; }
+    if(COMMUNICATION_DEADBAND_IGNORE != field->deadband && delta > field->deadband) { return true; }
+  }
+  for(size_t ii = 0; ii < msg->payload_length; ii++)
+  {
+    if(msg->payload[ii] != filter->baseline[ii] && !communication_deadband_covered(filter, ii, msg->payload_length)) { return true; }
+  }
+  return false;
+}
+
+ruuvi_status_t communication_deadband_put(communication_deadband_t* const filter, ruuvi_communication_channel_t* const channel,
+                                          ruuvi_communication_message_t* const msg)
+{
+  if(NULL == filter || NULL == channel || NULL == msg || NULL == msg->payload) { return RUUVI_ERROR_NULL; }
+  if(NULL == channel->message_put) { return RUUVI_ERROR_INVALID_STATE; }
+  bool forced = (0 != filter->max_skips) && (filter->skips >= filter->max_skips);
+  if(!forced && !communication_deadband_changed(filter, msg))
+  {
+    if(UINT8_MAX > filter->skips) { filter->skips++; }
+    return RUUVI_SUCCESS;
+  }
+
+  ruuvi_status_t err_code = channel->message_put(msg);
+  if(RUUVI_SUCCESS != err_code) { return err_code; }
+  filter->skips = 0;
+  if(COMMUNICATION_DEADBAND_PAYLOAD_MAX >= msg->payload_length)
+  {
+    memcpy(filter->baseline, msg->payload, msg->payload_length);
+    filter->length = msg->payload_length;
+    filter->valid = true;
+  }
+  else { filter->valid = false; }
+  return RUUVI_SUCCESS;
+}
+
+#endif
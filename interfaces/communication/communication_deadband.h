@@ -0,0 +1,64 @@
+/**
+ * Send-on-delta filter in front of message_put of a communication channel.
+ *
+ * Payload is described as fields with a deadband each. New message is sent only if some field
+ * differs from the last sent message by more than its deadband, or if bytes outside fields differ.
+ * Comparison is against last sent message, so slow drift is sent once it exceeds deadband.
+ * Deadbands are in raw payload units, e.g. in Ruuvi data format 5 0.05 °C is 10 and 2 Pa is 2.
+ *
+ * max_skips forces a message through after that many skipped ones so that receivers see the
+ * tag is alive. One filter holds baseline of one message type, e.g. one data format.
+ */
+#ifndef COMMUNICATION_DEADBAND_H
+#define COMMUNICATION_DEADBAND_H
+#include "ruuvi_error.h"
+#include "communication.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define COMMUNICATION_DEADBAND_PAYLOAD_MAX 32
+#define COMMUNICATION_DEADBAND_IGNORE      UINT32_MAX // Field never triggers send, e.g. sequence counter
+
+typedef struct
+{
+  uint8_t  offset;        // Bytes from start of payload
+  uint8_t  size;          // 1, 2 or 4
+  bool     is_signed;
+  bool     little_endian; // Default is big-endian as in Ruuvi data formats
+  uint32_t deadband;      // Largest difference which is not sent, raw units
+}communication_deadband_field_t;
+
+typedef struct
+{
+  const communication_deadband_field_t* fields;
+  uint8_t  field_count;
+  uint8_t  max_skips;     // 0 for no forced sends
+  uint8_t  skips;         // Messages skipped since last send
+  bool     valid;         // Baseline holds a sent message
+  size_t   length;
+  uint8_t  baseline[COMMUNICATION_DEADBAND_PAYLOAD_MAX];
+}communication_deadband_t;
+
+/**
+ * Initialize filter, fields must stay valid while filter is used.
+ * Returns RUUVI_ERROR_INVALID_PARAM if a field is not 1, 2 or 4 bytes or does not fit into COMMUNICATION_DEADBAND_PAYLOAD_MAX.
+ */
+ruuvi_status_t communication_deadband_init(communication_deadband_t* const filter, const communication_deadband_field_t* const fields,
+                                           const uint8_t field_count, const uint8_t max_skips);
+
+// Forget baseline, next message is sent
+void communication_deadband_reset(communication_deadband_t* const filter);
+
+// True if message differs enough from baseline to be sent. Does not modify filter.
+bool communication_deadband_changed(const communication_deadband_t* const filter, const ruuvi_communication_message_t* const msg);
+
+/**
+ * Put message to channel if it has changed enough or max_skips is reached, otherwise count it as skipped.
+ * Skipped message returns RUUVI_SUCCESS, sent message returns status of message_put.
+ * Baseline is updated only after successful message_put.
+ */
+ruuvi_status_t communication_deadband_put(communication_deadband_t* const filter, ruuvi_communication_channel_t* const channel,
+                                          ruuvi_communication_message_t* const msg);
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * Adaptive transmission interval, see communication_interval.h.
+ */
+#include "application_config.h"
+#if COMMUNICATION_INTERVAL
+#include "ruuvi_error.h"
+#include "communication_interval.h"
+#include <stddef.h>
+
+// Score follows share of changed measurements with time constant of 8 measurements.
+// Decay is rounded up so that score reaches 0 after calm data, truncated decay would stop at 7.
+#define COMMUNICATION_INTERVAL_SCORE_SHIFT 3
+#define COMMUNICATION_INTERVAL_SCORE_ROUND ((1 << COMMUNICATION_INTERVAL_SCORE_SHIFT) - 1)
+
+static ruuvi_status_t communication_interval_apply(communication_interval_t* const controller, int32_t interval_ms)
+{
+  if(interval_ms < controller->config.min_ms) { interval_ms = controller->config.min_ms; }
+  if(interval_ms > controller->config.max_ms) { interval_ms = controller->config.max_ms; }
+  if(interval_ms == controller->interval_ms) { return RUUVI_SUCCESS; }
+  ruuvi_status_t err_code = controller->config.set_interval((int16_t)interval_ms);
+  if(RUUVI_SUCCESS == err_code) { controller->interval_ms = (int16_t)interval_ms; }
+  return err_code;
+}
+
+ruuvi_status_t communication_interval_init(communication_interval_t* const controller, const communication_interval_config_t* const config)
+{
+  if(NULL == controller || NULL == config || NULL == config->set_interval) { return RUUVI_ERROR_NULL; }
+  if(0 >= config->min_ms || config->min_ms > config->max_ms) { return RUUVI_ERROR_INVALID_PARAM; }
+  if(config->fall_threshold >= config->rise_threshold || 0 == config->hold) { return RUUVI_ERROR_INVALID_PARAM; }
+  controller->config = *config;
+  controller->interval_ms = 0;
+  controller->score = 0;
+  controller->calm = 0;
+  controller->activity = false;
+  return communication_interval_apply(controller, config->min_ms);
+}
+
+void communication_interval_activity(communication_interval_t* const controller)
+{
+  if(NULL == controller) { return; }
+  controller->activity = true;
+}
+
+ruuvi_status_t communication_interval_update(communication_interval_t* const controller, const bool changed)
+{
+  if(NULL == controller || NULL == controller->config.set_interval) { return RUUVI_ERROR_NULL; }
+  int32_t score = controller->score - ((controller->score + COMMUNICATION_INTERVAL_SCORE_ROUND) >> COMMUNICATION_INTERVAL_SCORE_SHIFT);
+  if(changed) { score += (COMMUNICATION_INTERVAL_SCORE_MAX + 1) >> COMMUNICATION_INTERVAL_SCORE_SHIFT; }
+  controller->score = (COMMUNICATION_INTERVAL_SCORE_MAX < score) ? COMMUNICATION_INTERVAL_SCORE_MAX : (uint8_t)score;
+
+  int32_t interval_ms = controller->interval_ms;
+  // Activity reported between check and clear is merged into this one, effect would be the same
+  if(controller->activity)
+  {
+    controller->activity = false;
+    controller->calm = 0;
+    interval_ms = controller->config.min_ms;
+  }
+  else if(controller->score >= controller->config.rise_threshold)
+  {
+    controller->calm = 0;
+    interval_ms /= 2;
+  }
+  else if(controller->score <= controller->config.fall_threshold)
+  {
+    if(UINT8_MAX > controller->calm) { controller->calm++; }
+    if(controller->calm >= controller->config.hold)
+    {
+      controller->calm = 0;
+      interval_ms *= 2;
+    }
+  }
+  else { controller->calm = 0; }
+  return communication_interval_apply(controller, interval_ms);
+}
+
+int16_t communication_interval_get(const communication_interval_t* const controller)
+{
+  if(NULL == controller) { return 0; }
+  return controller->interval_ms;
+}
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * Adaptive transmission interval, e.g. for ble4_advertisement_set_interval.
+ *
+ * Interval moves between min_ms and max_ms. Motion, e.g. accelerometer activity interrupt,
+ * drops interval to min_ms at once. Volatility of data is tracked as a running share of
+ * measurements which changed, e.g. result of communication_deadband_changed.
+ * Volatile data halves interval, calm data doubles it after hold calm measurements in a row.
+ * Between the thresholds interval stays, and it is applied only when it changes,
+ * since a new interval restarts advertising.
+ */
+#ifndef COMMUNICATION_INTERVAL_H
+#define COMMUNICATION_INTERVAL_H
+#include "ruuvi_error.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Share of changed measurements is tracked as 0 ... COMMUNICATION_INTERVAL_SCORE_MAX
+#define COMMUNICATION_INTERVAL_SCORE_MAX 255
+
+typedef ruuvi_status_t(*communication_interval_set_fp)(int16_t ms);
+
+typedef struct
+{
+  int16_t min_ms;
+  int16_t max_ms;
+  uint8_t rise_threshold;  // Score at or above which interval is halved
+  uint8_t fall_threshold;  // Score at or below which measurement is calm, less than rise_threshold
+  uint8_t hold;            // Calm measurements before interval is doubled, at least 1
+  communication_interval_set_fp set_interval;
+}communication_interval_config_t;
+
+typedef struct
+{
+  communication_interval_config_t config;
+  int16_t       interval_ms; // Last applied interval
+  uint8_t       score;
+  uint8_t       calm;        // Calm measurements since last change
+  volatile bool activity;    // Set from interrupt, handled on next update
+}communication_interval_t;
+
+/**
+ * Initialize controller and apply min_ms, so that first data goes out fast.
+ * Returns RUUVI_ERROR_INVALID_PARAM if limits or thresholds are inconsistent.
+ */
+ruuvi_status_t communication_interval_init(communication_interval_t* const controller, const communication_interval_config_t* const config);
+
+// Report motion. Safe to call from interrupt context, e.g. pin_interrupt handler of accelerometer.
+void communication_interval_activity(communication_interval_t* const controller);
+
+/**
+ * Report a measurement from thread context, changed tells if data differs from last sent.
+ * Applies new interval through set_interval if it changes. On error old interval stays in use and is retried on next update.
+ */
+ruuvi_status_t communication_interval_update(communication_interval_t* const controller, const bool changed);
+
+int16_t communication_interval_get(const communication_interval_t* const controller);
+
+#endif
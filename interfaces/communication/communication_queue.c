@@ -0,0 +1,113 @@
+/**
+ * Zero-copy message queue, see communication_queue.h.
+ */
+#include "application_config.h"
+#if COMMUNICATION_QUEUE
+#include "ruuvi_error.h"
+#include "communication_queue.h"
+#include <stddef.h>
+
+// Index handoff between contexts. Acquire keeps slot accesses after load of other side's index,
+// release keeps them before store of own index. Compiles to DMB on Cortex-M and to proper
+// fences on multicore hosts.
+#define COMMUNICATION_QUEUE_LOAD(index)          __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define COMMUNICATION_QUEUE_STORE(index, value)  __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+
+static inline size_t communication_queue_next(const communication_queue_t* const queue, const size_t index)
+{
+  return (index + 1 < 2 * queue->capacity) ? (index + 1) : 0;
+}
+
+static inline uint8_t* communication_queue_slot(const communication_queue_t* const queue, const size_t index)
+{
+  size_t slot = (index < queue->capacity) ? index : (index - queue->capacity);
+  return queue->storage + (slot * queue->element_size);
+}
+
+static inline size_t communication_queue_used(const size_t head, const size_t tail, const size_t capacity)
+{
+  return (head >= tail) ? (head - tail) : ((2 * capacity) - tail + head);
+}
+
+ruuvi_status_t communication_queue_init(communication_queue_t* const queue, void* const storage,
+                                        const size_t element_size, const size_t capacity)
+{
+  if(NULL == queue || NULL == storage) { return RUUVI_ERROR_NULL; }
+  if(0 == element_size || 0 == capacity || (SIZE_MAX / 2) < capacity) { return RUUVI_ERROR_INVALID_PARAM; }
+  queue->storage = storage;
+  queue->element_size = element_size;
+  queue->capacity = capacity;
+  COMMUNICATION_QUEUE_STORE(queue->head, 0);
+  COMMUNICATION_QUEUE_STORE(queue->tail, 0);
+  return RUUVI_SUCCESS;
+}
+
+void* communication_queue_reserve(communication_queue_t* const queue)
+{
+  if(NULL == queue || NULL == queue->storage) { return NULL; }
+  // Own index needs no ordering, consumer may still be reading the slot until its release is seen
+  size_t head = queue->head;
+  size_t tail = COMMUNICATION_QUEUE_LOAD(queue->tail);
+  if(queue->capacity <= communication_queue_used(head, tail, queue->capacity)) { return NULL; }
+  return communication_queue_slot(queue, head);
+}
+
+void communication_queue_commit(communication_queue_t* const queue)
+{
+  if(NULL == queue) { return; }
+  size_t head = queue->head;
+  size_t tail = COMMUNICATION_QUEUE_LOAD(queue->tail);
+  if(queue->capacity <= communication_queue_used(head, tail, queue->capacity)) { return; }
+  COMMUNICATION_QUEUE_STORE(queue->head, communication_queue_next(queue, head));
+}
+
+void* communication_queue_peek(const communication_queue_t* const queue)
+{
+  if(NULL == queue || NULL == queue->storage) { return NULL; }
+  size_t tail = queue->tail;
+  if(tail == COMMUNICATION_QUEUE_LOAD(queue->head)) { return NULL; }
+  return communication_queue_slot(queue, tail);
+}
+
+void* communication_queue_peek_at(const communication_queue_t* const queue, const size_t index)
+{
+  if(NULL == queue || NULL == queue->storage) { return NULL; }
+  size_t tail = queue->tail;
+  if(index >= communication_queue_used(COMMUNICATION_QUEUE_LOAD(queue->head), tail, queue->capacity)) { return NULL; }
+  size_t at = tail + index;
+  return communication_queue_slot(queue, (at < 2 * queue->capacity) ? at : (at - (2 * queue->capacity)));
+}
+
+void communication_queue_release(communication_queue_t* const queue)
+{
+  if(NULL == queue) { return; }
+  size_t tail = queue->tail;
+  if(tail == COMMUNICATION_QUEUE_LOAD(queue->head)) { return; }
+  COMMUNICATION_QUEUE_STORE(queue->tail, communication_queue_next(queue, tail));
+}
+
+void communication_queue_flush(communication_queue_t* const queue)
+{
+  if(NULL == queue) { return; }
+  COMMUNICATION_QUEUE_STORE(queue->tail, COMMUNICATION_QUEUE_LOAD(queue->head));
+}
+
+size_t communication_queue_count(const communication_queue_t* const queue)
+{
+  if(NULL == queue) { return 0; }
+  size_t tail = COMMUNICATION_QUEUE_LOAD(queue->tail);
+  return communication_queue_used(COMMUNICATION_QUEUE_LOAD(queue->head), tail, queue->capacity);
+}
+
+bool communication_queue_empty(const communication_queue_t* const queue)
+{
+  return 0 == communication_queue_count(queue);
+}
+
+bool communication_queue_full(const communication_queue_t* const queue)
+{
+  if(NULL == queue) { return true; }
+  return queue->capacity <= communication_queue_count(queue);
+}
+
+#endif
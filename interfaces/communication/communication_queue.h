@@ -0,0 +1,61 @@
+/**
+ * Zero-copy queue of fixed-size messages for communication channels.
+ *
+ * Producer reserves the next free slot, writes the message directly into it and commits it.
+ * Consumer peeks at the oldest committed slot, uses it in place and releases it.
+ * Slots stay valid until released, so encoded data can be handed to the radio without copies.
+ *
+ * Lock-free for one producer and one consumer, e.g. thread and ISR, or two threads on a multicore host.
+ * Only producer writes head and only consumer writes tail, each index is published with
+ * release and read with acquire ordering, so no critical sections are needed.
+ * Indices run over 2 * capacity so that a full queue can be told apart from an empty one with any capacity.
+ *
+ * Producer must not release and consumer must not reserve: e.g. a repeated message stays in its slot
+ * instead of being pushed back by consumer.
+ */
+#ifndef COMMUNICATION_QUEUE_H
+#define COMMUNICATION_QUEUE_H
+#include "ruuvi_error.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+  uint8_t*        storage;      // capacity * element_size bytes
+  size_t          element_size;
+  size_t          capacity;
+  size_t          head;         // Next slot to commit, written by producer only
+  size_t          tail;         // Oldest committed slot, written by consumer only
+}communication_queue_t;
+
+/**
+ * Initialize queue over storage of capacity * element_size bytes.
+ */
+ruuvi_status_t communication_queue_init(communication_queue_t* const queue, void* const storage,
+                                        const size_t element_size, const size_t capacity);
+
+// Producer: pointer to next free slot, NULL if queue is full. Slot is not visible to consumer before commit.
+void* communication_queue_reserve(communication_queue_t* const queue);
+
+// Producer: publish slot returned by reserve
+void communication_queue_commit(communication_queue_t* const queue);
+
+// Consumer: pointer to oldest committed slot, NULL if queue is empty
+void* communication_queue_peek(const communication_queue_t* const queue);
+
+// Consumer: pointer to index:th committed slot from oldest, NULL if there are not that many
+void* communication_queue_peek_at(const communication_queue_t* const queue, const size_t index);
+
+// Consumer: drop oldest slot, if any
+void communication_queue_release(communication_queue_t* const queue);
+
+// Consumer: drop all committed slots. Producer may call this too if it can not preempt consumer,
+// e.g. thread with ISR consumer, since tail is then replaced in a single store.
+void communication_queue_flush(communication_queue_t* const queue);
+
+size_t communication_queue_count(const communication_queue_t* const queue);
+bool communication_queue_empty(const communication_queue_t* const queue);
+bool communication_queue_full(const communication_queue_t* const queue);
+
+#endif
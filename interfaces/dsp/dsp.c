@@ -0,0 +1,456 @@
+/**
+ * Software DSP stage, see dsp.h.
+ * Filter state is integer, floating point is used only for converting sensor data in and out
+ * and for computing filter coefficients in dsp_set.
+ */
+#include "application_config.h"
+#if DSP_ENGINE
+#include "ruuvi_error.h"
+#include "ruuvi_sensor.h"
+#include "dsp.h"
+#include "dsp_biquad.h"
+#include "dsp_block.h"
+#include <math.h>
+#include <string.h>
+
+#define DSP_ABSENT        INT32_MIN
+// IMPULSE moves its int16 reference to median once median is this far from it
+#define DSP_IMPULSE_RECENTER (INT16_MAX / 4)
+
+// Integer square root, rounded down
+static uint32_t dsp_isqrt(uint64_t value)
+{
+  uint64_t root = 0;
+  uint64_t bit = 1ULL << 62;
+  while(bit > value) { bit >>= 2; }
+  while(0 != bit)
+  {
+    if(value >= root + bit)
+    {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else { root >>= 1; }
+    bit >>= 2;
+  }
+  return (uint32_t)root;
+}
+
+static bool dsp_is_reduction(const ruuvi_sensor_dsp_function_t function)
+{
+  return (RUUVI_SENSOR_DSP_MIN == function)     || (RUUVI_SENSOR_DSP_MAX == function)   ||
+         (RUUVI_SENSOR_DSP_AVERAGE == function) || (RUUVI_SENSOR_DSP_STDEV == function) ||
+         (RUUVI_SENSOR_DSP_OS == function);
+}
+
+ruuvi_status_t dsp_init(dsp_t* const dsp, ruuvi_sensor_t* const sensor, const uint8_t channels, const size_t data_size,
+                        const float* const scale)
+{
+  if(NULL == dsp || NULL == scale) { return RUUVI_ERROR_NULL; }
+  if(0 == channels || DSP_CHANNELS_MAX < channels) { return RUUVI_ERROR_INVALID_PARAM; }
+  if(0 != data_size % sizeof(float) || channels * sizeof(float) > data_size) { return RUUVI_ERROR_INVALID_PARAM; }
+
+  memset(dsp, 0, sizeof(dsp_t));
+  for(uint8_t ii = 0; ii < channels; ii++)
+  {
+    if(0 >= scale[ii]) { return RUUVI_ERROR_INVALID_PARAM; }
+    dsp->scale[ii] = scale[ii];
+  }
+  dsp->sensor = sensor;
+  dsp->channels = channels;
+  dsp->data_size = data_size;
+  dsp->function = RUUVI_SENSOR_DSP_LAST;
+  dsp->parameter = 1;
+  return RUUVI_SUCCESS;
+}
+
+void dsp_reset(dsp_t* const dsp)
+{
+  if(NULL == dsp) { return; }
+  dsp->count = 0;
+  memset(dsp->channel, 0, sizeof(dsp->channel));
+}
+
+// Compute coefficient of software filters. Returns RUUVI_ERROR_NOT_SUPPORTED if function is unknown.
+static ruuvi_status_t dsp_software_configure(dsp_t* const dsp, const ruuvi_sensor_dsp_function_t function, const uint8_t parameter)
+{
+  switch(function)
+  {
+    case RUUVI_SENSOR_DSP_LAST:
+      return RUUVI_SUCCESS;
+
+    case RUUVI_SENSOR_DSP_MIN:
+    case RUUVI_SENSOR_DSP_MAX:
+    case RUUVI_SENSOR_DSP_AVERAGE:
+    case RUUVI_SENSOR_DSP_STDEV:
+    case RUUVI_SENSOR_DSP_OS:
+      return (0 == parameter) ? RUUVI_ERROR_INVALID_PARAM : RUUVI_SUCCESS;
+
+    case RUUVI_SENSOR_DSP_IMPULSE:
+      return (0 == parameter || DSP_IMPULSE_WINDOW_MAX < parameter) ? RUUVI_ERROR_INVALID_PARAM : RUUVI_SUCCESS;
+
+    case RUUVI_SENSOR_DSP_IIR:
+    {
+      // First order section y = x / parameter + (1 - 1 / parameter) * y'
+      if(0 == parameter) { return RUUVI_ERROR_INVALID_PARAM; }
+      int32_t alpha = (int32_t)((1LL << DSP_BIQUAD_Q) / parameter);
+      memset(dsp->filter, 0, sizeof(dsp->filter));
+      dsp->filter[0].b0 = alpha;
+      dsp->filter[0].a1 = alpha - (int32_t)(1LL << DSP_BIQUAD_Q);
+      dsp->stages = 1;
+      return RUUVI_SUCCESS;
+    }
+
+    case RUUVI_SENSOR_DSP_LOW_PASS:
+    case RUUVI_SENSOR_DSP_HIGH_PASS:
+    {
+      if(NULL == dsp->sensor || NULL == dsp->sensor->samplerate_get) { return RUUVI_ERROR_INVALID_STATE; }
+      ruuvi_sensor_samplerate_t rate = 0;
+      ruuvi_status_t err_code = dsp->sensor->samplerate_get(&rate);
+      if(RUUVI_SUCCESS != err_code) { return err_code; }
+      if(0 == rate || RUUVI_SENSOR_SAMPLERATE_SINGLE <= rate) { return RUUVI_ERROR_INVALID_STATE; }
+      if(0 == parameter || (rate / 2) <= parameter) { return RUUVI_ERROR_INVALID_PARAM; }
+      dsp->stages = DSP_FILTER_STAGES;
+      return dsp_biquad_butterworth(dsp->filter, DSP_FILTER_STAGES, (RUUVI_SENSOR_DSP_HIGH_PASS == function),
+                                    parameter, rate);
+    }
+
+    default:
+      return RUUVI_ERROR_NOT_SUPPORTED;
+  }
+}
+
+ruuvi_status_t dsp_set(dsp_t* const dsp, ruuvi_sensor_dsp_function_t* const function, uint8_t* const parameter)
+{
+  if(NULL == dsp || NULL == function || NULL == parameter) { return RUUVI_ERROR_NULL; }
+  ruuvi_status_t err_code = RUUVI_ERROR_NOT_SUPPORTED;
+
+  // Prefer sensor hardware
+  if(NULL != dsp->sensor && NULL != dsp->sensor->dsp_set)
+  {
+    ruuvi_sensor_dsp_function_t hw_function = *function;
+    uint8_t hw_parameter = *parameter;
+    err_code = dsp->sensor->dsp_set(&hw_function, &hw_parameter);
+    if(RUUVI_SUCCESS == err_code)
+    {
+      dsp->function = *function;
+      dsp->parameter = *parameter;
+      dsp->hardware = true;
+      dsp_reset(dsp);
+      return RUUVI_SUCCESS;
+    }
+    if(!(err_code & (RUUVI_ERROR_NOT_SUPPORTED | RUUVI_ERROR_NOT_IMPLEMENTED))) { return err_code; }
+
+    // Leave sensor without processing, errors are ignored as driver might not implement dsp at all.
+    hw_function = RUUVI_SENSOR_DSP_LAST;
+    hw_parameter = 1;
+    dsp->sensor->dsp_set(&hw_function, &hw_parameter);
+  }
+
+  err_code = dsp_software_configure(dsp, *function, *parameter);
+  if(RUUVI_SUCCESS != err_code) { return err_code; }
+  dsp->function = *function;
+  dsp->parameter = *parameter;
+  dsp->hardware = false;
+  dsp_reset(dsp);
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t dsp_get(const dsp_t* const dsp, ruuvi_sensor_dsp_function_t* const function, uint8_t* const parameter)
+{
+  if(NULL == dsp || NULL == function || NULL == parameter) { return RUUVI_ERROR_NULL; }
+  *function = dsp->function;
+  *parameter = dsp->parameter;
+  return RUUVI_SUCCESS;
+}
+
+static void dsp_reduction_add(dsp_channel_t* const state, const int32_t value)
+{
+  if(0 == state->n)
+  {
+    state->shift = value;
+    state->min = value;
+    state->max = value;
+    state->sum = 0;
+    state->sum_sq = 0;
+  }
+  int64_t delta = (int64_t)value - state->shift;
+  state->sum += delta;
+  state->sum_sq += delta * delta;
+  if(value < state->min) { state->min = value; }
+  if(value > state->max) { state->max = value; }
+  state->n++;
+}
+
+static int32_t dsp_reduction_result(const ruuvi_sensor_dsp_function_t function, const dsp_channel_t* const state)
+{
+  if(0 == state->n) { return DSP_ABSENT; }
+  switch(function)
+  {
+    case RUUVI_SENSOR_DSP_MIN:
+      return state->min;
+
+    case RUUVI_SENSOR_DSP_MAX:
+      return state->max;
+
+    case RUUVI_SENSOR_DSP_STDEV:
+    {
+      if(2 > state->n) { return 0; }
+      int64_t squares = state->sum_sq - ((state->sum * state->sum) / state->n);
+      if(0 > squares) { squares = 0; }
+      return (int32_t)dsp_isqrt((uint64_t)squares / (state->n - 1));
+    }
+
+    default:
+    {
+      // Rounded average
+      int64_t sum = state->sum;
+      int64_t half = state->n / 2;
+      int64_t mean = (0 <= sum) ? ((sum + half) / state->n) : ((sum - half) / state->n);
+      return (int32_t)(state->shift + mean);
+    }
+  }
+}
+
+static int32_t dsp_filter(const dsp_t* const dsp, dsp_channel_t* const state, const int32_t value)
+{
+  // Start from steady state of first sample instead of ringing up from 0
+  if(0 == state->n)
+  {
+    dsp_biquad_prime(dsp->filter, state->filter, dsp->stages, value);
+    state->n = 1;
+  }
+  return dsp_biquad_cascade_q31(dsp->filter, state->filter, dsp->stages, value);
+}
+
+/**
+ * Median of int16 deviations from shift, larger deviations are spikes and saturate.
+ * Each time the window has been refilled, shift moves to the median if the median is far from it,
+ * so a signal which drifts beyond int16 from the first sample is followed. Shift moves at most INT16_MAX
+ * per window, a step of d settles within d / INT16_MAX + 2 windows.
+ * n counts samples since shift last moved.
+ */
+static int32_t dsp_impulse(const dsp_t* const dsp, dsp_channel_t* const state, const int32_t value)
+{
+  if(0 == state->n)
+  {
+    dsp_median_init(&state->median, state->median_node, dsp->parameter);
+    state->shift = value;
+  }
+  int64_t delta = (int64_t)value - state->shift;
+  if(INT16_MAX < delta) { delta = INT16_MAX; }
+  if(INT16_MIN > delta) { delta = INT16_MIN; }
+  int16_t median = dsp_median_push(&state->median, (int16_t)delta);
+  int32_t result = state->shift + median;
+  if(++state->n < dsp->parameter) { return result; }
+
+  if(DSP_IMPULSE_RECENTER < median || -DSP_IMPULSE_RECENTER > median)
+  {
+    dsp_median_offset(&state->median, -median);
+    state->shift = result;
+  }
+  // Count restarts from 1, 0 is reserved for uninitialized state
+  state->n = 1;
+  return result;
+}
+
+bool dsp_process(dsp_t* const dsp, const int32_t* const in, const uint8_t valid, int32_t* const out)
+{
+  if(NULL == dsp || NULL == in || NULL == out) { return false; }
+  bool reduction = dsp_is_reduction(dsp->function);
+
+  for(uint8_t ii = 0; ii < dsp->channels; ii++)
+  {
+    dsp_channel_t* state = &(dsp->channel[ii]);
+    bool present = valid & (1U << ii);
+    if(dsp->hardware || RUUVI_SENSOR_DSP_LAST == dsp->function)
+    {
+      out[ii] = present ? in[ii] : DSP_ABSENT;
+    }
+    else if(reduction)
+    {
+      if(present) { dsp_reduction_add(state, in[ii]); }
+    }
+    else if(RUUVI_SENSOR_DSP_IMPULSE == dsp->function)
+    {
+      if(!present) { out[ii] = DSP_ABSENT; continue; }
+      out[ii] = dsp_impulse(dsp, state, in[ii]);
+    }
+    else
+    {
+      out[ii] = present ? dsp_filter(dsp, state, in[ii]) : DSP_ABSENT;
+    }
+  }
+
+  if(!reduction || dsp->hardware) { return true; }
+
+  if(++dsp->count < dsp->parameter) { return false; }
+  for(uint8_t ii = 0; ii < dsp->channels; ii++)
+  {
+    out[ii] = dsp_reduction_result(dsp->function, &(dsp->channel[ii]));
+    dsp->channel[ii].n = 0;
+  }
+  dsp->count = 0;
+  return true;
+}
+
+// Convert value of one float channel to fixed-point, returns false if value is invalid
+static bool dsp_fixed_get(const dsp_t* const dsp, const uint8_t channel, const float value, int32_t* const fixed)
+{
+  if(RUUVI_FLOAT_INVALID == value || isnan(value)) { return false; }
+  *fixed = (int32_t)lrintf(value * dsp->scale[channel]);
+  return true;
+}
+
+// Convert float channels to fixed-point, returns valid mask
+static uint8_t dsp_to_fixed(const dsp_t* const dsp, const float* const sample, int32_t* const fixed)
+{
+  uint8_t valid = 0;
+  for(uint8_t ii = 0; ii < dsp->channels; ii++)
+  {
+    if(dsp_fixed_get(dsp, ii, sample[ii], &fixed[ii])) { valid |= (1U << ii); }
+  }
+  return valid;
+}
+
+static void dsp_to_float(const dsp_t* const dsp, const int32_t* const fixed, float* const sample)
+{
+  for(uint8_t ii = 0; ii < dsp->channels; ii++)
+  {
+    sample[ii] = (DSP_ABSENT == fixed[ii]) ? RUUVI_FLOAT_INVALID : (fixed[ii] / dsp->scale[ii]);
+  }
+}
+
+// Sensor writes its whole data struct, so it is read into caller's buffer and channels are converted from there
+ruuvi_status_t dsp_data_get(dsp_t* const dsp, void* const data, const size_t size)
+{
+  if(NULL == dsp || NULL == data) { return RUUVI_ERROR_NULL; }
+  if(NULL == dsp->sensor || NULL == dsp->sensor->data_get) { return RUUVI_ERROR_INVALID_STATE; }
+  if(dsp->data_size > size) { return RUUVI_ERROR_DATA_SIZE; }
+  if(dsp->hardware || RUUVI_SENSOR_DSP_LAST == dsp->function) { return dsp->sensor->data_get(data); }
+
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  float*  sample = (float*)data;
+  int32_t fixed[DSP_CHANNELS_MAX];
+  int32_t out[DSP_CHANNELS_MAX];
+  bool    ready = false;
+
+  if(RUUVI_SENSOR_DSP_OS == dsp->function)
+  {
+    // Software oversampling takes parameter single measurements
+    if(NULL == dsp->sensor->mode_get || NULL == dsp->sensor->mode_set) { return RUUVI_ERROR_INVALID_STATE; }
+    ruuvi_sensor_mode_t mode = RUUVI_SENSOR_MODE_INVALID;
+    err_code |= dsp->sensor->mode_get(&mode);
+    if(RUUVI_SENSOR_MODE_CONTINOUS == mode) { return RUUVI_ERROR_INVALID_STATE; }
+    dsp_reset(dsp);
+    for(uint8_t ii = 0; ii < dsp->parameter && RUUVI_SUCCESS == err_code; ii++)
+    {
+      mode = RUUVI_SENSOR_MODE_SINGLE_BLOCKING;
+      err_code |= dsp->sensor->mode_set(&mode);
+      err_code |= dsp->sensor->data_get(sample);
+      ready = dsp_process(dsp, fixed, dsp_to_fixed(dsp, sample, fixed), out);
+    }
+  }
+  else
+  {
+    err_code |= dsp->sensor->data_get(sample);
+    if(RUUVI_SUCCESS == err_code) { ready = dsp_process(dsp, fixed, dsp_to_fixed(dsp, sample, fixed), out); }
+  }
+
+  if(RUUVI_SUCCESS != err_code) { return err_code; }
+  if(!ready)
+  {
+    for(uint8_t ii = 0; ii < dsp->channels; ii++) { out[ii] = DSP_ABSENT; }
+  }
+  dsp_to_float(dsp, out, sample);
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Load one channel of a block of parameter samples into reduction state, same as dsp_reduction_add on
+ * each valid sample. Deviations from first valid sample are gathered as int16 for the block kernel,
+ * if some deviation does not fit, samples are added one by one.
+ */
+static void dsp_block_reduce(const dsp_t* const dsp, const float* const block, const uint8_t channel,
+                             int16_t* const column, dsp_channel_t* const state)
+{
+  int32_t shift = 0;
+  int32_t value = 0;
+  uint8_t n = 0;
+  bool    fits = true;
+  for(uint8_t ii = 0; ii < dsp->parameter && fits; ii++)
+  {
+    if(!dsp_fixed_get(dsp, channel, block[(ii * dsp->channels) + channel], &value)) { continue; }
+    if(0 == n) { shift = value; }
+    int64_t delta = (int64_t)value - shift;
+    fits = (INT16_MIN <= delta && INT16_MAX >= delta);
+    column[n++] = (int16_t)delta;
+  }
+
+  state->n = 0;
+  if(!fits)
+  {
+    for(uint8_t ii = 0; ii < dsp->parameter; ii++)
+    {
+      if(dsp_fixed_get(dsp, channel, block[(ii * dsp->channels) + channel], &value)) { dsp_reduction_add(state, value); }
+    }
+    return;
+  }
+  if(0 == n) { return; }
+  dsp_block_sums_t sums;
+  dsp_block_sums_i16(column, n, &sums);
+  state->shift = shift;
+  state->sum = sums.sum;
+  state->sum_sq = sums.sum_sq;
+  state->min = shift + sums.min;
+  state->max = shift + sums.max;
+  state->n = n;
+}
+
+ruuvi_status_t dsp_buffer_get(dsp_t* const dsp, void* const buffer)
+{
+  if(NULL == dsp || NULL == buffer) { return RUUVI_ERROR_NULL; }
+  if(NULL == dsp->sensor || NULL == dsp->sensor->buffer_get) { return RUUVI_ERROR_NOT_SUPPORTED; }
+  ruuvi_status_t err_code = dsp->sensor->buffer_get(buffer);
+  if(RUUVI_SUCCESS != err_code) { return err_code; }
+  if(dsp->hardware || RUUVI_SENSOR_DSP_LAST == dsp->function) { return RUUVI_SUCCESS; }
+
+  dsp_buffer_t* p_buffer = (dsp_buffer_t*)buffer;
+  int32_t fixed[DSP_CHANNELS_MAX];
+  int32_t out[DSP_CHANNELS_MAX];
+  size_t  outputs = 0;
+  size_t  ii = 0;
+
+  // Whole blocks of reductions run through int16 block kernel on each channel. Results are identical
+  // to sample by sample processing, so alignment of blocks to buffer does not matter.
+  if(dsp_is_reduction(dsp->function) && 0 == dsp->count)
+  {
+    int16_t column[UINT8_MAX];
+    for(; ii + dsp->parameter <= p_buffer->count; ii += dsp->parameter)
+    {
+      for(uint8_t ch = 0; ch < dsp->channels; ch++)
+      {
+        dsp_block_reduce(dsp, p_buffer->data + (ii * dsp->channels), ch, column, &(dsp->channel[ch]));
+        out[ch] = dsp_reduction_result(dsp->function, &(dsp->channel[ch]));
+        dsp->channel[ch].n = 0;
+      }
+      dsp_to_float(dsp, out, p_buffer->data + (outputs * dsp->channels));
+      outputs++;
+    }
+  }
+
+  for(; ii < p_buffer->count; ii++)
+  {
+    float* sample = p_buffer->data + (ii * dsp->channels);
+    if(dsp_process(dsp, fixed, dsp_to_fixed(dsp, sample, fixed), out))
+    {
+      // Outputs never overtake inputs, so results can be written in place
+      dsp_to_float(dsp, out, p_buffer->data + (outputs * dsp->channels));
+      outputs++;
+    }
+  }
+  p_buffer->count = outputs;
+  return RUUVI_SUCCESS;
+}
+
+#endif
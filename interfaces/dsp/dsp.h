@@ -0,0 +1,118 @@
+/**
+ * Software DSP stage between a ruuvi_sensor_t and application.
+ *
+ * dsp_set tries the sensor's own dsp_set first and falls back to software if the sensor
+ * returns RUUVI_ERROR_NOT_SUPPORTED or RUUVI_ERROR_NOT_IMPLEMENTED, so every
+ * ruuvi_sensor_dsp_function_t behaves the same regardless of driver.
+ *
+ * Sensor data is handled as an array of float channels, i.e. first floats of a ruuvi_*_data_t
+ * which must be all floats. Values are converted to fixed-point with a per-channel scale,
+ * e.g. 1 for mg or 100 for centi-celsius, and all filter state is integer.
+ *
+ * Functions and parameter:
+ *   LAST:      pass-through.
+ *   MIN, MAX, AVERAGE, STDEV: reduce blocks of parameter samples into one.
+ *   OS:        average of parameter samples. dsp_data_get takes the samples with single measurements.
+ *   IMPULSE:   running median of last parameter samples, at most DSP_IMPULSE_WINDOW_MAX.
+ *              Runs on int16 deviation from a reference which follows the median, see dsp_median.h.
+ *   LOW_PASS:  Butterworth low-pass of order 2 * DSP_FILTER_STAGES, parameter is cutoff in Hz.
+ *              Coefficients are computed from sensor samplerate in dsp_set.
+ *   HIGH_PASS: Butterworth high-pass as above.
+ *   IIR:       y += (x - y) / parameter, like BME280 IIR.
+ * Filters run on fixed-point biquad cascade of dsp_biquad.h, one state per channel.
+ */
+#ifndef DSP_H
+#define DSP_H
+#include "ruuvi_error.h"
+#include "ruuvi_sensor.h"
+#include "dsp_biquad.h"
+#include "dsp_median.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_CHANNELS_MAX        8  // ruuvi_imu_data_t has 7 floats
+// Median window takes 4 bytes per sample and channel, up to DSP_MEDIAN_WINDOW_MAX
+#ifndef DSP_IMPULSE_WINDOW_MAX
+  #define DSP_IMPULSE_WINDOW_MAX 31
+#endif
+#if DSP_IMPULSE_WINDOW_MAX > DSP_MEDIAN_WINDOW_MAX
+  #error "DSP_IMPULSE_WINDOW_MAX is larger than DSP_MEDIAN_WINDOW_MAX"
+#endif
+#define DSP_FILTER_STAGES       1  // Biquads of LOW_PASS and HIGH_PASS, max DSP_BIQUAD_STAGES_MAX
+
+typedef struct
+{
+  int64_t  sum;      // Σ(x - shift), reductions
+  int64_t  sum_sq;   // Σ(x - shift)², STDEV
+  int32_t  shift;    // First sample of block or IMPULSE reference, keeps values small
+  int32_t  min;
+  int32_t  max;
+  uint8_t  n;        // Valid samples in current block or window
+  dsp_biquad_state_t filter[DSP_FILTER_STAGES];
+  dsp_median_t      median;
+  dsp_median_node_t median_node[DSP_IMPULSE_WINDOW_MAX];
+}dsp_channel_t;
+
+typedef struct
+{
+  ruuvi_sensor_t*             sensor;      // Source, may be NULL if samples are pushed with dsp_process
+  ruuvi_sensor_dsp_function_t function;
+  uint8_t                     parameter;
+  bool                        hardware;    // Function is run by sensor
+  uint8_t                     channels;
+  size_t                      data_size;   // Bytes of sensor data struct, channels are its first floats
+  float                       scale[DSP_CHANNELS_MAX];
+  uint8_t                     count;       // Samples in current block
+  dsp_biquad_t                filter[DSP_FILTER_STAGES]; // Filter coefficients
+  uint8_t                     stages;
+  dsp_channel_t               channel[DSP_CHANNELS_MAX];
+}dsp_t;
+
+// Layout of every ruuvi_*_buffer_t
+typedef struct
+{
+  size_t count;
+  float* data;
+}dsp_buffer_t;
+
+/**
+ * Initialize stage for sensor with given number of float channels in its data.
+ * data_size: sizeof sensor's data struct, e.g. sizeof(ruuvi_adc_data_t). Struct must be all floats,
+ *            channels are its first floats. Returns RUUVI_ERROR_INVALID_PARAM if it can not hold channels floats.
+ * scale: multiplier from sensor unit to fixed-point, one per channel.
+ */
+ruuvi_status_t dsp_init(dsp_t* const dsp, ruuvi_sensor_t* const sensor, const uint8_t channels, const size_t data_size,
+                        const float* const scale);
+
+/**
+ * Select function. Sensor hardware is used if it supports the function, otherwise software.
+ * Resets filter state.
+ */
+ruuvi_status_t dsp_set(dsp_t* const dsp, ruuvi_sensor_dsp_function_t* const function, uint8_t* const parameter);
+ruuvi_status_t dsp_get(const dsp_t* const dsp, ruuvi_sensor_dsp_function_t* const function, uint8_t* const parameter);
+
+// Clear filter state and current block
+void dsp_reset(dsp_t* const dsp);
+
+/**
+ * Push one fixed-point sample of all channels. Returns true if out was written.
+ * valid: bitmask of channels present in sample, bit 0 is channel 0. Absent channels in output are INT32_MIN.
+ */
+bool dsp_process(dsp_t* const dsp, const int32_t* const in, const uint8_t valid, int32_t* const out);
+
+/**
+ * Read sensor data through the stage into data of size bytes. Sensor writes its whole struct into data,
+ * channels are then replaced with output. If a reduction has not completed a block yet,
+ * channels are filled with RUUVI_FLOAT_INVALID.
+ * Returns RUUVI_ERROR_DATA_SIZE if size is less than data_size of dsp_init.
+ */
+ruuvi_status_t dsp_data_get(dsp_t* const dsp, void* const data, const size_t size);
+
+/**
+ * Read sensor buffer through the stage, buffer is a ruuvi_*_buffer_t.
+ * Outputs are written to start of buffer and count is set to number of outputs.
+ */
+ruuvi_status_t dsp_buffer_get(dsp_t* const dsp, void* const buffer);
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * Fixed-point biquad cascade, see dsp_biquad.h.
+ * Coefficient design uses float and runs only when filter is configured.
+ */
+#include "application_config.h"
+#if DSP_ENGINE
+#include "ruuvi_error.h"
+#include "dsp_biquad.h"
+#include <math.h>
+
+#define DSP_BIQUAD_ONE  (1LL << DSP_BIQUAD_Q)
+#define DSP_BIQUAD_HALF (1LL << (DSP_BIQUAD_Q - 1))
+#define DSP_BIQUAD_PI   3.14159265358979f
+
+static int32_t dsp_biquad_coeff(const float value)
+{
+  return (int32_t)lrintf(value * (float)DSP_BIQUAD_ONE);
+}
+
+// RBJ audio EQ cookbook filters, normalised by a0
+static ruuvi_status_t dsp_biquad_design(dsp_biquad_t* const coeffs, const bool highpass, const float fc, const float fs, const float q)
+{
+  if(NULL == coeffs) { return RUUVI_ERROR_NULL; }
+  if(0 >= fc || 0 >= fs || (fs / 2) <= fc || 0 >= q) { return RUUVI_ERROR_INVALID_PARAM; }
+
+  float w0 = 2 * DSP_BIQUAD_PI * fc / fs;
+  float cosw = cosf(w0);
+  float alpha = sinf(w0) / (2 * q);
+  float a0 = 1 + alpha;
+
+  coeffs->a1 = dsp_biquad_coeff((-2 * cosw) / a0);
+  coeffs->a2 = dsp_biquad_coeff((1 - alpha) / a0);
+  // With low cutoff 1 + a1 + a2 is tiny, and float rounding of coefficients would be a large DC gain error.
+  // Numerator is derived from quantized poles instead: low-pass has DC gain of exactly 1
+  // and high-pass exactly 0.
+  if(highpass)
+  {
+    coeffs->b0 = dsp_biquad_coeff(((1 + cosw) / 2) / a0);
+    coeffs->b1 = -2 * coeffs->b0;
+  }
+  else
+  {
+    int64_t dc = DSP_BIQUAD_ONE + coeffs->a1 + coeffs->a2;
+    coeffs->b0 = (int32_t)((dc + 2) / 4);
+    coeffs->b1 = (int32_t)(dc - (2 * (int64_t)coeffs->b0));
+  }
+  coeffs->b2 = coeffs->b0;
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t dsp_biquad_lowpass(dsp_biquad_t* const coeffs, const float fc, const float fs, const float q)
+{
+  return dsp_biquad_design(coeffs, false, fc, fs, q);
+}
+
+ruuvi_status_t dsp_biquad_highpass(dsp_biquad_t* const coeffs, const float fc, const float fs, const float q)
+{
+  return dsp_biquad_design(coeffs, true, fc, fs, q);
+}
+
+ruuvi_status_t dsp_biquad_butterworth(dsp_biquad_t* const coeffs, const uint8_t stages, const bool highpass, const float fc, const float fs)
+{
+  if(NULL == coeffs) { return RUUVI_ERROR_NULL; }
+  if(0 == stages || DSP_BIQUAD_STAGES_MAX < stages) { return RUUVI_ERROR_INVALID_PARAM; }
+
+  // Pole pairs of order 2N Butterworth: Q = 1 / (2 cos((2k + 1) pi / 4N))
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  for(uint8_t kk = 0; kk < stages && RUUVI_SUCCESS == err_code; kk++)
+  {
+    float q = 1 / (2 * cosf(((2 * kk + 1) * DSP_BIQUAD_PI) / (4 * stages)));
+    err_code |= dsp_biquad_design(&coeffs[kk], highpass, fc, fs, q);
+  }
+  return err_code;
+}
+
+void dsp_biquad_reset(dsp_biquad_state_t* const state, const uint8_t stages)
+{
+  if(NULL == state) { return; }
+  for(uint8_t kk = 0; kk < stages; kk++)
+  {
+    state[kk].s1 = 0;
+    state[kk].s2 = 0;
+    state[kk].error = 0;
+  }
+}
+
+void dsp_biquad_prime(const dsp_biquad_t* const coeffs, dsp_biquad_state_t* const state, const uint8_t stages, const int32_t x)
+{
+  if(NULL == coeffs || NULL == state) { return; }
+  int64_t in = x;
+  for(uint8_t kk = 0; kk < stages; kk++)
+  {
+    const dsp_biquad_t* c = &coeffs[kk];
+    // DC gain (b0 + b1 + b2) / (1 + a1 + a2)
+    int64_t num = (int64_t)c->b0 + c->b1 + c->b2;
+    int64_t den = DSP_BIQUAD_ONE + c->a1 + c->a2;
+    int64_t out = (0 == den) ? 0 : (in * num) / den;
+    state[kk].s2 = ((int64_t)c->b2 * in) - ((int64_t)c->a2 * out);
+    state[kk].s1 = ((int64_t)c->b1 * in) - ((int64_t)c->a1 * out) + state[kk].s2;
+    state[kk].error = 0;
+    in = out;
+  }
+}
+
+static inline int64_t dsp_biquad_step(const dsp_biquad_t* const c, dsp_biquad_state_t* const s, const int64_t x)
+{
+  int64_t acc = ((int64_t)c->b0 * x) + s->s1 + s->error;
+  int64_t y = (acc + DSP_BIQUAD_HALF) >> DSP_BIQUAD_Q;
+  s->error = (int32_t)(acc - (y * DSP_BIQUAD_ONE));
+  s->s1 = ((int64_t)c->b1 * x) - ((int64_t)c->a1 * y) + s->s2;
+  s->s2 = ((int64_t)c->b2 * x) - ((int64_t)c->a2 * y);
+  return y;
+}
+
+static inline int32_t dsp_biquad_saturate(const int64_t value, const int32_t min, const int32_t max)
+{
+  if(value > max) { return max; }
+  if(value < min) { return min; }
+  return (int32_t)value;
+}
+
+int32_t dsp_biquad_cascade_q31(const dsp_biquad_t* const coeffs, dsp_biquad_state_t* const state, const uint8_t stages, const int32_t x)
+{
+  int64_t y = x;
+  for(uint8_t kk = 0; kk < stages; kk++)
+  {
+    y = dsp_biquad_step(&coeffs[kk], &state[kk], y);
+  }
+  return dsp_biquad_saturate(y, INT32_MIN, INT32_MAX);
+}
+
+void dsp_biquad_cascade_q31_block(const dsp_biquad_t* const coeffs, dsp_biquad_state_t* const state, const uint8_t stages,
+                                  const int32_t* const in, int32_t* const out, const size_t n)
+{
+  if(NULL == coeffs || NULL == state || NULL == in || NULL == out) { return; }
+  for(uint8_t kk = 0; kk < stages; kk++)
+  {
+    const int32_t* src = (0 == kk) ? in : out;
+    for(size_t ii = 0; ii < n; ii++)
+    {
+      out[ii] = dsp_biquad_saturate(dsp_biquad_step(&coeffs[kk], &state[kk], src[ii]), INT32_MIN, INT32_MAX);
+    }
+  }
+}
+
+void dsp_biquad_cascade_q15_block(const dsp_biquad_t* const coeffs, dsp_biquad_state_t* const state, const uint8_t stages,
+                                  const int16_t* const in, int16_t* const out, const size_t n)
+{
+  if(NULL == coeffs || NULL == state || NULL == in || NULL == out) { return; }
+  for(uint8_t kk = 0; kk < stages; kk++)
+  {
+    const int16_t* src = (0 == kk) ? in : out;
+    for(size_t ii = 0; ii < n; ii++)
+    {
+      out[ii] = (int16_t)dsp_biquad_saturate(dsp_biquad_step(&coeffs[kk], &state[kk], src[ii]), INT16_MIN, INT16_MAX);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * Fixed-point biquad cascade in Direct Form II transposed.
+ *
+ * Coefficients are Q2.30 so that a1 of low cutoff filters, close to -2, fits.
+ * a0 is normalised to 1 and stored signs follow y = b0x + b1x' + b2x'' - a1y' - a2y''.
+ * State is kept in 64 bits at coefficient precision, so low cutoff frequencies
+ * do not lose precision in feedback. Samples are Q31 / int32 or Q15 / int16.
+ */
+#ifndef DSP_BIQUAD_H
+#define DSP_BIQUAD_H
+#include "ruuvi_error.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_BIQUAD_Q          30
+#define DSP_BIQUAD_STAGES_MAX 4
+
+typedef struct
+{
+  int32_t b0;
+  int32_t b1;
+  int32_t b2;
+  int32_t a1;
+  int32_t a2;
+}dsp_biquad_t;
+
+typedef struct
+{
+  int64_t s1;
+  int64_t s2;
+  int32_t error; // Rounding residue of last output, fed back to shape quantization noise away from DC
+}dsp_biquad_state_t;
+
+/**
+ * Second order sections designed at run time with the bilinear transform.
+ * fc: cutoff in Hz, must be below fs / 2. q: quality factor, 0.7071 for Butterworth.
+ */
+ruuvi_status_t dsp_biquad_lowpass(dsp_biquad_t* const coeffs, const float fc, const float fs, const float q);
+ruuvi_status_t dsp_biquad_highpass(dsp_biquad_t* const coeffs, const float fc, const float fs, const float q);
+
+/**
+ * Butterworth filter of order 2 * stages as a cascade of biquads.
+ */
+ruuvi_status_t dsp_biquad_butterworth(dsp_biquad_t* const coeffs, const uint8_t stages, const bool highpass, const float fc, const float fs);
+
+// Clear state
+void dsp_biquad_reset(dsp_biquad_state_t* const state, const uint8_t stages);
+
+// Set state to steady state of constant input x, avoids start-up transient
+void dsp_biquad_prime(const dsp_biquad_t* const coeffs, dsp_biquad_state_t* const state, const uint8_t stages, const int32_t x);
+
+// Filter one sample
+int32_t dsp_biquad_cascade_q31(const dsp_biquad_t* const coeffs, dsp_biquad_state_t* const state, const uint8_t stages, const int32_t x);
+
+/**
+ * Filter a block, in and out may be the same array. Each stage runs over the whole block before the next.
+ */
+void dsp_biquad_cascade_q31_block(const dsp_biquad_t* const coeffs, dsp_biquad_state_t* const state, const uint8_t stages,
+                                  const int32_t* const in, int32_t* const out, const size_t n);
+// As above for Q15 data, output saturates to int16.
+void dsp_biquad_cascade_q15_block(const dsp_biquad_t* const coeffs, dsp_biquad_state_t* const state, const uint8_t stages,
+                                  const int16_t* const in, int16_t* const out, const size_t n);
+
+#endif
@@ -0,0 +1,201 @@
+/**
+ * Block statistics kernels, see dsp_block.h.
+ */
+#include "application_config.h"
+#if DSP_ENGINE
+#include "dsp_block.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#endif
+
+// Largest int16 chunk whose int32 sum cannot overflow, and n * Σx² fits in int64
+#define DSP_BLOCK_I16_CHUNK 32768
+// Accumulators in float kernel, independent lanes let compiler vectorize
+#define DSP_BLOCK_LANES 4
+
+void dsp_block_stats_init(dsp_block_stats_t* const stats)
+{
+  if(NULL == stats) { return; }
+  stats->n = 0;
+  stats->mean = 0;
+  stats->m2 = 0;
+  stats->min = FLT_MAX;
+  stats->max = -FLT_MAX;
+}
+
+void dsp_block_stats_merge(dsp_block_stats_t* const into, const dsp_block_stats_t* const from)
+{
+  if(NULL == into || NULL == from || 0 == from->n) { return; }
+  if(0 == into->n)
+  {
+    *into = *from;
+    return;
+  }
+  uint32_t n = into->n + from->n;
+  float delta = from->mean - into->mean;
+  into->mean += delta * ((float)from->n / n);
+  into->m2 += from->m2 + (delta * delta * ((float)into->n * from->n / n));
+  into->n = n;
+  if(from->min < into->min) { into->min = from->min; }
+  if(from->max > into->max) { into->max = from->max; }
+}
+
+float dsp_block_stats_stdev(const dsp_block_stats_t* const stats)
+{
+  if(NULL == stats || 2 > stats->n) { return 0; }
+  return sqrtf(stats->m2 / (stats->n - 1));
+}
+
+// Chunk of at most DSP_BLOCK_I16_CHUNK samples, int32 sum cannot overflow
+static void dsp_block_chunk_i16(const int16_t* const x, const size_t n, dsp_block_sums_t* const sums)
+{
+  int32_t sum = 0;
+  int64_t sum_sq = 0;
+  int16_t min = INT16_MAX;
+  int16_t max = INT16_MIN;
+  size_t ii = 0;
+
+#if defined(__ARM_FEATURE_SIMD32)
+  // Two samples per instruction: SMLAD for sum, SMLALD for sum of squares
+  for(; ii + 1 < n; ii += 2)
+  {
+    int32_t pair;
+    memcpy(&pair, &x[ii], sizeof(pair));
+    sum = __smlad(pair, 0x00010001, sum);
+    sum_sq = __smlald(pair, pair, sum_sq);
+  }
+  for(; ii < n; ii++)
+  {
+    sum += x[ii];
+    sum_sq += (int32_t)x[ii] * x[ii];
+  }
+#else
+  for(; ii < n; ii++)
+  {
+    sum += x[ii];
+    sum_sq += (int32_t)x[ii] * x[ii];
+  }
+#endif
+  for(ii = 0; ii < n; ii++)
+  {
+    min = (x[ii] < min) ? x[ii] : min;
+    max = (x[ii] > max) ? x[ii] : max;
+  }
+
+  sums->n = n;
+  sums->sum = sum;
+  sums->sum_sq = sum_sq;
+  sums->min = min;
+  sums->max = max;
+}
+
+void dsp_block_sums_i16(const int16_t* const x, const size_t n, dsp_block_sums_t* const sums)
+{
+  if(NULL == x || NULL == sums) { return; }
+  sums->n = 0;
+  sums->sum = 0;
+  sums->sum_sq = 0;
+  sums->min = INT16_MAX;
+  sums->max = INT16_MIN;
+  for(size_t start = 0; start < n; start += DSP_BLOCK_I16_CHUNK)
+  {
+    size_t length = ((n - start) < DSP_BLOCK_I16_CHUNK) ? (n - start) : DSP_BLOCK_I16_CHUNK;
+    dsp_block_sums_t chunk;
+    dsp_block_chunk_i16(x + start, length, &chunk);
+    sums->n += chunk.n;
+    sums->sum += chunk.sum;
+    sums->sum_sq += chunk.sum_sq;
+    sums->min = (chunk.min < sums->min) ? chunk.min : sums->min;
+    sums->max = (chunk.max > sums->max) ? chunk.max : sums->max;
+  }
+}
+
+void dsp_block_stats_i16(const int16_t* const x, const size_t n, dsp_block_stats_t* const stats)
+{
+  if(NULL == x || NULL == stats) { return; }
+  dsp_block_stats_init(stats);
+  for(size_t start = 0; start < n; start += DSP_BLOCK_I16_CHUNK)
+  {
+    size_t length = ((n - start) < DSP_BLOCK_I16_CHUNK) ? (n - start) : DSP_BLOCK_I16_CHUNK;
+    dsp_block_sums_t sums;
+    dsp_block_chunk_i16(x + start, length, &sums);
+    // Exact integer sums, n * Σ(x - mean)² = n * Σx² - (Σx)²
+    int64_t scaled_m2 = ((int64_t)length * sums.sum_sq) - (sums.sum * sums.sum);
+    dsp_block_stats_t chunk;
+    chunk.n = length;
+    chunk.mean = (float)sums.sum / length;
+    chunk.m2 = (float)scaled_m2 / length;
+    chunk.min = sums.min;
+    chunk.max = sums.max;
+    dsp_block_stats_merge(stats, &chunk);
+  }
+}
+
+void dsp_block_stats_f32(const float* const x, const size_t n, const size_t stride, dsp_block_stats_t* const stats)
+{
+  if(NULL == x || NULL == stats) { return; }
+  dsp_block_stats_init(stats);
+  if(0 == n || 0 == stride) { return; }
+
+  // First pass: sum, min and max in independent lanes
+  float sum[DSP_BLOCK_LANES] = {0};
+  float min[DSP_BLOCK_LANES];
+  float max[DSP_BLOCK_LANES];
+  for(uint8_t lane = 0; lane < DSP_BLOCK_LANES; lane++)
+  {
+    min[lane] = FLT_MAX;
+    max[lane] = -FLT_MAX;
+  }
+  size_t ii = 0;
+  for(; ii + DSP_BLOCK_LANES <= n; ii += DSP_BLOCK_LANES)
+  {
+    for(uint8_t lane = 0; lane < DSP_BLOCK_LANES; lane++)
+    {
+      float value = x[(ii + lane) * stride];
+      sum[lane] += value;
+      min[lane] = (value < min[lane]) ? value : min[lane];
+      max[lane] = (value > max[lane]) ? value : max[lane];
+    }
+  }
+  for(; ii < n; ii++)
+  {
+    float value = x[ii * stride];
+    sum[0] += value;
+    min[0] = (value < min[0]) ? value : min[0];
+    max[0] = (value > max[0]) ? value : max[0];
+  }
+  float total = 0;
+  for(uint8_t lane = 0; lane < DSP_BLOCK_LANES; lane++)
+  {
+    total += sum[lane];
+    stats->min = (min[lane] < stats->min) ? min[lane] : stats->min;
+    stats->max = (max[lane] > stats->max) ? max[lane] : stats->max;
+  }
+  float mean = total / n;
+
+  // Second pass: squared deviations from block mean, stable unlike Σx² - (Σx)²/n
+  float m2[DSP_BLOCK_LANES] = {0};
+  for(ii = 0; ii + DSP_BLOCK_LANES <= n; ii += DSP_BLOCK_LANES)
+  {
+    for(uint8_t lane = 0; lane < DSP_BLOCK_LANES; lane++)
+    {
+      float delta = x[(ii + lane) * stride] - mean;
+      m2[lane] += delta * delta;
+    }
+  }
+  for(; ii < n; ii++)
+  {
+    float delta = x[ii * stride] - mean;
+    m2[0] += delta * delta;
+  }
+
+  stats->n = n;
+  stats->mean = mean;
+  stats->m2 = 0;
+  for(uint8_t lane = 0; lane < DSP_BLOCK_LANES; lane++) { stats->m2 += m2[lane]; }
+}
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * Block kernels for MIN, MAX, AVERAGE and STDEV over whole sample arrays.
+ *
+ * Each kernel computes count, mean, sum of squared deviations, min and max of a block
+ * in one call. Blocks are combined with the parallel form of Welford's algorithm,
+ * so long streams stay numerically stable without per-sample division.
+ *
+ * Loops are branch-free with independent accumulators so that compilers can vectorize
+ * them. On cores with DSP extension (Cortex-M4/M7) int16 sums use dual 16-bit multiply-accumulate.
+ * dsp_buffer_get runs its reductions on exact int16 sums, float kernel is for float-only data.
+ */
+#ifndef DSP_BLOCK_H
+#define DSP_BLOCK_H
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+  uint32_t n;
+  float    mean;
+  float    m2;   // Σ(x - mean)²
+  float    min;
+  float    max;
+}dsp_block_stats_t;
+
+// Exact integer sums of an int16 block
+typedef struct
+{
+  uint32_t n;
+  int64_t  sum;
+  int64_t  sum_sq;
+  int16_t  min;
+  int16_t  max;
+}dsp_block_sums_t;
+
+void dsp_block_stats_init(dsp_block_stats_t* const stats);
+
+/**
+ * Sum, sum of squares, min and max of n int16 samples, contiguous for dual MAC and SIMD.
+ */
+void dsp_block_sums_i16(const int16_t* const x, const size_t n, dsp_block_sums_t* const sums);
+
+/**
+ * Statistics of n int16 samples, e.g. raw sensor FIFO data. Integer sums are exact.
+ */
+void dsp_block_stats_i16(const int16_t* const x, const size_t n, dsp_block_stats_t* const stats);
+
+/**
+ * Statistics of n float samples, stride is distance of samples in floats.
+ * Stride allows running kernel directly on one channel of a ruuvi_*_buffer_t.
+ */
+void dsp_block_stats_f32(const float* const x, const size_t n, const size_t stride, dsp_block_stats_t* const stats);
+
+// Combine statistics of two blocks into the first one
+void dsp_block_stats_merge(dsp_block_stats_t* const into, const dsp_block_stats_t* const from);
+
+// Sample standard deviation, 0 if there are fewer than 2 samples
+float dsp_block_stats_stdev(const dsp_block_stats_t* const stats);
+
+#endif
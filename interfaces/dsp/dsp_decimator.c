@@ -0,0 +1,179 @@
+/**
+ * CIC decimator with droop compensation, see dsp_decimator.h.
+ */
+#include "application_config.h"
+#if DSP_ENGINE
+#include "ruuvi_error.h"
+#include "dsp_decimator.h"
+#include <math.h>
+#include <string.h>
+
+#define DSP_DECIMATOR_ONE  (1LL << DSP_DECIMATOR_TAP_Q)
+#define DSP_DECIMATOR_HALF (1LL << (DSP_DECIMATOR_TAP_Q - 1))
+#define DSP_DECIMATOR_PI   3.14159265358979f
+
+// Layout of every ruuvi_*_buffer_t
+typedef struct
+{
+  size_t count;
+  float* data;
+}dsp_decimator_buffer_t;
+
+ruuvi_status_t dsp_decimator_init(dsp_decimator_t* const decimator, const uint8_t channels, const uint16_t ratio, const float* const scale)
+{
+  if(NULL == decimator || NULL == scale) { return RUUVI_ERROR_NULL; }
+  if(0 == channels || DSP_DECIMATOR_CHANNELS_MAX < channels) { return RUUVI_ERROR_INVALID_PARAM; }
+  if(2 > ratio || DSP_DECIMATOR_RATIO_MAX < ratio) { return RUUVI_ERROR_INVALID_PARAM; }
+
+  memset(decimator, 0, sizeof(dsp_decimator_t));
+  for(uint8_t ii = 0; ii < channels; ii++)
+  {
+    if(0 >= scale[ii]) { return RUUVI_ERROR_INVALID_PARAM; }
+    decimator->scale[ii] = scale[ii];
+  }
+  decimator->channels = channels;
+  decimator->ratio = ratio;
+  decimator->gain = 1;
+  for(uint8_t ii = 0; ii < DSP_DECIMATOR_ORDER; ii++) { decimator->gain *= ratio; }
+
+  // CIC response is close to sinc(f / fout)^ORDER. FIR [c, 1 - 2c, c] has gain 1 - 2c at fout / 4,
+  // choose c to cancel droop there.
+  float droop = powf(sinf(DSP_DECIMATOR_PI / 4) / (DSP_DECIMATOR_PI / 4), DSP_DECIMATOR_ORDER);
+  decimator->tap = (int32_t)lrintf(((1.0f - (1.0f / droop)) / 2.0f) * DSP_DECIMATOR_ONE);
+  dsp_decimator_reset(decimator);
+  return RUUVI_SUCCESS;
+}
+
+void dsp_decimator_reset(dsp_decimator_t* const decimator)
+{
+  if(NULL == decimator) { return; }
+  for(uint8_t ii = 0; ii < DSP_DECIMATOR_CHANNELS_MAX; ii++)
+  {
+    dsp_decimator_channel_t* state = &(decimator->channel[ii]);
+    memset(state->integrator, 0, sizeof(state->integrator));
+    memset(state->comb, 0, sizeof(state->comb));
+    memset(state->history, 0, sizeof(state->history));
+  }
+  decimator->phase = 0;
+  decimator->settle = DSP_DECIMATOR_ORDER + 2;
+}
+
+// Rounded division of CIC output by its DC gain
+static int32_t dsp_decimator_normalize(const int64_t value, const int64_t gain)
+{
+  int64_t half = gain / 2;
+  return (int32_t)((0 <= value) ? ((value + half) / gain) : ((value - half) / gain));
+}
+
+static int32_t dsp_decimator_saturate(const int64_t value)
+{
+  if(INT32_MAX < value) { return INT32_MAX; }
+  if(INT32_MIN > value) { return INT32_MIN; }
+  return (int32_t)value;
+}
+
+// Comb stages and compensation FIR of one channel, called once per ratio input samples
+static int32_t dsp_decimator_output(const dsp_decimator_t* const decimator, dsp_decimator_channel_t* const state)
+{
+  uint64_t value = state->integrator[DSP_DECIMATOR_ORDER - 1];
+  for(uint8_t kk = 0; kk < DSP_DECIMATOR_ORDER; kk++)
+  {
+    uint64_t previous = state->comb[kk];
+    state->comb[kk] = value;
+    value -= previous;
+  }
+  int32_t cic = dsp_decimator_normalize((int64_t)value, decimator->gain);
+
+  int64_t acc = ((int64_t)decimator->tap * state->history[0])
+              + ((DSP_DECIMATOR_ONE - (2 * (int64_t)decimator->tap)) * state->history[1])
+              + ((int64_t)decimator->tap * cic);
+  state->history[0] = state->history[1];
+  state->history[1] = cic;
+  return dsp_decimator_saturate((acc + DSP_DECIMATOR_HALF) >> DSP_DECIMATOR_TAP_Q);
+}
+
+size_t dsp_decimator_process(dsp_decimator_t* const decimator, const int32_t* const in, const size_t frames,
+                             int32_t* const out, const size_t max_frames)
+{
+  if(NULL == decimator || NULL == in || NULL == out) { return 0; }
+  size_t outputs = 0;
+
+  for(size_t ii = 0; ii < frames && outputs < max_frames; ii++)
+  {
+    const int32_t* frame = in + (ii * decimator->channels);
+    for(uint8_t ch = 0; ch < decimator->channels; ch++)
+    {
+      // Unsigned arithmetic wraps, comb differences are exact as long as result fits
+      uint64_t* integrator = decimator->channel[ch].integrator;
+      integrator[0] += (uint64_t)(int64_t)frame[ch];
+      for(uint8_t kk = 1; kk < DSP_DECIMATOR_ORDER; kk++) { integrator[kk] += integrator[kk - 1]; }
+    }
+    if(++decimator->phase < decimator->ratio) { continue; }
+
+    decimator->phase = 0;
+    for(uint8_t ch = 0; ch < decimator->channels; ch++)
+    {
+      dsp_decimator_channel_t* state = &(decimator->channel[ch]);
+      int32_t value = dsp_decimator_output(decimator, state);
+      if(0 != decimator->settle) { continue; }
+      out[(outputs * decimator->channels) + ch] = value;
+      state->sum += value;
+    }
+    if(0 != decimator->settle)
+    {
+      decimator->settle--;
+      continue;
+    }
+    decimator->count++;
+    outputs++;
+  }
+  return outputs;
+}
+
+ruuvi_status_t dsp_decimator_buffer(dsp_decimator_t* const decimator, void* const buffer)
+{
+  if(NULL == decimator || NULL == buffer) { return RUUVI_ERROR_NULL; }
+  dsp_decimator_buffer_t* p_buffer = (dsp_decimator_buffer_t*)buffer;
+  if(NULL == p_buffer->data) { return RUUVI_ERROR_NULL; }
+
+  int32_t fixed[DSP_DECIMATOR_CHANNELS_MAX];
+  int32_t out[DSP_DECIMATOR_CHANNELS_MAX];
+  size_t  outputs = 0;
+  for(size_t ii = 0; ii < p_buffer->count; ii++)
+  {
+    float* sample = p_buffer->data + (ii * decimator->channels);
+    for(uint8_t ch = 0; ch < decimator->channels; ch++)
+    {
+      dsp_decimator_channel_t* state = &(decimator->channel[ch]);
+      if(RUUVI_FLOAT_INVALID != sample[ch] && !isnan(sample[ch]))
+      {
+        state->last = dsp_decimator_saturate(llrintf(sample[ch] * decimator->scale[ch]));
+      }
+      fixed[ch] = state->last;
+    }
+    if(dsp_decimator_process(decimator, fixed, 1, out, 1))
+    {
+      // Outputs never overtake inputs, so results can be written in place
+      float* result = p_buffer->data + (outputs * decimator->channels);
+      for(uint8_t ch = 0; ch < decimator->channels; ch++) { result[ch] = out[ch] / decimator->scale[ch]; }
+      outputs++;
+    }
+  }
+  p_buffer->count = outputs;
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t dsp_decimator_mean_get(dsp_decimator_t* const decimator, float* const mean)
+{
+  if(NULL == decimator || NULL == mean) { return RUUVI_ERROR_NULL; }
+  for(uint8_t ch = 0; ch < decimator->channels; ch++)
+  {
+    dsp_decimator_channel_t* state = &(decimator->channel[ch]);
+    mean[ch] = (0 == decimator->count) ? RUUVI_FLOAT_INVALID : ((float)state->sum / decimator->count) / decimator->scale[ch];
+    state->sum = 0;
+  }
+  decimator->count = 0;
+  return RUUVI_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * Decimator for high samplerate sensor bursts, e.g. accelerometer FIFO at 400 - 1600 Hz to 10 - 100 Hz.
+ *
+ * Integer CIC filter of DSP_DECIMATOR_ORDER stages decimates by ratio with additions only,
+ * integrators wrap around harmlessly in 64 bits. A 3-tap FIR at output rate compensates
+ * CIC passband droop, response is flat within 4 % up to a quarter of output rate.
+ * Anti-aliasing is that of the CIC: inputs near fout alias close to DC and are attenuated by about 57 dB
+ * at 0.9 fout, but 0.75 fout folds onto the passband edge fout / 4 and is attenuated by only about 28 dB
+ * (sinc^3 -31 dB with +2.7 dB of compensation gain). Keep content above fout / 2 small in input,
+ * e.g. with sensor's own low-pass, if more rejection is needed.
+ * Output is delayed by (ORDER * (ratio - 1) / 2 + ratio) input samples and first
+ * ORDER + 2 outputs are discarded while filter settles.
+ *
+ * Samples are fixed-point with per-channel scale, as in dsp.h. Decimator keeps mean of outputs
+ * since it was last read, e.g. for advertisement payload.
+ */
+#ifndef DSP_DECIMATOR_H
+#define DSP_DECIMATOR_H
+#include "ruuvi_error.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_DECIMATOR_ORDER        3
+#define DSP_DECIMATOR_CHANNELS_MAX 3    // ruuvi_acceleration_data_t
+#define DSP_DECIMATOR_RATIO_MAX    1024 // 32 bit input + ORDER * log2(ratio) must fit in 64 bits
+#define DSP_DECIMATOR_TAP_Q        15
+
+typedef struct
+{
+  uint64_t integrator[DSP_DECIMATOR_ORDER];
+  uint64_t comb[DSP_DECIMATOR_ORDER];
+  int32_t  history[2]; // Previous CIC outputs for compensation FIR, oldest first
+  int64_t  sum;        // Sum of outputs since last mean
+  int32_t  last;       // Last valid input of buffer
+}dsp_decimator_channel_t;
+
+typedef struct
+{
+  uint16_t ratio;
+  uint16_t phase;   // Input samples in current output
+  uint8_t  channels;
+  uint8_t  settle;  // Outputs to discard
+  int64_t  gain;    // ratio ^ ORDER
+  int32_t  tap;     // Outer FIR tap, center tap is 1 - 2 * tap, Q DSP_DECIMATOR_TAP_Q
+  uint32_t count;   // Outputs since last mean
+  float    scale[DSP_DECIMATOR_CHANNELS_MAX];
+  dsp_decimator_channel_t channel[DSP_DECIMATOR_CHANNELS_MAX];
+}dsp_decimator_t;
+
+/**
+ * Initialize decimator. ratio is input rate / output rate, e.g. 1600 Hz / 100 Hz = 16.
+ * scale: multiplier from sensor unit to fixed-point, one per channel, e.g. 4 for 0.25 mg.
+ */
+ruuvi_status_t dsp_decimator_init(dsp_decimator_t* const decimator, const uint8_t channels, const uint16_t ratio, const float* const scale);
+
+// Clear filter state, e.g. after FIFO overflow
+void dsp_decimator_reset(dsp_decimator_t* const decimator);
+
+/**
+ * Decimate frames of interleaved fixed-point channels. out has room for max_frames frames.
+ * Returns number of output frames written, inputs which would produce more outputs are dropped.
+ */
+size_t dsp_decimator_process(dsp_decimator_t* const decimator, const int32_t* const in, const size_t frames,
+                             int32_t* const out, const size_t max_frames);
+
+/**
+ * Decimate a ruuvi_*_buffer_t in place. Count is set to number of outputs.
+ * Invalid samples are replaced by previous sample of channel to keep timing.
+ */
+ruuvi_status_t dsp_decimator_buffer(dsp_decimator_t* const decimator, void* const buffer);
+
+/**
+ * Mean of outputs since previous call in sensor units, RUUVI_FLOAT_INVALID if there were none.
+ */
+ruuvi_status_t dsp_decimator_mean_get(dsp_decimator_t* const decimator, float* const mean);
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ * Fixed-point FFT and spectrum summary, see dsp_fft.h.
+ * Twiddle factors come from a quarter wave sine table which is computed on first use.
+ */
+#include "application_config.h"
+#if DSP_ENGINE
+#include "ruuvi_error.h"
+#include "dsp_block.h"
+#include "dsp_fft.h"
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define DSP_FFT_QUARTER   (DSP_FFT_SIZE_MAX / 4)
+#define DSP_FFT_Q15_ONE   32767
+#define DSP_FFT_HEADROOM  16384.0f // Largest input magnitude, keeps radix-4 butterflies within int16
+#define DSP_FFT_PI        3.14159265358979f
+
+static int16_t dsp_fft_sine[DSP_FFT_QUARTER + 1];
+static bool    dsp_fft_table_ready = false;
+
+static void dsp_fft_table_init(void)
+{
+  if(dsp_fft_table_ready) { return; }
+  for(size_t ii = 0; ii <= DSP_FFT_QUARTER; ii++)
+  {
+    dsp_fft_sine[ii] = (int16_t)lrintf(DSP_FFT_Q15_ONE * sinf((2 * DSP_FFT_PI * ii) / DSP_FFT_SIZE_MAX));
+  }
+  dsp_fft_table_ready = true;
+}
+
+// cos and sin of 2 pi t / DSP_FFT_SIZE_MAX in Q15
+static void dsp_fft_twiddle(const size_t t, int32_t* const cosine, int32_t* const sine)
+{
+  size_t r = t % DSP_FFT_QUARTER;
+  switch((t / DSP_FFT_QUARTER) & 3)
+  {
+    case 0:  *sine =  dsp_fft_sine[r];                   *cosine =  dsp_fft_sine[DSP_FFT_QUARTER - r]; break;
+    case 1:  *sine =  dsp_fft_sine[DSP_FFT_QUARTER - r]; *cosine = -dsp_fft_sine[r];                   break;
+    case 2:  *sine = -dsp_fft_sine[r];                   *cosine = -dsp_fft_sine[DSP_FFT_QUARTER - r]; break;
+    default: *sine = -dsp_fft_sine[DSP_FFT_QUARTER - r]; *cosine =  dsp_fft_sine[r];                   break;
+  }
+}
+
+// Scale butterfly sum by radix and multiply with e^(-j 2 pi t / DSP_FFT_SIZE_MAX)
+static inline void dsp_fft_store(dsp_fft_complex_t* const out, int32_t re, int32_t im, const uint8_t shift, const size_t t)
+{
+  int32_t half = 1 << (shift - 1);
+  re = (re + half) >> shift;
+  im = (im + half) >> shift;
+  if(0 != t)
+  {
+    int32_t cosine, sine;
+    dsp_fft_twiddle(t, &cosine, &sine);
+    int32_t rotated_re = ((re * cosine) + (im * sine) + (1 << 14)) >> 15;
+    int32_t rotated_im = ((im * cosine) - (re * sine) + (1 << 14)) >> 15;
+    re = rotated_re;
+    im = rotated_im;
+  }
+  out->re = (int16_t)re;
+  out->im = (int16_t)im;
+}
+
+static void dsp_fft_radix4(dsp_fft_complex_t* const data, const size_t n, const size_t size)
+{
+  size_t span = size / 4;
+  size_t step = DSP_FFT_SIZE_MAX / size;
+  for(size_t base = 0; base < n; base += size)
+  {
+    for(size_t jj = 0; jj < span; jj++)
+    {
+      dsp_fft_complex_t* x0 = &data[base + jj];
+      dsp_fft_complex_t* x1 = x0 + span;
+      dsp_fft_complex_t* x2 = x1 + span;
+      dsp_fft_complex_t* x3 = x2 + span;
+      int32_t t0_re = x0->re + x2->re, t0_im = x0->im + x2->im;
+      int32_t t1_re = x0->re - x2->re, t1_im = x0->im - x2->im;
+      int32_t t2_re = x1->re + x3->re, t2_im = x1->im + x3->im;
+      int32_t t3_re = x1->re - x3->re, t3_im = x1->im - x3->im;
+      size_t t = jj * step;
+      // Output group q holds bins q mod 4, -j t3 for q = 1 and +j t3 for q = 3
+      dsp_fft_store(x0, t0_re + t2_re, t0_im + t2_im, 2, 0);
+      dsp_fft_store(x1, t1_re + t3_im, t1_im - t3_re, 2, t);
+      dsp_fft_store(x2, t0_re - t2_re, t0_im - t2_im, 2, 2 * t);
+      dsp_fft_store(x3, t1_re - t3_im, t1_im + t3_re, 2, 3 * t);
+    }
+  }
+}
+
+static void dsp_fft_radix2(dsp_fft_complex_t* const data, const size_t n)
+{
+  for(size_t base = 0; base < n; base += 2)
+  {
+    dsp_fft_complex_t* x0 = &data[base];
+    dsp_fft_complex_t* x1 = x0 + 1;
+    int32_t sum_re = x0->re + x1->re, sum_im = x0->im + x1->im;
+    int32_t diff_re = x0->re - x1->re, diff_im = x0->im - x1->im;
+    dsp_fft_store(x0, sum_re, sum_im, 1, 0);
+    dsp_fft_store(x1, diff_re, diff_im, 1, 0);
+  }
+}
+
+static bool dsp_fft_size_valid(const size_t n)
+{
+  return (256 == n) || (512 == n) || (1024 == n);
+}
+
+ruuvi_status_t dsp_fft_q15(dsp_fft_complex_t* const data, const size_t n)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  if(!dsp_fft_size_valid(n)) { return RUUVI_ERROR_INVALID_PARAM; }
+  dsp_fft_table_init();
+
+  size_t size = n;
+  for(; 4 <= size; size /= 4) { dsp_fft_radix4(data, n, size); }
+  if(2 == size) { dsp_fft_radix2(data, n); }
+  return RUUVI_SUCCESS;
+}
+
+size_t dsp_fft_bin(const size_t k, const size_t n)
+{
+  // First stage puts k mod radix into most significant digit of position, and so on
+  size_t position = 0;
+  size_t rest = k;
+  for(size_t size = n; 1 < size;)
+  {
+    size_t radix = (4 <= size) ? 4 : 2;
+    size /= radix;
+    position += (rest % radix) * size;
+    rest /= radix;
+  }
+  return position;
+}
+
+static uint32_t dsp_fft_power_at(const dsp_fft_complex_t* const work, const size_t k, const size_t n)
+{
+  uint32_t power;
+  memcpy(&power, &work[dsp_fft_bin(k, n)], sizeof(power));
+  return power;
+}
+
+ruuvi_status_t dsp_fft_summary(const float* const x, const size_t n, const size_t stride, const float samplerate,
+                               const dsp_fft_window_t window, const uint8_t peaks, dsp_fft_complex_t* const work,
+                               dsp_fft_summary_t* const summary)
+{
+  if(NULL == x || NULL == work || NULL == summary) { return RUUVI_ERROR_NULL; }
+  if(!dsp_fft_size_valid(n) || 0 == stride || 0 >= samplerate || DSP_FFT_PEAKS_MAX < peaks) { return RUUVI_ERROR_INVALID_PARAM; }
+  dsp_fft_table_init();
+
+  dsp_block_stats_t stats;
+  dsp_block_stats_f32(x, n, stride, &stats);
+  if(RUUVI_FLOAT_INVALID == stats.max) { return RUUVI_ERROR_INVALID_PARAM; }
+  float deviation = ((stats.max - stats.mean) > (stats.mean - stats.min)) ? (stats.max - stats.mean) : (stats.mean - stats.min);
+  summary->rms = sqrtf(stats.m2 / n);
+  summary->crest = (0 < summary->rms) ? (deviation / summary->rms) : 0;
+  summary->peaks = 0;
+  if(0 >= deviation) { return RUUVI_SUCCESS; }
+
+  // Remove mean and normalize to full scale, block floating point
+  float gain = DSP_FFT_HEADROOM / deviation;
+  for(size_t ii = 0; ii < n; ii++)
+  {
+    float w = 1.0f;
+    if(DSP_FFT_WINDOW_HANN == window)
+    {
+      int32_t cosine, sine;
+      dsp_fft_twiddle(ii * (DSP_FFT_SIZE_MAX / n), &cosine, &sine);
+      w = 0.5f - (0.5f * cosine / DSP_FFT_Q15_ONE);
+    }
+    work[ii].re = (int16_t)lrintf((x[ii * stride] - stats.mean) * gain * w);
+    work[ii].im = 0;
+  }
+  dsp_fft_q15(work, n);
+
+  // Replace bins with their power
+  for(size_t ii = 0; ii < n; ii++)
+  {
+    uint32_t power = (uint32_t)((int32_t)work[ii].re * work[ii].re) + (uint32_t)((int32_t)work[ii].im * work[ii].im);
+    memcpy(&work[ii], &power, sizeof(power));
+  }
+
+  // Largest local maxima, insertion sorted
+  size_t   bins[DSP_FFT_PEAKS_MAX];
+  uint32_t powers[DSP_FFT_PEAKS_MAX];
+  uint8_t  found = 0;
+  for(size_t k = 1; k < n / 2; k++)
+  {
+    uint32_t power = dsp_fft_power_at(work, k, n);
+    if(0 == power || power <= dsp_fft_power_at(work, k - 1, n) || power < dsp_fft_power_at(work, k + 1, n)) { continue; }
+    if(found == peaks && (0 == peaks || power <= powers[found - 1])) { continue; }
+    uint8_t at = (found < peaks) ? found++ : (found - 1);
+    while(0 < at && powers[at - 1] < power)
+    {
+      powers[at] = powers[at - 1];
+      bins[at] = bins[at - 1];
+      at--;
+    }
+    powers[at] = power;
+    bins[at] = k;
+  }
+
+  // Parabolic interpolation of magnitude around each peak
+  float coherent_gain = (DSP_FFT_WINDOW_HANN == window) ? 0.5f : 1.0f;
+  for(uint8_t ii = 0; ii < found; ii++)
+  {
+    float left   = sqrtf((float)dsp_fft_power_at(work, bins[ii] - 1, n));
+    float center = sqrtf((float)powers[ii]);
+    float right  = sqrtf((float)dsp_fft_power_at(work, bins[ii] + 1, n));
+    float curve  = left - (2 * center) + right;
+    float delta  = (0 != curve) ? (0.5f * (left - right) / curve) : 0;
+    float magnitude = center - (0.25f * (left - right) * delta);
+    summary->peak[ii].frequency = (bins[ii] + delta) * samplerate / n;
+    summary->peak[ii].amplitude = (2 * magnitude) / (gain * coherent_gain);
+  }
+  summary->peaks = found;
+  return RUUVI_SUCCESS;
+}
+
+static void dsp_fft_put_u16(uint8_t* const payload, const float value)
+{
+  float scaled = value * 10;
+  uint16_t encoded = (0 >= scaled) ? 0 : ((UINT16_MAX <= scaled) ? UINT16_MAX : (uint16_t)lrintf(scaled));
+  payload[0] = encoded >> 8;
+  payload[1] = encoded & 0xFF;
+}
+
+ruuvi_status_t dsp_fft_summary_encode(const dsp_fft_summary_t* const summary, uint8_t* const payload, size_t* const length)
+{
+  if(NULL == summary || NULL == payload || NULL == length) { return RUUVI_ERROR_NULL; }
+  if(DSP_FFT_PEAKS_MAX < summary->peaks) { return RUUVI_ERROR_INVALID_PARAM; }
+  if(DSP_FFT_SUMMARY_LENGTH(summary->peaks) > *length) { return RUUVI_ERROR_NO_MEM; }
+
+  float crest = summary->crest * 10;
+  dsp_fft_put_u16(&payload[0], summary->rms);
+  payload[2] = (0 >= crest) ? 0 : ((UINT8_MAX <= crest) ? UINT8_MAX : (uint8_t)lrintf(crest));
+  payload[3] = summary->peaks;
+  for(uint8_t ii = 0; ii < summary->peaks; ii++)
+  {
+    dsp_fft_put_u16(&payload[4 + (4 * ii)], summary->peak[ii].frequency);
+    dsp_fft_put_u16(&payload[6 + (4 * ii)], summary->peak[ii].amplitude);
+  }
+  *length = DSP_FFT_SUMMARY_LENGTH(summary->peaks);
+  return RUUVI_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * Fixed-point FFT and vibration spectrum summary.
+ *
+ * Radix-4 decimation in frequency on Q15 complex data, 256, 512 or 1024 points.
+ * 512 points run radix-4 stages and one radix-2 stage. Each stage scales by its radix,
+ * so output is DFT / n and cannot overflow if input magnitude is below 2^15 / sqrt(2).
+ * Output is left in digit-reversed order, dsp_fft_bin gives the position of a frequency bin.
+ *
+ * dsp_fft_summary reduces a block of real sensor samples, e.g. one axis of
+ * ruuvi_acceleration_buffer_t, to RMS, crest factor and the largest spectral peaks,
+ * which is a fraction of the raw data size to transmit.
+ */
+#ifndef DSP_FFT_H
+#define DSP_FFT_H
+#include "ruuvi_error.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_FFT_SIZE_MAX  1024
+#define DSP_FFT_PEAKS_MAX 8
+#define DSP_FFT_SUMMARY_LENGTH(peaks) (4U + (4U * (peaks))) // bytes
+
+typedef enum
+{
+  DSP_FFT_WINDOW_RECTANGULAR,
+  DSP_FFT_WINDOW_HANN       // Lower leakage between peaks, wider main lobe
+}dsp_fft_window_t;
+
+typedef struct
+{
+  int16_t re;
+  int16_t im;
+}dsp_fft_complex_t;
+
+typedef struct
+{
+  float frequency; // Hz, interpolated between bins
+  float amplitude; // Sensor units, amplitude of sinusoid
+}dsp_fft_peak_t;
+
+typedef struct
+{
+  float          rms;   // Of signal with mean removed
+  float          crest; // Peak deviation from mean / RMS
+  uint8_t        peaks;
+  dsp_fft_peak_t peak[DSP_FFT_PEAKS_MAX]; // Largest first
+}dsp_fft_summary_t;
+
+/**
+ * Forward FFT in place. n must be 256, 512 or 1024.
+ */
+ruuvi_status_t dsp_fft_q15(dsp_fft_complex_t* const data, const size_t n);
+
+// Position of frequency bin k in output of dsp_fft_q15
+size_t dsp_fft_bin(const size_t k, const size_t n);
+
+/**
+ * Summarize n samples, stride is distance of samples in floats. work has room for n complex values.
+ * Up to peaks local maxima of spectrum are returned, DC is excluded.
+ */
+ruuvi_status_t dsp_fft_summary(const float* const x, const size_t n, const size_t stride, const float samplerate,
+                               const dsp_fft_window_t window, const uint8_t peaks, dsp_fft_complex_t* const work,
+                               dsp_fft_summary_t* const summary);
+
+/**
+ * Pack summary into DSP_FFT_SUMMARY_LENGTH(summary->peaks) bytes, big-endian, values saturate:
+ *   0-1: RMS, 0.1 units    2: crest factor, 0.1    3: number of peaks
+ *   4 + 4i: peak frequency, 0.1 Hz    6 + 4i: peak amplitude, 0.1 units
+ * length: size of payload as input, bytes written as output.
+ */
+ruuvi_status_t dsp_fft_summary_encode(const dsp_fft_summary_t* const summary, uint8_t* const payload, size_t* const length);
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ * Sliding window median, see dsp_median.h.
+ * Heap positions are counted from the top of each heap, dsp_median_index maps them to the shared array.
+ */
+#include "application_config.h"
+#if DSP_ENGINE
+#include "ruuvi_error.h"
+#include "dsp_median.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DSP_MEDIAN_LOW  false
+#define DSP_MEDIAN_HIGH true
+
+static inline uint8_t dsp_median_index(const dsp_median_t* const m, const bool high, const uint16_t p)
+{
+  return high ? (uint8_t)(m->window - 1 - p) : (uint8_t)p;
+}
+
+static inline int16_t dsp_median_value(const dsp_median_t* const m, const bool high, const uint16_t p)
+{
+  return m->node[m->node[dsp_median_index(m, high, p)].heap].value;
+}
+
+// True if element at a belongs above element at b
+static inline bool dsp_median_above(const dsp_median_t* const m, const bool high, const uint16_t a, const uint16_t b)
+{
+  int16_t va = dsp_median_value(m, high, a);
+  int16_t vb = dsp_median_value(m, high, b);
+  return high ? (va < vb) : (va > vb);
+}
+
+static void dsp_median_place(dsp_median_t* const m, const uint8_t index, const uint8_t slot)
+{
+  m->node[index].heap = slot;
+  m->node[slot].at = index;
+}
+
+static void dsp_median_swap(dsp_median_t* const m, const bool high, const uint16_t a, const uint16_t b)
+{
+  uint8_t ia = dsp_median_index(m, high, a);
+  uint8_t ib = dsp_median_index(m, high, b);
+  uint8_t slot = m->node[ia].heap;
+  dsp_median_place(m, ia, m->node[ib].heap);
+  dsp_median_place(m, ib, slot);
+}
+
+static uint16_t dsp_median_sift_up(dsp_median_t* const m, const bool high, uint16_t p)
+{
+  while(0 < p)
+  {
+    uint16_t parent = (p - 1) / 2;
+    if(!dsp_median_above(m, high, p, parent)) { break; }
+    dsp_median_swap(m, high, p, parent);
+    p = parent;
+  }
+  return p;
+}
+
+static void dsp_median_sift_down(dsp_median_t* const m, const bool high, uint16_t p)
+{
+  uint16_t size = high ? m->high : m->low;
+  while(true)
+  {
+    uint16_t child = (2 * p) + 1;
+    if(child >= size) { break; }
+    if(child + 1 < size && dsp_median_above(m, high, child + 1, child)) { child++; }
+    if(!dsp_median_above(m, high, child, p)) { break; }
+    dsp_median_swap(m, high, child, p);
+    p = child;
+  }
+}
+
+static void dsp_median_insert(dsp_median_t* const m, const bool high, const uint8_t slot)
+{
+  uint16_t p = high ? m->high++ : m->low++;
+  dsp_median_place(m, dsp_median_index(m, high, p), slot);
+  dsp_median_sift_up(m, high, p);
+}
+
+// Remove top of heap and return its slot
+static uint8_t dsp_median_pop(dsp_median_t* const m, const bool high)
+{
+  uint8_t slot = m->node[dsp_median_index(m, high, 0)].heap;
+  uint16_t last = high ? --m->high : --m->low;
+  if(0 != last)
+  {
+    dsp_median_place(m, dsp_median_index(m, high, 0), m->node[dsp_median_index(m, high, last)].heap);
+    dsp_median_sift_down(m, high, 0);
+  }
+  return slot;
+}
+
+ruuvi_status_t dsp_median_init(dsp_median_t* const median, dsp_median_node_t* const arena, const uint8_t window)
+{
+  if(NULL == median || NULL == arena) { return RUUVI_ERROR_NULL; }
+  if(0 == window) { return RUUVI_ERROR_INVALID_PARAM; }
+  median->node = arena;
+  median->window = window;
+  dsp_median_reset(median);
+  return RUUVI_SUCCESS;
+}
+
+void dsp_median_reset(dsp_median_t* const median)
+{
+  if(NULL == median) { return; }
+  median->count = 0;
+  median->head = 0;
+  median->low = 0;
+  median->high = 0;
+}
+
+int16_t dsp_median_push(dsp_median_t* const median, const int16_t value)
+{
+  if(NULL == median || NULL == median->node) { return 0; }
+  dsp_median_t* const m = median;
+  uint8_t slot = m->head;
+  m->node[slot].value = value;
+
+  if(m->count < m->window)
+  {
+    // Filling: insert into half given by current median, keep low == high or low == high + 1
+    bool high = (0 != m->low) && (value > dsp_median_value(m, DSP_MEDIAN_LOW, 0));
+    dsp_median_insert(m, high, slot);
+    m->count++;
+    if(m->low > m->high + 1)  { dsp_median_insert(m, DSP_MEDIAN_HIGH, dsp_median_pop(m, DSP_MEDIAN_LOW)); }
+    else if(m->high > m->low) { dsp_median_insert(m, DSP_MEDIAN_LOW, dsp_median_pop(m, DSP_MEDIAN_HIGH)); }
+  }
+  else
+  {
+    // Replace oldest sample in its own heap
+    uint8_t at = m->node[slot].at;
+    bool high = at >= (m->window - m->high);
+    uint16_t p = high ? (m->window - 1 - at) : at;
+    dsp_median_sift_down(m, high, dsp_median_sift_up(m, high, p));
+  }
+
+  // Only the new sample can be on the wrong side, one exchange of tops restores order
+  if(0 != m->high && dsp_median_value(m, DSP_MEDIAN_LOW, 0) > dsp_median_value(m, DSP_MEDIAN_HIGH, 0))
+  {
+    uint8_t low_index = dsp_median_index(m, DSP_MEDIAN_LOW, 0);
+    uint8_t high_index = dsp_median_index(m, DSP_MEDIAN_HIGH, 0);
+    uint8_t low_slot = m->node[low_index].heap;
+    dsp_median_place(m, low_index, m->node[high_index].heap);
+    dsp_median_place(m, high_index, low_slot);
+    dsp_median_sift_down(m, DSP_MEDIAN_LOW, 0);
+    dsp_median_sift_down(m, DSP_MEDIAN_HIGH, 0);
+  }
+
+  m->head = (m->head + 1 < m->window) ? (m->head + 1) : 0;
+  return dsp_median_get(m);
+}
+
+int16_t dsp_median_get(const dsp_median_t* const median)
+{
+  if(NULL == median || 0 == median->low) { return 0; }
+  int16_t mid = dsp_median_value(median, DSP_MEDIAN_LOW, 0);
+  if(median->low > median->high) { return mid; }
+  int32_t sum = (int32_t)mid + dsp_median_value(median, DSP_MEDIAN_HIGH, 0);
+  return (int16_t)((sum >= 0) ? (sum / 2) : ((sum - 1) / 2));
+}
+
+void dsp_median_offset(dsp_median_t* const median, const int32_t offset)
+{
+  if(NULL == median || NULL == median->node) { return; }
+  for(uint16_t ii = 0; ii < median->window; ii++)
+  {
+    int32_t value = median->node[ii].value + offset;
+    if(INT16_MAX < value) { value = INT16_MAX; }
+    if(INT16_MIN > value) { value = INT16_MIN; }
+    median->node[ii].value = (int16_t)value;
+  }
+}
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * Sliding window median of int16 samples in O(log n) per sample.
+ *
+ * Window is split into a max-heap of the lower half and a min-heap of the upper half,
+ * median is at the top of the heaps. Both heaps share one array of slot indices in the
+ * arena, lower half grows from the start and upper half from the end.
+ * Each new sample replaces the oldest one in place and is sifted into position,
+ * no memory is allocated. Arena has one node per sample of the window, 4 bytes each.
+ */
+#ifndef DSP_MEDIAN_H
+#define DSP_MEDIAN_H
+#include "ruuvi_error.h"
+#include <stdint.h>
+
+#define DSP_MEDIAN_WINDOW_MAX 255
+
+typedef struct
+{
+  int16_t value; // Sample in this slot of window
+  uint8_t at;    // Index of this slot in heap array
+  uint8_t heap;  // Heap array: slot at this index
+}dsp_median_node_t;
+
+typedef struct
+{
+  dsp_median_node_t* node;
+  uint8_t window;
+  uint8_t count;  // Samples in window, < window while filling
+  uint8_t head;   // Oldest slot
+  uint8_t low;    // Size of lower half
+  uint8_t high;   // Size of upper half
+}dsp_median_t;
+
+/**
+ * Initialize median over window samples. arena must have window nodes and outlive median.
+ */
+ruuvi_status_t dsp_median_init(dsp_median_t* const median, dsp_median_node_t* const arena, const uint8_t window);
+
+// Drop all samples
+void dsp_median_reset(dsp_median_t* const median);
+
+/**
+ * Add sample, oldest sample is dropped if window is full. Returns median of window.
+ * Median of even number of samples is the rounded down mean of the middle two.
+ */
+int16_t dsp_median_push(dsp_median_t* const median, const int16_t value);
+
+// Median of window, 0 if window is empty
+int16_t dsp_median_get(const dsp_median_t* const median);
+
+/**
+ * Add offset to every sample in window, results saturate to int16. Saturation keeps order of samples,
+ * so heaps stay valid. O(window), for re-centering samples stored as deviations from a reference.
+ */
+void dsp_median_offset(dsp_median_t* const median, const int32_t offset);
+
+#endif
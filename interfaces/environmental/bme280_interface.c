@@ -3,7 +3,9 @@
  * Requires Bosch BME280_driver, available under BSD-3 on GitHub.
  * Requires "application_config.h", will only get compiled if BME280_ENVIRONMENTAL is defined
  * Requires "boards.h" for slave select pin
- * Requires BME280_FLOAT_ENABLE defined in makefile. 
+ * Uses floating point compensation if BME280_FLOAT_ENABLE is defined in makefile,
+ * otherwise Bosch 32-bit integer compensation, or 64-bit pressure compensation if
+ * BME280_64BIT_ENABLE is defined.
  */
 
 #include "application_config.h" //TODO: write default header on driver repository
@@ -21,9 +23,6 @@
 #include "bme280.h"
 #include "bme280_defs.h"
 #include "bme280_selftest.h"
-#ifndef BME280_FLOAT_ENABLE
-  #error "Please #define BME280_FLOAT_ENABLE in makefile CFLAGS"
-#endif
 
 // Platform functions
 #include "spi.h"
@@ -73,10 +72,9 @@ ruuvi_status_t bme280_interface_init(ruuvi_sensor_t* environmental_sensor)
   // NRF_LOG_INFO("BME self-test status: %X", err_code);
   err_code |= BME_TO_RUUVI_ERROR(bme280_soft_reset(&dev));
   // NRF_LOG_INFO("BME reset status: %X", err_code);
-  // Setup Oversampling 1 to enable sensor
-  ruuvi_sensor_dsp_function_t dsp = RUUVI_SENSOR_DSP_OS;
-  uint8_t dsp_parameter = 1;
-  err_code |= bme280_interface_dsp_set(&dsp, &dsp_parameter);
+  // Setup Oversampling 1 on all channels to enable sensor, IIR off
+  err_code |= bme280_interface_oversampling_set(1, 1, 1);
+  err_code |= bme280_interface_iir_set(1);
   
   if (RUUVI_SUCCESS == err_code)
   {
@@ -156,8 +154,133 @@ ruuvi_status_t bme280_interface_scale_get(ruuvi_sensor_scale_t* scale)
   return RUUVI_ERROR_NOT_SUPPORTED;
 }
 
+/** Convert oversampling ratio to BME280 setting. Ratio 0 skips the measurement. **/
+static ruuvi_status_t bme280_oversampling_encode(const uint8_t ratio, uint8_t* const osr)
+{
+  switch(ratio)
+  {
+    case 0:  *osr = BME280_NO_OVERSAMPLING;  break;
+    case 1:  *osr = BME280_OVERSAMPLING_1X;  break;
+    case 2:  *osr = BME280_OVERSAMPLING_2X;  break;
+    case 4:  *osr = BME280_OVERSAMPLING_4X;  break;
+    case 8:  *osr = BME280_OVERSAMPLING_8X;  break;
+    case 16: *osr = BME280_OVERSAMPLING_16X; break;
+    default: return RUUVI_ERROR_NOT_SUPPORTED;
+  }
+  return RUUVI_SUCCESS;
+}
+
+static uint8_t bme280_oversampling_decode(const uint8_t osr)
+{
+  switch(osr)
+  {
+    case BME280_OVERSAMPLING_1X:  return 1;
+    case BME280_OVERSAMPLING_2X:  return 2;
+    case BME280_OVERSAMPLING_4X:  return 4;
+    case BME280_OVERSAMPLING_8X:  return 8;
+    case BME280_OVERSAMPLING_16X: return 16;
+    default: return 0;
+  }
+}
+
+/** Convert IIR coefficient to BME280 setting. Coefficient 1 disables the filter. **/
+static ruuvi_status_t bme280_iir_encode(const uint8_t coefficient, uint8_t* const filter)
+{
+  switch(coefficient)
+  {
+    case 1:  *filter = BME280_FILTER_COEFF_OFF; break;
+    case 2:  *filter = BME280_FILTER_COEFF_2;   break;
+    case 4:  *filter = BME280_FILTER_COEFF_4;   break;
+    case 8:  *filter = BME280_FILTER_COEFF_8;   break;
+    case 16: *filter = BME280_FILTER_COEFF_16;  break;
+    default: return RUUVI_ERROR_NOT_SUPPORTED;
+  }
+  return RUUVI_SUCCESS;
+}
+
+static uint8_t bme280_iir_decode(const uint8_t filter)
+{
+  switch(filter)
+  {
+    case BME280_FILTER_COEFF_2:  return 2;
+    case BME280_FILTER_COEFF_4:  return 4;
+    case BME280_FILTER_COEFF_8:  return 8;
+    case BME280_FILTER_COEFF_16: return 16;
+    default: return 1;
+  }
+}
+
+/**
+ * Set oversampling of each channel separately. Valid ratios are 0, 1, 2, 4, 8 and 16.
+ * Ratio 0 skips the channel entirely, which shortens measurement time.
+ * Temperature cannot be skipped as pressure and humidity compensation requires it.
+ */
+ruuvi_status_t bme280_interface_oversampling_set(const uint8_t temperature, const uint8_t pressure, const uint8_t humidity)
+{
+  uint8_t osr_t, osr_p, osr_h;
+  if(0 == temperature) { return RUUVI_ERROR_NOT_SUPPORTED; }
+  if(RUUVI_SUCCESS != bme280_oversampling_encode(temperature, &osr_t)
+     || RUUVI_SUCCESS != bme280_oversampling_encode(pressure, &osr_p)
+     || RUUVI_SUCCESS != bme280_oversampling_encode(humidity, &osr_h))
+  {
+    PLATFORM_LOG_INFO("Invalid oversampling");
+    return RUUVI_ERROR_NOT_SUPPORTED;
+  }
+  dev.settings.osr_t = osr_t;
+  dev.settings.osr_p = osr_p;
+  dev.settings.osr_h = osr_h;
+  uint8_t settings_sel = BME280_OSR_PRESS_SEL | BME280_OSR_TEMP_SEL | BME280_OSR_HUM_SEL;
+  return BME_TO_RUUVI_ERROR(bme280_set_sensor_settings(settings_sel, &dev));
+}
+
+/** Read oversampling ratios from cached state, 0 if channel is skipped **/
+ruuvi_status_t bme280_interface_oversampling_get(uint8_t* const temperature, uint8_t* const pressure, uint8_t* const humidity)
+{
+  if(NULL == temperature || NULL == pressure || NULL == humidity) { return RUUVI_ERROR_NULL; }
+  *temperature = bme280_oversampling_decode(dev.settings.osr_t);
+  *pressure    = bme280_oversampling_decode(dev.settings.osr_p);
+  *humidity    = bme280_oversampling_decode(dev.settings.osr_h);
+  return RUUVI_SUCCESS;
+}
+
+/** Set IIR coefficient. Valid values are 1 (off), 2, 4, 8 and 16. Oversampling is not changed. **/
+ruuvi_status_t bme280_interface_iir_set(const uint8_t coefficient)
+{
+  uint8_t filter;
+  if(RUUVI_SUCCESS != bme280_iir_encode(coefficient, &filter)) { return RUUVI_ERROR_NOT_SUPPORTED; }
+  dev.settings.filter = filter;
+  return BME_TO_RUUVI_ERROR(bme280_set_sensor_settings(BME280_FILTER_SEL, &dev));
+}
+
+/** Read IIR coefficient from cached state, 1 if filter is off **/
+ruuvi_status_t bme280_interface_iir_get(uint8_t* const coefficient)
+{
+  if(NULL == coefficient) { return RUUVI_ERROR_NULL; }
+  *coefficient = bme280_iir_decode(dev.settings.filter);
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Maximum duration of a forced measurement with current oversampling, from datasheet appendix B.
+ */
+uint32_t bme280_interface_measurement_time_us(void)
+{
+  uint32_t time_us = 1250 + 2300 * bme280_oversampling_decode(dev.settings.osr_t);
+  uint8_t os_p = bme280_oversampling_decode(dev.settings.osr_p);
+  uint8_t os_h = bme280_oversampling_decode(dev.settings.osr_h);
+  if(os_p) { time_us += 2300 * os_p + 575; }
+  if(os_h) { time_us += 2300 * os_h + 575; }
+  return time_us;
+}
+
+/**
+ * Apply IIR and / or oversampling. Functions are independent, i.e. setting IIR does not change oversampling.
+ * Oversampling is applied to measured channels only, skipped channels stay skipped.
+ * RUUVI_SENSOR_DSP_LAST turns off IIR and sets measured channels to 1x oversampling.
+ */
 ruuvi_status_t bme280_interface_dsp_set(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
 {
+  if(NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
   // Validate configuration
   if(   1  != *parameter
      && 2  != *parameter
@@ -177,90 +300,58 @@ ruuvi_status_t bme280_interface_dsp_set(ruuvi_sensor_dsp_function_t* dsp, uint8_
     return RUUVI_ERROR_NOT_SUPPORTED; 
   }
 
-  // Clear setup
   uint8_t settings_sel = 0;
-  dev.settings.osr_h = BME280_OVERSAMPLING_1X;
-  dev.settings.osr_p = BME280_OVERSAMPLING_1X;
-  dev.settings.osr_t = BME280_OVERSAMPLING_1X;
-  dev.settings.filter = BME280_FILTER_COEFF_OFF;
-  settings_sel |= BME280_OSR_PRESS_SEL;
-  settings_sel |= BME280_OSR_TEMP_SEL;
-  settings_sel |= BME280_OSR_HUM_SEL;
-  settings_sel |= BME280_FILTER_SEL;
-
-  // Disable DSP on BME if DSP_LAST was selected
-  if(RUUVI_SENSOR_DSP_LAST == *dsp) { return BME_TO_RUUVI_ERROR(bme280_set_sensor_settings(settings_sel, &dev)); }
-
-  // Setup IIR
-  if(RUUVI_SENSOR_DSP_IIR & *dsp)
+  uint8_t osr = BME280_OVERSAMPLING_1X;
+  uint8_t filter = BME280_FILTER_COEFF_OFF;
+
+  if(RUUVI_SENSOR_DSP_IIR & *dsp) { bme280_iir_encode(*parameter, &filter); }
+  if(RUUVI_SENSOR_DSP_OS & *dsp)  { bme280_oversampling_encode(*parameter, &osr); }
+
+  if(RUUVI_SENSOR_DSP_LAST == *dsp || (RUUVI_SENSOR_DSP_IIR & *dsp))
   {
-    switch(*parameter)
-    {
-      case 1:
-        dev.settings.filter = BME280_FILTER_COEFF_OFF;
-        break;
-      case 2:
-        dev.settings.filter = BME280_FILTER_COEFF_2;
-        break;
-      case 4:
-        dev.settings.filter = BME280_FILTER_COEFF_4;
-        break;
-      case 8:
-        dev.settings.filter = BME280_FILTER_COEFF_8;
-        break;
-      case 16:
-        dev.settings.filter = BME280_FILTER_COEFF_16;
-        break;
-      default:
-        return RUUVI_ERROR_NOT_SUPPORTED;
-        break;
-    }
+    dev.settings.filter = filter;
+    settings_sel |= BME280_FILTER_SEL;
   }
-  // Setup Oversampling
-  if(RUUVI_SENSOR_DSP_OS & *dsp)
+  if(RUUVI_SENSOR_DSP_LAST == *dsp || (RUUVI_SENSOR_DSP_OS & *dsp))
   {
-    switch(*parameter)
-    {
-      case 1:
-          dev.settings.osr_h = BME280_OVERSAMPLING_1X;
-          dev.settings.osr_p = BME280_OVERSAMPLING_1X;
-          dev.settings.osr_t = BME280_OVERSAMPLING_1X;
-        break;
-      case 2:
-          dev.settings.osr_h = BME280_OVERSAMPLING_2X;
-          dev.settings.osr_p = BME280_OVERSAMPLING_2X;
-          dev.settings.osr_t = BME280_OVERSAMPLING_2X;
-        break;
-      case 4:
-          dev.settings.osr_h = BME280_OVERSAMPLING_4X;
-          dev.settings.osr_p = BME280_OVERSAMPLING_4X;
-          dev.settings.osr_t = BME280_OVERSAMPLING_4X;
-        break;
-      case 8:
-          dev.settings.osr_h = BME280_OVERSAMPLING_8X;
-          dev.settings.osr_p = BME280_OVERSAMPLING_8X;
-          dev.settings.osr_t = BME280_OVERSAMPLING_8X;
-        break;
-      case 16:
-          dev.settings.osr_h = BME280_OVERSAMPLING_16X;
-          dev.settings.osr_p = BME280_OVERSAMPLING_16X;
-          dev.settings.osr_t = BME280_OVERSAMPLING_16X;
-        break;
-      default:
-        return RUUVI_ERROR_NOT_SUPPORTED;
-        break;
-    }
+    dev.settings.osr_t = osr;
+    if(BME280_NO_OVERSAMPLING != dev.settings.osr_p) { dev.settings.osr_p = osr; }
+    if(BME280_NO_OVERSAMPLING != dev.settings.osr_h) { dev.settings.osr_h = osr; }
+    settings_sel |= BME280_OSR_PRESS_SEL | BME280_OSR_TEMP_SEL | BME280_OSR_HUM_SEL;
   }
 
   //Write configuration
   return BME_TO_RUUVI_ERROR(bme280_set_sensor_settings(settings_sel, &dev));
-
 }
 
-// TODO
+/**
+ * Return active DSP functions from cached state without bus access.
+ * Parameter is IIR coefficient if IIR is active, highest channel oversampling otherwise.
+ * Use bme280_interface_oversampling_get and bme280_interface_iir_get for per-channel details.
+ */
 ruuvi_status_t bme280_interface_dsp_get(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
+  uint8_t iir = bme280_iir_decode(dev.settings.filter);
+  uint8_t os = bme280_oversampling_decode(dev.settings.osr_t);
+  uint8_t os_p = bme280_oversampling_decode(dev.settings.osr_p);
+  uint8_t os_h = bme280_oversampling_decode(dev.settings.osr_h);
+  if(os_p > os) { os = os_p; }
+  if(os_h > os) { os = os_h; }
+
+  *dsp = RUUVI_SENSOR_DSP_LAST;
+  *parameter = 1;
+  if(1 < os)
+  {
+    *dsp |= RUUVI_SENSOR_DSP_OS;
+    *parameter = os;
+  }
+  if(1 < iir)
+  {
+    *dsp |= RUUVI_SENSOR_DSP_IIR;
+    *parameter = iir;
+  }
+  return RUUVI_SUCCESS;
 }
 
 ruuvi_status_t bme280_interface_mode_set(ruuvi_sensor_mode_t* mode)
@@ -276,7 +367,7 @@ ruuvi_status_t bme280_interface_mode_set(ruuvi_sensor_mode_t* mode)
       break;
     case RUUVI_SENSOR_MODE_SINGLE_BLOCKING:
       err_code = BME_TO_RUUVI_ERROR(bme280_set_sensor_mode(BME280_FORCED_MODE, &dev));
-      platform_delay_ms(100); // TODO: poll status?
+      platform_delay_ms((bme280_interface_measurement_time_us() / 1000) + 1);
       break;
     case RUUVI_SENSOR_MODE_CONTINOUS:
       err_code = BME_TO_RUUVI_ERROR(bme280_set_sensor_mode(BME280_NORMAL_MODE, &dev));
@@ -321,8 +412,46 @@ ruuvi_status_t bme280_interface_interrupt_get(uint8_t number, float* threshold,
   return RUUVI_ERROR_NOT_SUPPORTED;
 }
 
+/**
+ * Fill ruuvi_environmental_fixed_data_t. Integer builds use Bosch integer compensation directly,
+ * float builds convert the compensated values.
+ */
+ruuvi_status_t bme280_interface_data_fixed_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_environmental_fixed_data_t* p_data = (ruuvi_environmental_fixed_data_t*)data;
+  struct bme280_data comp_data;
+  int8_t rslt = bme280_get_sensor_data(BME280_ALL, &comp_data, &dev);
+#ifdef BME280_FLOAT_ENABLE
+  p_data->temperature_cc = (int32_t)(comp_data.temperature * 100);
+  p_data->humidity_q10   = (uint32_t)(comp_data.humidity * 1024);
+  p_data->pressure_q8    = (uint32_t)(comp_data.pressure * 256);
+#else
+  // Bosch integer compensation returns 0.01 C and Q22.10 RH-%.
+  p_data->temperature_cc = comp_data.temperature;
+  p_data->humidity_q10   = comp_data.humidity;
+  #ifdef BME280_64BIT_ENABLE
+  // 64-bit compensation returns 0.01 Pa, scale to Q24.8 without overflowing 32 bits.
+  p_data->pressure_q8    = (uint32_t)(((uint64_t)comp_data.pressure * 64) / 25);
+  #else
+  // 32-bit compensation returns full Pa.
+  p_data->pressure_q8    = comp_data.pressure << 8;
+  #endif
+#endif
+  // Skipped channels are not valid
+  if(BME280_NO_OVERSAMPLING == dev.settings.osr_h) { p_data->humidity_q10 = ENVIRONMENTAL_HUMIDITY_FIXED_INVALID; }
+  if(BME280_NO_OVERSAMPLING == dev.settings.osr_p) { p_data->pressure_q8 = ENVIRONMENTAL_PRESSURE_FIXED_INVALID; }
+  return BME_TO_RUUVI_ERROR(rslt);
+}
+
+/**
+ * Fill ruuvi_environmental_data_t. Without BME280_FLOAT_ENABLE data is converted from integer compensation.
+ * Without APPLICATION_FLOAT_USE returns RUUVI_ERROR_NOT_SUPPORTED, use bme280_interface_data_fixed_get.
+ */
 ruuvi_status_t bme280_interface_data_get(void* data)
 {
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+#ifdef BME280_FLOAT_ENABLE
   ruuvi_environmental_data_t* p_data = (ruuvi_environmental_data_t*)data;
   struct bme280_data comp_data;
   int8_t rslt = bme280_get_sensor_data(BME280_ALL, &comp_data, &dev);
@@ -330,10 +459,23 @@ ruuvi_status_t bme280_interface_data_get(void* data)
   p_data->temperature = (float) comp_data.temperature;
   p_data->humidity    = (float) comp_data.humidity;
   p_data->pressure    = (float) comp_data.pressure;
+  if(BME280_NO_OVERSAMPLING == dev.settings.osr_h) { p_data->humidity = ENVIRONMENTAL_INVALID; }
+  if(BME280_NO_OVERSAMPLING == dev.settings.osr_p) { p_data->pressure = ENVIRONMENTAL_INVALID; }
   return BME_TO_RUUVI_ERROR(rslt);
+#elif defined(APPLICATION_FLOAT_USE)
+  ruuvi_environmental_data_t* p_data = (ruuvi_environmental_data_t*)data;
+  ruuvi_environmental_fixed_data_t fixed;
+  ruuvi_status_t err_code = bme280_interface_data_fixed_get(&fixed);
+  p_data->temperature = ENVIRONMENTAL_FIXED_TO_C(fixed.temperature_cc);
+  p_data->humidity    = ENVIRONMENTAL_FIXED_TO_RH(fixed.humidity_q10);
+  p_data->pressure    = ENVIRONMENTAL_FIXED_TO_PA(fixed.pressure_q8);
+  if(ENVIRONMENTAL_HUMIDITY_FIXED_INVALID == fixed.humidity_q10) { p_data->humidity = ENVIRONMENTAL_INVALID; }
+  if(ENVIRONMENTAL_PRESSURE_FIXED_INVALID == fixed.pressure_q8)  { p_data->pressure = ENVIRONMENTAL_INVALID; }
+  return err_code;
+#else
+  // Layout of data must not depend on build flags, integers are only available through data_fixed_get
+  return RUUVI_ERROR_NOT_SUPPORTED;
+#endif
 }
 
-
-
-
 #endif
\ No newline at end of file
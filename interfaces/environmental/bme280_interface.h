@@ -23,4 +23,27 @@ ruuvi_status_t bme280_interface_interrupt_set(uint8_t number, float* threshold,
 ruuvi_status_t bme280_interface_interrupt_get(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
 ruuvi_status_t bme280_interface_data_get(void* data);
 
+/**
+ * Read fixed-point data into ruuvi_environmental_fixed_data_t, does not require floating point unit.
+ * data_get always fills ruuvi_environmental_data_t and is not supported without APPLICATION_FLOAT_USE.
+ */
+ruuvi_status_t bme280_interface_data_fixed_get(void* data);
+
+/**
+ * Per-channel oversampling, valid ratios 0, 1, 2, 4, 8, 16. 0 skips the channel. Temperature cannot be skipped.
+ */
+ruuvi_status_t bme280_interface_oversampling_set(const uint8_t temperature, const uint8_t pressure, const uint8_t humidity);
+ruuvi_status_t bme280_interface_oversampling_get(uint8_t* const temperature, uint8_t* const pressure, uint8_t* const humidity);
+
+/**
+ * IIR filter coefficient, valid values 1 (off), 2, 4, 8, 16.
+ */
+ruuvi_status_t bme280_interface_iir_set(const uint8_t coefficient);
+ruuvi_status_t bme280_interface_iir_get(uint8_t* const coefficient);
+
+/**
+ * Maximum time of a single measurement with current oversampling settings.
+ */
+uint32_t bme280_interface_measurement_time_us(void);
+
 #endif
\ No newline at end of file
@@ -10,4 +10,21 @@ typedef struct
   float pressure;    // Pa
 }ruuvi_environmental_data_t;
 
-#endif
\ No newline at end of file
+/**
+ * Fixed-point environmental data, filled without any floating point operations.
+ */
+#define ENVIRONMENTAL_TEMPERATURE_FIXED_INVALID INT32_MIN
+#define ENVIRONMENTAL_HUMIDITY_FIXED_INVALID    UINT32_MAX
+#define ENVIRONMENTAL_PRESSURE_FIXED_INVALID    UINT32_MAX
+typedef struct
+{
+  int32_t  temperature_cc; // C * 100
+  uint32_t humidity_q10;   // RH-%, Q22.10
+  uint32_t pressure_q8;    // Pa, Q24.8
+}ruuvi_environmental_fixed_data_t;
+
+#define ENVIRONMENTAL_FIXED_TO_C(cc)   ((float)(cc) / 100.0f)
+#define ENVIRONMENTAL_FIXED_TO_RH(q10) ((float)(q10) / 1024.0f)
+#define ENVIRONMENTAL_FIXED_TO_PA(q8)  ((float)(q8) / 256.0f)
+
+#endif
@@ -24,5 +24,6 @@ typedef void(*pin_interrupt_fp)(const ruuvi_gpio_evt_t);
 
 ruuvi_status_t platform_pin_interrupt_init();
 ruuvi_status_t platform_pin_interrupt_enable(uint8_t pin, ruuvi_gpio_slope_t slope, ruuvi_gpio_mode_t mode, pin_interrupt_fp handler);
+ruuvi_status_t platform_pin_interrupt_disable(uint8_t pin);
 
 #endif
\ No newline at end of file
@@ -23,6 +23,16 @@
 #include "spi.h"
 #include "yield.h"
 
+#include <stdbool.h>
+
+#define BMG250_INTERFACE_FIFO_SIZE        1024 // bytes
+#define BMG250_INTERFACE_FIFO_SAMPLE_SIZE 6    // bytes, headerless gyro frame
+#define BMG250_INTERFACE_FIFO_SAMPLES     (BMG250_INTERFACE_FIFO_SIZE / BMG250_INTERFACE_FIFO_SAMPLE_SIZE)
+#define BMG250_INTERFACE_EXTRACT_CHUNK    16   // samples parsed at once in buffer_get
+#define BMG250_INTERFACE_FIFO_WM_REG      0x46 // FIFO_CONFIG_0, watermark in 4-byte units
+#define BMG250_INTERFACE_CMD_REG          0x7E
+#define BMG250_INTERFACE_FIFO_FLUSH       0xB0
+
 #define PLATFORM_LOG_MODULE_NAME bmg250_iface
 #if BMG250_INTERFACE_LOG_ENABLED
 #define PLATFORM_LOG_LEVEL       BMG250_INTERFACE_LOG_LEVEL
@@ -38,6 +48,10 @@ static struct bmg250_dev gyro = {0};
 /* Structure to set the gyro config */
 static struct bmg250_cfg gyro_cfg;
 static ruuvi_sensor_mode_t state_power_mode = RUUVI_SENSOR_MODE_SLEEP;
+/* FIFO burst buffer */
+static uint8_t fifo_raw[BMG250_INTERFACE_FIFO_SIZE];
+static struct bmg250_fifo_frame fifo_frame;
+static bool fifo_enabled = false;
 
 //XXX
 ruuvi_status_t bmg250_interface_init(ruuvi_sensor_t* gyration_sensor)
@@ -49,6 +63,7 @@ ruuvi_status_t bmg250_interface_init(ruuvi_sensor_t* gyration_sensor)
   gyro.read = spi_bosch_platform_read;
   gyro.write = spi_bosch_platform_write;
   gyro.delay_ms = platform_delay_ms;
+  gyro.fifo = &fifo_frame;
 
   uint8_t num_retries = 0;
   do {
@@ -111,6 +126,7 @@ ruuvi_status_t bmg250_interface_init(ruuvi_sensor_t* gyration_sensor)
     gyration_sensor->interrupt_set  = bmg250_interface_interrupt_set;
     gyration_sensor->interrupt_get  = bmg250_interface_interrupt_get;
     gyration_sensor->data_get       = bmg250_interface_data_get;
+    gyration_sensor->buffer_get     = bmg250_interface_buffer_get;
   }
 
   return err_code;
@@ -121,10 +137,59 @@ ruuvi_status_t bmg250_interface_uninit(ruuvi_sensor_t* gyration_sensor)
   return RUUVI_ERROR_NOT_IMPLEMENTED;
 }
 
+/**
+ * Set output data rate in Hz, rounded up to next supported rate 25, 50, 100, 200, 400, 800, 1600 or 3200 Hz.
+ * Keeps gyro suspended unless continuous mode is active.
+ */
+ruuvi_status_t bmg250_interface_odr_set(const uint16_t hz)
+{
+  int8_t result = BMG250_OK;
+  if(25 >= hz)        { gyro_cfg.odr = BMG250_ODR_25HZ;   }
+  else if(50 >= hz)   { gyro_cfg.odr = BMG250_ODR_50HZ;   }
+  else if(100 >= hz)  { gyro_cfg.odr = BMG250_ODR_100HZ;  }
+  else if(200 >= hz)  { gyro_cfg.odr = BMG250_ODR_200HZ;  }
+  else if(400 >= hz)  { gyro_cfg.odr = BMG250_ODR_400HZ;  }
+  else if(800 >= hz)  { gyro_cfg.odr = BMG250_ODR_800HZ;  }
+  else if(1600 >= hz) { gyro_cfg.odr = BMG250_ODR_1600HZ; }
+  else if(3200 >= hz) { gyro_cfg.odr = BMG250_ODR_3200HZ; }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  result |= bmg250_set_sensor_settings(&gyro_cfg, &gyro);
+  // Restore power mode, settings are written in suspend.
+  if(RUUVI_SENSOR_MODE_CONTINOUS == state_power_mode)
+  {
+    gyro.power_mode = BMG250_GYRO_NORMAL_MODE;
+    result |= bmg250_set_power_mode(&gyro);
+  }
+  return (BMG250_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
+
+ruuvi_status_t bmg250_interface_odr_get(uint16_t* const hz)
+{
+  if(NULL == hz) { return RUUVI_ERROR_NULL; }
+
+  switch(gyro_cfg.odr)
+  {
+    case BMG250_ODR_25HZ:   *hz = 25;   break;
+    case BMG250_ODR_50HZ:   *hz = 50;   break;
+    case BMG250_ODR_100HZ:  *hz = 100;  break;
+    case BMG250_ODR_200HZ:  *hz = 200;  break;
+    case BMG250_ODR_400HZ:  *hz = 400;  break;
+    case BMG250_ODR_800HZ:  *hz = 800;  break;
+    case BMG250_ODR_1600HZ: *hz = 1600; break;
+    case BMG250_ODR_3200HZ: *hz = 3200; break;
+    default: return RUUVI_ERROR_INTERNAL;
+  }
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Samplerate is rounded up. Rates above 200 Hz do not fit into samplerate,
+ * use bmg250_interface_odr_set for 400 - 1600 Hz. MAX is 3200 Hz.
+ */
 ruuvi_status_t bmg250_interface_samplerate_set(ruuvi_sensor_samplerate_t* samplerate)
 {
   if(NULL == samplerate) { return RUUVI_ERROR_NULL; }
-  ruuvi_status_t err_code = RUUVI_SUCCESS;
   int8_t result = BMG250_OK;
 
   // Stop byro, store desired mode
@@ -134,62 +199,26 @@ ruuvi_status_t bmg250_interface_samplerate_set(ruuvi_sensor_samplerate_t* sample
     gyro.power_mode = BMG250_GYRO_SUSPEND_MODE;
     result |= bmg250_set_power_mode(&gyro);
     gyro.power_mode = pwr;
+    return (BMG250_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
   }
   else if(RUUVI_SENSOR_SAMPLERATE_SINGLE == *samplerate)    { return RUUVI_ERROR_NOT_SUPPORTED; }
-  else if(RUUVI_SENSOR_SAMPLERATE_MIN == *samplerate)       { gyro_cfg.odr = BMG250_ODR_25HZ;   }
-  else if(RUUVI_SENSOR_SAMPLERATE_MAX == *samplerate)       { gyro_cfg.odr = BMG250_ODR_3200HZ; }
+  else if(RUUVI_SENSOR_SAMPLERATE_MIN == *samplerate)       { return bmg250_interface_odr_set(25);   }
+  else if(RUUVI_SENSOR_SAMPLERATE_MAX == *samplerate)       { return bmg250_interface_odr_set(3200); }
   else if(RUUVI_SENSOR_SAMPLERATE_NO_CHANGE == *samplerate) { return RUUVI_SUCCESS;             }
-  else if(25 >= *samplerate)  { gyro_cfg.odr = BMG250_ODR_25HZ;   }
-  else if(50 >= *samplerate)  { gyro_cfg.odr = BMG250_ODR_50HZ;   }
-  else if(100 >= *samplerate) { gyro_cfg.odr = BMG250_ODR_100HZ;  }
-  else if(200 >= *samplerate) { gyro_cfg.odr = BMG250_ODR_200HZ;  }
-  else { return RUUVI_ERROR_NOT_SUPPORTED; }
-
-  result |= bmg250_set_sensor_settings(&gyro_cfg, &gyro);
-  // Restore power mode if we did not stop the gyro.
-  if(RUUVI_SENSOR_MODE_CONTINOUS == state_power_mode
-    && RUUVI_SENSOR_SAMPLERATE_STOP   != *samplerate)
-  {
-    gyro.power_mode = BMG250_GYRO_NORMAL_MODE;
-    result |= bmg250_set_power_mode(&gyro);
-  }
-  if(BMG250_OK != result)
-  {
-    err_code |= RUUVI_ERROR_INTERNAL;
-  }
-  return err_code;
+  else if(200 >= *samplerate) { return bmg250_interface_odr_set(*samplerate); }
+  return RUUVI_ERROR_NOT_SUPPORTED;
 }
 
 ruuvi_status_t bmg250_interface_samplerate_get(ruuvi_sensor_samplerate_t* samplerate)
 {
   if(NULL == samplerate) { return RUUVI_ERROR_NULL; }
+  uint16_t hz = 0;
+  ruuvi_status_t err_code = bmg250_interface_odr_get(&hz);
 
-  switch(gyro_cfg.odr)
-  {
-    case BMG250_ODR_25HZ:
-      *samplerate = 25;
-      break;
-
-    case BMG250_ODR_50HZ:
-      *samplerate = 50;
-      break;
-
-    case BMG250_ODR_100HZ:
-      *samplerate = 100;
-      break;
-
-    case BMG250_ODR_200HZ:
-      *samplerate = 200;
-      break;
-
-    case BMG250_ODR_3200HZ:
-      *samplerate = RUUVI_SENSOR_SAMPLERATE_MAX;
-      break;
-
-     default:
-       return RUUVI_ERROR_INTERNAL;
-  }
-  return RUUVI_SUCCESS;
+  if(200 >= hz)       { *samplerate = hz; }
+  else if(3200 == hz) { *samplerate = RUUVI_SENSOR_SAMPLERATE_MAX; }
+  else                { *samplerate = RUUVI_SENSOR_SAMPLERATE_NOT_SUPPORTED; }
+  return err_code;
 }
 
 ruuvi_status_t bmg250_interface_resolution_set(ruuvi_sensor_resolution_t* resolution)
@@ -204,37 +233,119 @@ ruuvi_status_t bmg250_interface_resolution_get(ruuvi_sensor_resolution_t* resolu
   return RUUVI_SUCCESS;
 }
 
+/**
+ * Set range in degrees per second, rounded up to next supported range 125, 250, 500, 1000 or 2000 dps.
+ */
+ruuvi_status_t bmg250_interface_range_set(const uint16_t dps)
+{
+  if(125 >= dps)       { gyro_cfg.range = BMG250_RANGE_125_DPS;  }
+  else if(250 >= dps)  { gyro_cfg.range = BMG250_RANGE_250_DPS;  }
+  else if(500 >= dps)  { gyro_cfg.range = BMG250_RANGE_500_DPS;  }
+  else if(1000 >= dps) { gyro_cfg.range = BMG250_RANGE_1000_DPS; }
+  else if(2000 >= dps) { gyro_cfg.range = BMG250_RANGE_2000_DPS; }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  int8_t result = bmg250_set_sensor_settings(&gyro_cfg, &gyro);
+  if(RUUVI_SENSOR_MODE_CONTINOUS == state_power_mode)
+  {
+    gyro.power_mode = BMG250_GYRO_NORMAL_MODE;
+    result |= bmg250_set_power_mode(&gyro);
+  }
+  return (BMG250_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
+
+ruuvi_status_t bmg250_interface_range_get(uint16_t* const dps)
+{
+  if(NULL == dps) { return RUUVI_ERROR_NULL; }
+
+  switch(gyro_cfg.range)
+  {
+    case BMG250_RANGE_125_DPS:  *dps = 125;  break;
+    case BMG250_RANGE_250_DPS:  *dps = 250;  break;
+    case BMG250_RANGE_500_DPS:  *dps = 500;  break;
+    case BMG250_RANGE_1000_DPS: *dps = 1000; break;
+    case BMG250_RANGE_2000_DPS: *dps = 2000; break;
+    default: return RUUVI_ERROR_INTERNAL;
+  }
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Scale is rounded up. Ranges above 250 dps do not fit into scale,
+ * use bmg250_interface_range_set for 500 and 1000 dps. MAX is 2000 dps.
+ */
 ruuvi_status_t bmg250_interface_scale_set(ruuvi_sensor_scale_t* scale)
 {
   if(NULL ==  scale) { return RUUVI_ERROR_NULL; }
 
   if(RUUVI_SENSOR_SCALE_NO_CHANGE == *scale) { return RUUVI_SUCCESS; }
-  else if(RUUVI_SENSOR_SCALE_MIN == *scale) { gyro_cfg.range = BMG250_RANGE_125_DPS; }
-  else if(RUUVI_SENSOR_SCALE_MAX == *scale) { gyro_cfg.range = BMG250_RANGE_2000_DPS;}
-  else if(125 >= *scale) { gyro_cfg.range = BMG250_RANGE_125_DPS; }
-  else if(250 >= *scale) { gyro_cfg.range = BMG250_RANGE_250_DPS; }
+  else if(RUUVI_SENSOR_SCALE_MIN == *scale) { return bmg250_interface_range_set(125);  }
+  else if(RUUVI_SENSOR_SCALE_MAX == *scale) { return bmg250_interface_range_set(2000); }
+  else if(250 >= *scale) { return bmg250_interface_range_set(*scale); }
+  return RUUVI_ERROR_NOT_SUPPORTED;
+}
+
+ruuvi_status_t bmg250_interface_scale_get(ruuvi_sensor_scale_t* scale)
+{
+  if(NULL ==  scale) { return RUUVI_ERROR_NULL; }
+  uint16_t dps = 0;
+  ruuvi_status_t err_code = bmg250_interface_range_get(&dps);
+
+  if(250 >= dps)       { *scale = dps; }
+  else if(2000 == dps) { *scale = RUUVI_SENSOR_SCALE_MAX; }
+  else                 { return RUUVI_ERROR_NOT_SUPPORTED; }
+  return err_code;
+}
+
+/**
+ * Bandwidth of the digital filter. OS 1 is normal mode, OS 2 and OS 4 lower the filter cutoff.
+ * RUUVI_SENSOR_DSP_LAST returns to normal mode.
+ */
+ruuvi_status_t bmg250_interface_dsp_set(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
+{
+  if(NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
+
+  if(RUUVI_SENSOR_DSP_LAST == *dsp) { gyro_cfg.bw = BMG250_BW_NORMAL_MODE; }
+  else if(RUUVI_SENSOR_DSP_OS == *dsp)
+  {
+    switch(*parameter)
+    {
+      case 1:  gyro_cfg.bw = BMG250_BW_NORMAL_MODE; break;
+      case 2:  gyro_cfg.bw = BMG250_BW_OSR2_MODE;   break;
+      case 4:  gyro_cfg.bw = BMG250_BW_OSR4_MODE;   break;
+      default: return RUUVI_ERROR_NOT_SUPPORTED;
+    }
+  }
   else { return RUUVI_ERROR_NOT_SUPPORTED; }
-  
+
   int8_t result = bmg250_set_sensor_settings(&gyro_cfg, &gyro);
+  if(RUUVI_SENSOR_MODE_CONTINOUS == state_power_mode)
+  {
+    gyro.power_mode = BMG250_GYRO_NORMAL_MODE;
+    result |= bmg250_set_power_mode(&gyro);
+  }
   return (BMG250_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
 }
 
-ruuvi_status_t bmg250_interface_scale_get(ruuvi_sensor_scale_t* scale)
+ruuvi_status_t bmg250_interface_dsp_get(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
 {
-  if(NULL ==  scale) { return RUUVI_ERROR_NULL; }
+  if(NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
 
-  switch(gyro_cfg.range)
+  switch(gyro_cfg.bw)
   {
-    case BMG250_RANGE_125_DPS:
-      *scale = 125;
+    case BMG250_BW_NORMAL_MODE:
+      *dsp = RUUVI_SENSOR_DSP_LAST;
+      *parameter = 1;
       break;
 
-    case BMG250_RANGE_250_DPS:
-      *scale = 250;
+    case BMG250_BW_OSR2_MODE:
+      *dsp = RUUVI_SENSOR_DSP_OS;
+      *parameter = 2;
       break;
 
-    case BMG250_RANGE_2000_DPS:
-      *scale = RUUVI_SENSOR_SCALE_MAX;
+    case BMG250_BW_OSR4_MODE:
+      *dsp = RUUVI_SENSOR_DSP_OS;
+      *parameter = 4;
       break;
 
     default:
@@ -243,16 +354,6 @@ ruuvi_status_t bmg250_interface_scale_get(ruuvi_sensor_scale_t* scale)
   return RUUVI_SUCCESS;
 }
 
-ruuvi_status_t bmg250_interface_dsp_set(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
-{
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
-}
-
-ruuvi_status_t bmg250_interface_dsp_get(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
-{
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
-}
-
 ruuvi_status_t bmg250_interface_mode_set(ruuvi_sensor_mode_t* mode)
 {
 
@@ -294,47 +395,159 @@ ruuvi_status_t bmg250_interface_interrupt_get(uint8_t number, float* threshold,
   return RUUVI_ERROR_NOT_IMPLEMENTED;
 }
 
-ruuvi_status_t bmg250_interface_data_get(void* data)
+/**
+ * Enable or disable gyro data in FIFO. FIFO is headerless, i.e. every 6 bytes is a gyro sample.
+ * FIFO is flushed on enable.
+ */
+ruuvi_status_t bmg250_interface_fifo_use(const bool enable)
 {
-  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  int8_t result = BMG250_OK;
+  if(enable)
+  {
+    uint8_t flush = BMG250_INTERFACE_FIFO_FLUSH;
+    result |= bmg250_set_fifo_config(BMG250_FIFO_HEADER, BMG250_DISABLE, &gyro);
+    result |= bmg250_set_fifo_config(BMG250_FIFO_GYRO, BMG250_ENABLE, &gyro);
+    result |= bmg250_set_regs(BMG250_INTERFACE_CMD_REG, &flush, 1, &gyro);
+  }
+  else
+  {
+    result |= bmg250_set_fifo_config(BMG250_FIFO_GYRO, BMG250_DISABLE, &gyro);
+  }
+  if(BMG250_OK == result) { fifo_enabled = enable; }
+  return (BMG250_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
 
-  typedef struct
+/**
+ * Route FIFO watermark interrupt to INT1. Watermark is given in samples and rounded down to 4-byte units.
+ * Interrupt pin must be connected to application with pin_interrupt.
+ */
+ruuvi_status_t bmg250_interface_fifo_interrupt_use(const bool enable, const uint8_t watermark_samples)
 {
-  float x_mdps;
-  float y_mdps;
-  float z_mdps;
-}ruuvi_gyration_data_t;
-
-ruuvi_gyration_data_t* p_gyro = (ruuvi_gyration_data_t*) data;
-struct bmg250_sensor_data gyro_data;
+  if(BMG250_INTERFACE_FIFO_SAMPLES < watermark_samples) { return RUUVI_ERROR_INVALID_PARAM; }
+  int8_t result = BMG250_OK;
+  uint8_t watermark = (uint8_t)((watermark_samples * BMG250_INTERFACE_FIFO_SAMPLE_SIZE) / 4);
+  struct bmg250_int_settg int_config = {0};
+  int_config.int_channel = BMG250_INT_CHANNEL_1;
+  int_config.int_type = BMG250_FIFO_WATERMARK_INT;
+  int_config.fifo_wtm_int_en = enable ? BMG250_ENABLE : BMG250_DISABLE;
+  int_config.int_pin_settg.output_en = enable ? BMG250_ENABLE : BMG250_DISABLE;
+  int_config.int_pin_settg.output_mode = BMG250_PUSH_PULL;
+  int_config.int_pin_settg.output_type = BMG250_ACTIVE_HIGH;
+  int_config.int_pin_settg.edge_ctrl = BMG250_EDGE_TRIGGER;
+  int_config.int_pin_settg.input_en = BMG250_DISABLE;
+
+  if(enable) { result |= bmg250_set_regs(BMG250_INTERFACE_FIFO_WM_REG, &watermark, 1, &gyro); }
+  result |= bmg250_set_int_config(&int_config, &gyro);
+  return (BMG250_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
 
-int8_t result = bmg250_get_sensor_data(BMG250_DATA_SEL, &gyro_data, &gyro);
+/**
+ * Route data ready interrupt to INT1.
+ * Interrupt pin must be connected to application with pin_interrupt.
+ */
+ruuvi_status_t bmg250_interface_data_ready_interrupt_use(const bool enable)
+{
+  struct bmg250_int_settg int_config = {0};
+  int_config.int_channel = BMG250_INT_CHANNEL_1;
+  int_config.int_type = BMG250_DATA_RDY_INT;
+  int_config.int_pin_settg.output_en = enable ? BMG250_ENABLE : BMG250_DISABLE;
+  int_config.int_pin_settg.output_mode = BMG250_PUSH_PULL;
+  int_config.int_pin_settg.output_type = BMG250_ACTIVE_HIGH;
+  int_config.int_pin_settg.edge_ctrl = BMG250_EDGE_TRIGGER;
+  int_config.int_pin_settg.input_en = BMG250_DISABLE;
+
+  int8_t result = bmg250_set_int_config(&int_config, &gyro);
+  return (BMG250_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
 
-switch(gyro_cfg.range)
+// Convert raw sample to ruuvi format with current range
+static ruuvi_status_t bmg250_convert(const struct bmg250_sensor_data* const raw, ruuvi_gyration_data_t* const p_gyro)
 {
+  switch(gyro_cfg.range)
+  {
     case BMG250_RANGE_125_DPS:
-      p_gyro->x_mdps = BMG250_125_RAW_TO_DPS(gyro_data.x);
-      p_gyro->y_mdps = BMG250_125_RAW_TO_DPS(gyro_data.y);
-      p_gyro->z_mdps = BMG250_125_RAW_TO_DPS(gyro_data.z);
+      p_gyro->x_mdps = BMG250_125_RAW_TO_DPS(raw->x);
+      p_gyro->y_mdps = BMG250_125_RAW_TO_DPS(raw->y);
+      p_gyro->z_mdps = BMG250_125_RAW_TO_DPS(raw->z);
       break;
 
     case BMG250_RANGE_250_DPS:
-      p_gyro->x_mdps = BMG250_250_RAW_TO_DPS(gyro_data.x);
-      p_gyro->y_mdps = BMG250_250_RAW_TO_DPS(gyro_data.y);
-      p_gyro->z_mdps = BMG250_250_RAW_TO_DPS(gyro_data.z);
+      p_gyro->x_mdps = BMG250_250_RAW_TO_DPS(raw->x);
+      p_gyro->y_mdps = BMG250_250_RAW_TO_DPS(raw->y);
+      p_gyro->z_mdps = BMG250_250_RAW_TO_DPS(raw->z);
+      break;
+
+    case BMG250_RANGE_500_DPS:
+      p_gyro->x_mdps = BMG250_500_RAW_TO_DPS(raw->x);
+      p_gyro->y_mdps = BMG250_500_RAW_TO_DPS(raw->y);
+      p_gyro->z_mdps = BMG250_500_RAW_TO_DPS(raw->z);
+      break;
+
+    case BMG250_RANGE_1000_DPS:
+      p_gyro->x_mdps = BMG250_1000_RAW_TO_DPS(raw->x);
+      p_gyro->y_mdps = BMG250_1000_RAW_TO_DPS(raw->y);
+      p_gyro->z_mdps = BMG250_1000_RAW_TO_DPS(raw->z);
       break;
 
     case BMG250_RANGE_2000_DPS:
-      p_gyro->x_mdps = BMG250_2000_RAW_TO_DPS(gyro_data.x);
-      p_gyro->y_mdps = BMG250_2000_RAW_TO_DPS(gyro_data.y);
-      p_gyro->z_mdps = BMG250_2000_RAW_TO_DPS(gyro_data.z);
+      p_gyro->x_mdps = BMG250_2000_RAW_TO_DPS(raw->x);
+      p_gyro->y_mdps = BMG250_2000_RAW_TO_DPS(raw->y);
+      p_gyro->z_mdps = BMG250_2000_RAW_TO_DPS(raw->z);
       break;
 
     default:
+      p_gyro->x_mdps = GYRATION_INVALID;
+      p_gyro->y_mdps = GYRATION_INVALID;
+      p_gyro->z_mdps = GYRATION_INVALID;
       return RUUVI_ERROR_INTERNAL;
-      }
-return (BMG250_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+  }
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t bmg250_interface_data_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+
+  ruuvi_gyration_data_t* p_gyro = (ruuvi_gyration_data_t*) data;
+  struct bmg250_sensor_data gyro_data;
+
+  int8_t result = bmg250_get_sensor_data(BMG250_DATA_SEL, &gyro_data, &gyro);
+  ruuvi_status_t err_code = bmg250_convert(&gyro_data, p_gyro);
+  return (BMG250_OK == result) ? err_code : RUUVI_ERROR_INTERNAL;
 }
 
+/**
+ * Drain FIFO into ruuvi_gyration_buffer_t with a single burst read.
+ * Samples which do not fit into given buffer are lost.
+ */
+ruuvi_status_t bmg250_interface_buffer_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_gyration_buffer_t* p_buffer = (ruuvi_gyration_buffer_t*) data;
+  if(NULL == p_buffer->data) { return RUUVI_ERROR_NULL; }
+  if(!fifo_enabled) { return RUUVI_ERROR_INVALID_STATE; }
+
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  size_t max_samples = p_buffer->count;
+  p_buffer->count = 0;
+
+  fifo_frame.data = fifo_raw;
+  fifo_frame.length = sizeof(fifo_raw);
+  int8_t result = bmg250_get_fifo_data(&gyro);
+
+  // Parse burst in chunks to keep raw sample buffer small, extract continues where previous call ended.
+  struct bmg250_sensor_data raw[BMG250_INTERFACE_EXTRACT_CHUNK];
+  uint8_t extracted = BMG250_INTERFACE_EXTRACT_CHUNK;
+  while(BMG250_OK == result && BMG250_INTERFACE_EXTRACT_CHUNK == extracted && p_buffer->count < max_samples)
+  {
+    extracted = BMG250_INTERFACE_EXTRACT_CHUNK;
+    result |= bmg250_extract_gyro(raw, &extracted, &gyro);
+    for(size_t ii = 0; ii < extracted && p_buffer->count < max_samples; ii++)
+    {
+      err_code |= bmg250_convert(&raw[ii], &(p_buffer->data[p_buffer->count++]));
+    }
+  }
+  return (BMG250_OK == result) ? err_code : RUUVI_ERROR_INTERNAL;
+}
 
-#endif
\ No newline at end of file
+#endif
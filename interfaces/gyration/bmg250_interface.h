@@ -6,9 +6,12 @@
 #define BMG250_INTERFACE_H
 #include "ruuvi_error.h"
 #include "ruuvi_sensor.h"
+#include <stdbool.h>
 
 #define BMG250_125_RAW_TO_DPS(raw) (float)(raw *0.0038f)
 #define BMG250_250_RAW_TO_DPS(raw) (float)(raw *0.0076f)
+#define BMG250_500_RAW_TO_DPS(raw) (float)(raw *0.0153f)
+#define BMG250_1000_RAW_TO_DPS(raw) (float)(raw *0.0305f)
 #define BMG250_2000_RAW_TO_DPS(raw) (float)(raw *0.0610f)
 
 ruuvi_status_t bmg250_interface_init(ruuvi_sensor_t* gyration_sensor);
@@ -26,5 +29,17 @@ ruuvi_status_t bmg250_interface_mode_get(ruuvi_sensor_mode_t* mode);
 ruuvi_status_t bmg250_interface_interrupt_set(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
 ruuvi_status_t bmg250_interface_interrupt_get(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
 ruuvi_status_t bmg250_interface_data_get(void* data);
+ruuvi_status_t bmg250_interface_buffer_get(void* data);
+
+// Full output data rate and range, samplerate and scale cannot represent values above 250.
+ruuvi_status_t bmg250_interface_odr_set(const uint16_t hz);
+ruuvi_status_t bmg250_interface_odr_get(uint16_t* const hz);
+ruuvi_status_t bmg250_interface_range_set(const uint16_t dps);
+ruuvi_status_t bmg250_interface_range_get(uint16_t* const dps);
+
+// FIFO and interrupts, INT1 of BMG250 is used.
+ruuvi_status_t bmg250_interface_fifo_use(const bool enable);
+ruuvi_status_t bmg250_interface_fifo_interrupt_use(const bool enable, const uint8_t watermark_samples);
+ruuvi_status_t bmg250_interface_data_ready_interrupt_use(const bool enable);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef GYRATION_H
 #define GYRATION_H
 #include "ruuvi_error.h"
+#include <stddef.h>
 
 #define GYRATION_INVALID RUUVI_FLOAT_INVALID
 
@@ -12,4 +13,11 @@ typedef struct
   float z_mdps;
 }ruuvi_gyration_data_t;
 
+// Buffer for buffer_get. Count is maximum number of samples as input, number of samples read as output.
+typedef struct
+{
+  size_t count;
+  ruuvi_gyration_data_t* data;
+}ruuvi_gyration_buffer_t;
+
 #endif
\ No newline at end of file
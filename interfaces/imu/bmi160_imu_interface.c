@@ -1,3 +1,9 @@
+/**
+ * BMI160 IMU interface.
+ * Requires Bosch BMI160-API, available under BSD-3 on GitHub.
+ * Requires "application_config.h", will only get compiled if BMI160_IMU is defined
+ * Requires "boards.h" for slave select pin
+ */
 #include "application_config.h" 
 #include "boards.h"
 
@@ -14,6 +20,15 @@
 #include "spi.h"
 #include "yield.h"
 
+#include <stdbool.h>
+
+#define BMI160_INTERFACE_FIFO_SIZE       (1024 + 4) // bytes, FIFO and sensor time frame
+#define BMI160_INTERFACE_EXTRACT_CHUNK   13         // frames parsed at once in buffer_get
+#define BMI160_INTERFACE_SENSORTIME_HZ   25600      // 39.0625 us per tick
+#define BMI160_INTERFACE_SENSORTIME_WRAP (1UL << 24)
+#define BMI160_INTERFACE_STEP_COUNTER_CLEAR 0xB2 // Command register value
+#define BMI160_INTERFACE_TICKS_TO_MS(ticks) ((float)(ticks) * (1000.0f / BMI160_INTERFACE_SENSORTIME_HZ))
+
 #define PLATFORM_LOG_MODULE_NAME bmi160_imu_iface
 #if BMI160_INTERFACE_LOG_ENABLED
 #define PLATFORM_LOG_LEVEL       BMI160_INTERFACE_LOG_LEVEL
@@ -26,6 +41,17 @@ PLATFORM_LOG_MODULE_REGISTER();
 
 /** State variables **/
 static struct bmi160_dev imu = {0};
+static ruuvi_sensor_mode_t state_mode = RUUVI_SENSOR_MODE_SLEEP;
+/* FIFO burst buffer */
+static uint8_t fifo_raw[BMI160_INTERFACE_FIFO_SIZE];
+static struct bmi160_fifo_frame fifo_frame;
+static bool fifo_enabled = false;
+
+static ruuvi_interrupt_t interrupts[BMI160_INTERFACE_INTERRUPT_COUNT];
+static bool step_counter_enabled = false;
+
+static ruuvi_status_t bmi160_config_write(void);
+static bool bmi160_engines_active(void);
 
 //XXX
 ruuvi_status_t bmi160_interface_init(ruuvi_sensor_t* imu_sensor)
@@ -37,6 +63,7 @@ ruuvi_status_t bmi160_interface_init(ruuvi_sensor_t* imu_sensor)
   imu.read = spi_bosch_platform_read;
   imu.write = spi_bosch_platform_write;
   imu.delay_ms = platform_delay_ms;
+  imu.fifo = &fifo_frame;
 
   uint8_t num_retries = 0;
   do {
@@ -77,6 +104,25 @@ ruuvi_status_t bmi160_interface_init(ruuvi_sensor_t* imu_sensor)
   // result = bmi160_set_foc(&gyro);
   // if (BMI160_OK != result) { err_code |= RUUVI_ERROR_INTERNAL; PLATFORM_LOG_ERROR("Failed to compensate gyro");}
 
+  // Self-test leaves sensor configuration undefined, restore it and suspend sensor
+  imu.accel_cfg.odr = BMI160_ACCEL_ODR_50HZ;
+  imu.accel_cfg.range = BMI160_ACCEL_RANGE_2G;
+  imu.accel_cfg.bw = BMI160_ACCEL_BW_NORMAL_AVG4;
+  imu.gyro_cfg.odr = BMI160_GYRO_ODR_50HZ;
+  imu.gyro_cfg.range = BMI160_GYRO_RANGE_2000_DPS;
+  imu.gyro_cfg.bw = BMI160_GYRO_BW_NORMAL_MODE;
+  state_mode = RUUVI_SENSOR_MODE_SLEEP;
+  fifo_enabled = false;
+  step_counter_enabled = false;
+  for(size_t ii = 0; ii < BMI160_INTERFACE_INTERRUPT_COUNT; ii++)
+  {
+    interrupts[ii].interrupt_number = ii + 1;
+    interrupts[ii].trigger = RUUVI_SENSOR_TRIGGER_DISABLED;
+    interrupts[ii].threshold = 0;
+    interrupts[ii].dsp = RUUVI_SENSOR_DSP_LAST;
+  }
+  err_code |= bmi160_config_write();
+
   if (RUUVI_SUCCESS == result)
   {
     imu_sensor->init           = bmi160_interface_init;
@@ -94,78 +140,572 @@ ruuvi_status_t bmi160_interface_init(ruuvi_sensor_t* imu_sensor)
     imu_sensor->interrupt_set  = bmi160_interface_interrupt_set;
     imu_sensor->interrupt_get  = bmi160_interface_interrupt_get;
     imu_sensor->data_get       = bmi160_interface_data_get;
+    imu_sensor->buffer_get     = bmi160_interface_buffer_get;
   }
   return err_code;
 }
 
 ruuvi_status_t bmi160_interface_uninit(ruuvi_sensor_t* imu_sensor)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  state_mode = RUUVI_SENSOR_MODE_SLEEP;
+  fifo_enabled = false;
+  step_counter_enabled = false;
+  for(size_t ii = 0; ii < BMI160_INTERFACE_INTERRUPT_COUNT; ii++)
+  {
+    interrupts[ii].trigger = RUUVI_SENSOR_TRIGGER_DISABLED;
+  }
+  int8_t result = bmi160_soft_reset(&imu);
+  return (BMI160_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
+
+// Write configuration to sensor, sensor is kept suspended unless continuous mode is active.
+static ruuvi_status_t bmi160_config_write(void)
+{
+  if(RUUVI_SENSOR_MODE_CONTINOUS == state_mode)
+  {
+    imu.accel_cfg.power = BMI160_ACCEL_NORMAL_MODE;
+    imu.gyro_cfg.power = BMI160_GYRO_NORMAL_MODE;
+  }
+  else if(bmi160_engines_active())
+  {
+    imu.accel_cfg.power = BMI160_ACCEL_LOWPOWER_MODE;
+    imu.gyro_cfg.power = BMI160_GYRO_SUSPEND_MODE;
+  }
+  else
+  {
+    imu.accel_cfg.power = BMI160_ACCEL_SUSPEND_MODE;
+    imu.gyro_cfg.power = BMI160_GYRO_SUSPEND_MODE;
+  }
+  int8_t result = bmi160_set_sens_conf(&imu);
+  result |= bmi160_set_power_mode(&imu);
+  return (BMI160_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
 }
 
+/**
+ * Set common output data rate of accelerometer and gyroscope, rounded up to
+ * 25, 50, 100, 200, 400, 800 or 1600 Hz. Common rate keeps FIFO frames paired.
+ */
+ruuvi_status_t bmi160_interface_odr_set(const uint16_t hz)
+{
+  if(25 >= hz)        { imu.accel_cfg.odr = BMI160_ACCEL_ODR_25HZ;   imu.gyro_cfg.odr = BMI160_GYRO_ODR_25HZ;   }
+  else if(50 >= hz)   { imu.accel_cfg.odr = BMI160_ACCEL_ODR_50HZ;   imu.gyro_cfg.odr = BMI160_GYRO_ODR_50HZ;   }
+  else if(100 >= hz)  { imu.accel_cfg.odr = BMI160_ACCEL_ODR_100HZ;  imu.gyro_cfg.odr = BMI160_GYRO_ODR_100HZ;  }
+  else if(200 >= hz)  { imu.accel_cfg.odr = BMI160_ACCEL_ODR_200HZ;  imu.gyro_cfg.odr = BMI160_GYRO_ODR_200HZ;  }
+  else if(400 >= hz)  { imu.accel_cfg.odr = BMI160_ACCEL_ODR_400HZ;  imu.gyro_cfg.odr = BMI160_GYRO_ODR_400HZ;  }
+  else if(800 >= hz)  { imu.accel_cfg.odr = BMI160_ACCEL_ODR_800HZ;  imu.gyro_cfg.odr = BMI160_GYRO_ODR_800HZ;  }
+  else if(1600 >= hz) { imu.accel_cfg.odr = BMI160_ACCEL_ODR_1600HZ; imu.gyro_cfg.odr = BMI160_GYRO_ODR_1600HZ; }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
+  return bmi160_config_write();
+}
+
+ruuvi_status_t bmi160_interface_odr_get(uint16_t* const hz)
+{
+  if(NULL == hz) { return RUUVI_ERROR_NULL; }
+
+  switch(imu.accel_cfg.odr)
+  {
+    case BMI160_ACCEL_ODR_25HZ:   *hz = 25;   break;
+    case BMI160_ACCEL_ODR_50HZ:   *hz = 50;   break;
+    case BMI160_ACCEL_ODR_100HZ:  *hz = 100;  break;
+    case BMI160_ACCEL_ODR_200HZ:  *hz = 200;  break;
+    case BMI160_ACCEL_ODR_400HZ:  *hz = 400;  break;
+    case BMI160_ACCEL_ODR_800HZ:  *hz = 800;  break;
+    case BMI160_ACCEL_ODR_1600HZ: *hz = 1600; break;
+    default: return RUUVI_ERROR_INTERNAL;
+  }
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Samplerate is rounded up. Rates above 200 Hz do not fit into samplerate,
+ * use bmi160_interface_odr_set for 400 and 800 Hz. MAX is 1600 Hz.
+ */
 ruuvi_status_t bmi160_interface_samplerate_set(ruuvi_sensor_samplerate_t* samplerate)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == samplerate) { return RUUVI_ERROR_NULL; }
+
+  if(RUUVI_SENSOR_SAMPLERATE_NO_CHANGE == *samplerate)   { return RUUVI_SUCCESS; }
+  else if(RUUVI_SENSOR_SAMPLERATE_SINGLE == *samplerate) { return RUUVI_ERROR_NOT_SUPPORTED; }
+  else if(RUUVI_SENSOR_SAMPLERATE_STOP == *samplerate)
+  {
+    ruuvi_sensor_mode_t mode = RUUVI_SENSOR_MODE_SLEEP;
+    return bmi160_interface_mode_set(&mode);
+  }
+  else if(RUUVI_SENSOR_SAMPLERATE_MIN == *samplerate) { return bmi160_interface_odr_set(25);   }
+  else if(RUUVI_SENSOR_SAMPLERATE_MAX == *samplerate) { return bmi160_interface_odr_set(1600); }
+  else if(200 >= *samplerate) { return bmi160_interface_odr_set(*samplerate); }
+  return RUUVI_ERROR_NOT_SUPPORTED;
 }
 
 ruuvi_status_t bmi160_interface_samplerate_get(ruuvi_sensor_samplerate_t* samplerate)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == samplerate) { return RUUVI_ERROR_NULL; }
+  uint16_t hz = 0;
+  ruuvi_status_t err_code = bmi160_interface_odr_get(&hz);
+
+  if(200 >= hz)       { *samplerate = hz; }
+  else if(1600 == hz) { *samplerate = RUUVI_SENSOR_SAMPLERATE_MAX; }
+  else                { *samplerate = RUUVI_SENSOR_SAMPLERATE_NOT_SUPPORTED; }
+  return err_code;
 }
 
 ruuvi_status_t bmi160_interface_resolution_set(ruuvi_sensor_resolution_t* resolution)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  return RUUVI_ERROR_NOT_SUPPORTED;
 }
 
 ruuvi_status_t bmi160_interface_resolution_get(ruuvi_sensor_resolution_t* resolution)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == resolution) { return RUUVI_ERROR_NULL; }
+  *resolution = 16;
+  return RUUVI_SUCCESS;
 }
 
+/**
+ * Scale of accelerometer in g, rounded up to 2, 4, 8 or 16 g.
+ * Gyroscope range is set with bmi160_interface_gyro_range_set.
+ */
 ruuvi_status_t bmi160_interface_scale_set(ruuvi_sensor_scale_t* scale)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == scale) { return RUUVI_ERROR_NULL; }
+
+  if(RUUVI_SENSOR_SCALE_NO_CHANGE == *scale)   { return RUUVI_SUCCESS; }
+  else if(RUUVI_SENSOR_SCALE_MIN == *scale) { imu.accel_cfg.range = BMI160_ACCEL_RANGE_2G;  }
+  else if(RUUVI_SENSOR_SCALE_MAX == *scale) { imu.accel_cfg.range = BMI160_ACCEL_RANGE_16G; }
+  else if(2  >= *scale) { imu.accel_cfg.range = BMI160_ACCEL_RANGE_2G;  }
+  else if(4  >= *scale) { imu.accel_cfg.range = BMI160_ACCEL_RANGE_4G;  }
+  else if(8  >= *scale) { imu.accel_cfg.range = BMI160_ACCEL_RANGE_8G;  }
+  else if(16 >= *scale) { imu.accel_cfg.range = BMI160_ACCEL_RANGE_16G; }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
+  return bmi160_config_write();
 }
 
 ruuvi_status_t bmi160_interface_scale_get(ruuvi_sensor_scale_t* scale)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == scale) { return RUUVI_ERROR_NULL; }
+
+  switch(imu.accel_cfg.range)
+  {
+    case BMI160_ACCEL_RANGE_2G:  *scale = 2;  break;
+    case BMI160_ACCEL_RANGE_4G:  *scale = 4;  break;
+    case BMI160_ACCEL_RANGE_8G:  *scale = 8;  break;
+    case BMI160_ACCEL_RANGE_16G: *scale = 16; break;
+    default: return RUUVI_ERROR_INTERNAL;
+  }
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Range of gyroscope in degrees per second, rounded up to 125, 250, 500, 1000 or 2000 dps.
+ */
+ruuvi_status_t bmi160_interface_gyro_range_set(const uint16_t dps)
+{
+  if(125 >= dps)       { imu.gyro_cfg.range = BMI160_GYRO_RANGE_125_DPS;  }
+  else if(250 >= dps)  { imu.gyro_cfg.range = BMI160_GYRO_RANGE_250_DPS;  }
+  else if(500 >= dps)  { imu.gyro_cfg.range = BMI160_GYRO_RANGE_500_DPS;  }
+  else if(1000 >= dps) { imu.gyro_cfg.range = BMI160_GYRO_RANGE_1000_DPS; }
+  else if(2000 >= dps) { imu.gyro_cfg.range = BMI160_GYRO_RANGE_2000_DPS; }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
+  return bmi160_config_write();
+}
+
+ruuvi_status_t bmi160_interface_gyro_range_get(uint16_t* const dps)
+{
+  if(NULL == dps) { return RUUVI_ERROR_NULL; }
+
+  switch(imu.gyro_cfg.range)
+  {
+    case BMI160_GYRO_RANGE_125_DPS:  *dps = 125;  break;
+    case BMI160_GYRO_RANGE_250_DPS:  *dps = 250;  break;
+    case BMI160_GYRO_RANGE_500_DPS:  *dps = 500;  break;
+    case BMI160_GYRO_RANGE_1000_DPS: *dps = 1000; break;
+    case BMI160_GYRO_RANGE_2000_DPS: *dps = 2000; break;
+    default: return RUUVI_ERROR_INTERNAL;
+  }
+  return RUUVI_SUCCESS;
 }
 
+/**
+ * Digital filter of both sensors. OS 1 is normal mode, OS 2 and OS 4 lower the filter cutoff.
+ * RUUVI_SENSOR_DSP_LAST returns to normal mode.
+ */
 ruuvi_status_t bmi160_interface_dsp_set(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
+
+  uint8_t os = 1;
+  if(RUUVI_SENSOR_DSP_OS == *dsp)         { os = *parameter; }
+  else if(RUUVI_SENSOR_DSP_LAST != *dsp)  { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  switch(os)
+  {
+    case 1:
+      imu.accel_cfg.bw = BMI160_ACCEL_BW_NORMAL_AVG4;
+      imu.gyro_cfg.bw = BMI160_GYRO_BW_NORMAL_MODE;
+      break;
+
+    case 2:
+      imu.accel_cfg.bw = BMI160_ACCEL_BW_OSR2_AVG2;
+      imu.gyro_cfg.bw = BMI160_GYRO_BW_OSR2_MODE;
+      break;
+
+    case 4:
+      imu.accel_cfg.bw = BMI160_ACCEL_BW_OSR4_AVG1;
+      imu.gyro_cfg.bw = BMI160_GYRO_BW_OSR4_MODE;
+      break;
+
+    default:
+      return RUUVI_ERROR_NOT_SUPPORTED;
+  }
+  return bmi160_config_write();
 }
 
 ruuvi_status_t bmi160_interface_dsp_get(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
+
+  switch(imu.gyro_cfg.bw)
+  {
+    case BMI160_GYRO_BW_NORMAL_MODE:
+      *dsp = RUUVI_SENSOR_DSP_LAST;
+      *parameter = 1;
+      break;
+
+    case BMI160_GYRO_BW_OSR2_MODE:
+      *dsp = RUUVI_SENSOR_DSP_OS;
+      *parameter = 2;
+      break;
+
+    case BMI160_GYRO_BW_OSR4_MODE:
+      *dsp = RUUVI_SENSOR_DSP_OS;
+      *parameter = 4;
+      break;
+
+    default:
+      return RUUVI_ERROR_INTERNAL;
+  }
+  return RUUVI_SUCCESS;
 }
 
 ruuvi_status_t bmi160_interface_mode_set(ruuvi_sensor_mode_t* mode)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == mode) { return RUUVI_ERROR_NULL; }
+
+  switch(*mode)
+  {
+    case RUUVI_SENSOR_MODE_SLEEP:
+    case RUUVI_SENSOR_MODE_CONTINOUS:
+      state_mode = *mode;
+      break;
+
+    default:
+      return RUUVI_ERROR_NOT_SUPPORTED;
+  }
+  return bmi160_config_write();
 }
 
 ruuvi_status_t bmi160_interface_mode_get(ruuvi_sensor_mode_t* mode)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == mode) { return RUUVI_ERROR_NULL; }
+  *mode = state_mode;
+  return RUUVI_SUCCESS;
+}
+
+// True if any on-chip engine requires accelerometer to run while sensor is in sleep mode
+static bool bmi160_engines_active(void)
+{
+  for(size_t ii = 0; ii < BMI160_INTERFACE_INTERRUPT_COUNT; ii++)
+  {
+    if(RUUVI_SENSOR_TRIGGER_DISABLED != interrupts[ii].trigger) { return true; }
+  }
+  return step_counter_enabled;
+}
+
+// Convert threshold in mg to motion threshold register LSBs, which depend on accelerometer range.
+static uint8_t bmi160_motion_threshold(const float mg)
+{
+  ruuvi_sensor_scale_t g = 2;
+  bmi160_interface_scale_get(&g);
+  float lsb = mg / ((g * 1000.0f) / 512.0f);
+  if(0 > lsb)   { lsb = 0;   }
+  if(255 < lsb) { lsb = 255; }
+  return (uint8_t)lsb;
 }
 
+/**
+ * Configure on-chip motion engines, interrupts are routed to INT1.
+ * number: bmi160_interface_interrupt_t
+ * threshold: mg. Ignored by step detector.
+ * trigger: ABOVE for any-motion, significant motion and step detector, BELOW for no-motion, DISABLED to turn off.
+ * dsp: not supported, must be RUUVI_SENSOR_DSP_LAST.
+ *
+ * While an engine is enabled, accelerometer runs in low-power mode when sensor is in sleep mode.
+ * Any-motion and significant motion share the motion engine, its threshold and select bit, so only one of them
+ * can be enabled at a time. Enabling one while the other is enabled returns RUUVI_ERROR_INVALID_STATE.
+ */
 ruuvi_status_t bmi160_interface_interrupt_set(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == threshold || NULL == trigger || NULL == dsp) { return RUUVI_ERROR_NULL; }
+  if(0 == number || BMI160_INTERFACE_INTERRUPT_COUNT < number) { return RUUVI_ERROR_NOT_SUPPORTED; }
+  if(RUUVI_SENSOR_DSP_LAST != *dsp) { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  bool enable = (RUUVI_SENSOR_TRIGGER_DISABLED != *trigger);
+  uint8_t en = enable ? BMI160_ENABLE : BMI160_DISABLE;
+  uint8_t shared = 0;
+  if(BMI160_INTERFACE_INTERRUPT_ANY_MOTION == number) { shared = BMI160_INTERFACE_INTERRUPT_SIGNIFICANT_MOTION; }
+  if(BMI160_INTERFACE_INTERRUPT_SIGNIFICANT_MOTION == number) { shared = BMI160_INTERFACE_INTERRUPT_ANY_MOTION; }
+  if(enable && 0 != shared && RUUVI_SENSOR_TRIGGER_DISABLED != interrupts[shared - 1].trigger) { return RUUVI_ERROR_INVALID_STATE; }
+  struct bmi160_int_settg int_config = {0};
+  int_config.int_channel = BMI160_INT_CHANNEL_1;
+  int_config.int_pin_settg.output_en = BMI160_ENABLE;
+  int_config.int_pin_settg.output_mode = BMI160_DISABLE; // push-pull
+  int_config.int_pin_settg.output_type = BMI160_ENABLE;  // active high
+  int_config.int_pin_settg.edge_ctrl = BMI160_ENABLE;
+  int_config.int_pin_settg.input_en = BMI160_DISABLE;
+  int_config.int_pin_settg.latch_dur = BMI160_LATCH_DUR_NONE;
+
+  switch(number)
+  {
+    case BMI160_INTERFACE_INTERRUPT_ANY_MOTION:
+      if(enable && RUUVI_SENSOR_TRIGGER_ABOVE != *trigger) { return RUUVI_ERROR_NOT_SUPPORTED; }
+      int_config.int_type = BMI160_ACC_ANY_MOTION_INT;
+      int_config.int_type_cfg.acc_any_motion_int.anymotion_en = en;
+      int_config.int_type_cfg.acc_any_motion_int.anymotion_x = BMI160_ENABLE;
+      int_config.int_type_cfg.acc_any_motion_int.anymotion_y = BMI160_ENABLE;
+      int_config.int_type_cfg.acc_any_motion_int.anymotion_z = BMI160_ENABLE;
+      int_config.int_type_cfg.acc_any_motion_int.anymotion_dur = 0;       // 1 sample over threshold
+      int_config.int_type_cfg.acc_any_motion_int.anymotion_data_src = 0;  // filtered data
+      int_config.int_type_cfg.acc_any_motion_int.anymotion_thr = bmi160_motion_threshold(*threshold);
+      break;
+
+    case BMI160_INTERFACE_INTERRUPT_NO_MOTION:
+      if(enable && RUUVI_SENSOR_TRIGGER_BELOW != *trigger) { return RUUVI_ERROR_NOT_SUPPORTED; }
+      int_config.int_type = BMI160_ACC_SLOW_NO_MOTION_INT;
+      int_config.int_type_cfg.acc_no_motion_int.no_motion_x = en;
+      int_config.int_type_cfg.acc_no_motion_int.no_motion_y = en;
+      int_config.int_type_cfg.acc_no_motion_int.no_motion_z = en;
+      int_config.int_type_cfg.acc_no_motion_int.no_motion_dur = 0;  // 1 s
+      int_config.int_type_cfg.acc_no_motion_int.no_motion_sel = 1;  // no-motion instead of slow-motion
+      int_config.int_type_cfg.acc_no_motion_int.no_motion_src = 0;  // filtered data
+      int_config.int_type_cfg.acc_no_motion_int.no_motion_thres = bmi160_motion_threshold(*threshold);
+      break;
+
+    case BMI160_INTERFACE_INTERRUPT_SIGNIFICANT_MOTION:
+      if(enable && RUUVI_SENSOR_TRIGGER_ABOVE != *trigger) { return RUUVI_ERROR_NOT_SUPPORTED; }
+      int_config.int_type = BMI160_ACC_SIG_MOTION_INT;
+      int_config.int_type_cfg.acc_sig_motion_int.sig_en = en;
+      int_config.int_type_cfg.acc_sig_motion_int.sig_mot_skip = 1;   // 3 s
+      int_config.int_type_cfg.acc_sig_motion_int.sig_mot_proof = 1;  // 0.5 s
+      int_config.int_type_cfg.acc_sig_motion_int.sig_data_src = 0;   // filtered data
+      int_config.int_type_cfg.acc_sig_motion_int.sig_mot_thres = bmi160_motion_threshold(*threshold);
+      break;
+
+    case BMI160_INTERFACE_INTERRUPT_STEP_DETECTOR:
+      if(enable && RUUVI_SENSOR_TRIGGER_ABOVE != *trigger) { return RUUVI_ERROR_NOT_SUPPORTED; }
+      int_config.int_type = BMI160_STEP_DETECT_INT;
+      int_config.int_type_cfg.acc_step_detect_int.step_detector_en = en;
+      int_config.int_type_cfg.acc_step_detect_int.step_detector_mode = BMI160_STEP_DETECT_NORMAL;
+      break;
+
+    default:
+      return RUUVI_ERROR_NOT_SUPPORTED;
+  }
+
+  int8_t result = bmi160_set_int_config(&int_config, &imu);
+  if(BMI160_OK != result) { return RUUVI_ERROR_INTERNAL; }
+
+  interrupts[number - 1].interrupt_number = number;
+  interrupts[number - 1].threshold = *threshold;
+  interrupts[number - 1].trigger = *trigger;
+  interrupts[number - 1].dsp = *dsp;
+  return bmi160_config_write();
 }
 
 ruuvi_status_t bmi160_interface_interrupt_get(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == threshold || NULL == trigger || NULL == dsp) { return RUUVI_ERROR_NULL; }
+  if(0 == number || BMI160_INTERFACE_INTERRUPT_COUNT < number) { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  *threshold = interrupts[number - 1].threshold;
+  *trigger = interrupts[number - 1].trigger;
+  *dsp = interrupts[number - 1].dsp;
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Enable on-chip step counter. Counter keeps running in sleep mode with accelerometer in low-power mode.
+ */
+ruuvi_status_t bmi160_interface_step_counter_use(const bool enable)
+{
+  int8_t result = bmi160_set_step_counter(enable ? BMI160_ENABLE : BMI160_DISABLE, &imu);
+  if(BMI160_OK != result) { return RUUVI_ERROR_INTERNAL; }
+  step_counter_enabled = enable;
+  return bmi160_config_write();
+}
+
+ruuvi_status_t bmi160_interface_step_counter_get(uint16_t* const steps)
+{
+  if(NULL == steps) { return RUUVI_ERROR_NULL; }
+  if(!step_counter_enabled) { return RUUVI_ERROR_INVALID_STATE; }
+  int8_t result = bmi160_read_step_counter(steps, &imu);
+  return (BMI160_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
+
+ruuvi_status_t bmi160_interface_step_counter_reset(void)
+{
+  uint8_t command = BMI160_INTERFACE_STEP_COUNTER_CLEAR;
+  int8_t result = bmi160_set_regs(BMI160_COMMAND_REG_ADDR, &command, 1, &imu);
+  return (BMI160_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
+
+/**
+ * Extend 24-bit sensor time to monotonic ticks. Must be called at least once per 655 seconds.
+ */
+static uint64_t bmi160_sensortime_extend(const uint32_t sensortime)
+{
+  static uint64_t epoch = 0;
+  static uint32_t previous = 0;
+  if(sensortime < previous) { epoch += BMI160_INTERFACE_SENSORTIME_WRAP; }
+  previous = sensortime;
+  return epoch + sensortime;
+}
+
+// Convert raw accelerometer and gyroscope samples with current ranges
+static void bmi160_convert(const struct bmi160_sensor_data* const accel, const struct bmi160_sensor_data* const gyro, ruuvi_imu_data_t* const p_imu)
+{
+  ruuvi_sensor_scale_t g = 0;
+  uint16_t dps = 0;
+  bmi160_interface_scale_get(&g);
+  bmi160_interface_gyro_range_get(&dps);
+  float mg_per_lsb = (g * 1000.0f) / 32768.0f;
+  float dps_per_lsb = dps / 32768.0f;
+
+  p_imu->acceleration.x_mg = accel->x * mg_per_lsb;
+  p_imu->acceleration.y_mg = accel->y * mg_per_lsb;
+  p_imu->acceleration.z_mg = accel->z * mg_per_lsb;
+  p_imu->gyration.x_mdps   = gyro->x * dps_per_lsb;
+  p_imu->gyration.y_mdps   = gyro->y * dps_per_lsb;
+  p_imu->gyration.z_mdps   = gyro->z * dps_per_lsb;
 }
 
 ruuvi_status_t bmi160_interface_data_get(void* data)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_imu_data_t* p_imu = (ruuvi_imu_data_t*)data;
+  struct bmi160_sensor_data accel = {0};
+  struct bmi160_sensor_data gyro = {0};
+
+  int8_t result = bmi160_get_sensor_data(BMI160_ACCEL_SEL | BMI160_GYRO_SEL | BMI160_TIME_SEL, &accel, &gyro, &imu);
+  bmi160_convert(&accel, &gyro, p_imu);
+  p_imu->timestamp_ms = BMI160_INTERFACE_TICKS_TO_MS(bmi160_sensortime_extend(accel.sensortime));
+  return (BMI160_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
+
+ruuvi_status_t bmi160_interface_acceleration_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_imu_data_t imu_data;
+  ruuvi_status_t err_code = bmi160_interface_data_get(&imu_data);
+  *(ruuvi_acceleration_data_t*)data = imu_data.acceleration;
+  return err_code;
+}
+
+ruuvi_status_t bmi160_interface_gyration_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_imu_data_t imu_data;
+  ruuvi_status_t err_code = bmi160_interface_data_get(&imu_data);
+  *(ruuvi_gyration_data_t*)data = imu_data.gyration;
+  return err_code;
+}
+
+/**
+ * Enable or disable headered FIFO with accelerometer, gyroscope and sensor time.
+ * FIFO is flushed on enable.
+ */
+ruuvi_status_t bmi160_interface_fifo_use(const bool enable)
+{
+  int8_t result = BMI160_OK;
+  uint8_t config = BMI160_FIFO_ACCEL | BMI160_FIFO_GYRO | BMI160_FIFO_HEADER | BMI160_FIFO_TIME;
+  if(enable)
+  {
+    result |= bmi160_set_fifo_config(BMI160_FIFO_CONFIG_1_MASK, BMI160_DISABLE, &imu);
+    result |= bmi160_set_fifo_config(config, BMI160_ENABLE, &imu);
+    result |= bmi160_set_fifo_flush(&imu);
+  }
+  else
+  {
+    result |= bmi160_set_fifo_config(config, BMI160_DISABLE, &imu);
+  }
+  if(BMI160_OK == result) { fifo_enabled = enable; }
+  return (BMI160_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
+}
+
+/**
+ * Drain FIFO into ruuvi_imu_buffer_t with a single burst read.
+ * Accelerometer and gyroscope frames are paired, which requires common ODR.
+ * Timestamps are calculated backwards from the sensor time frame at the end of FIFO.
+ * Samples which do not fit into given buffer are dropped.
+ */
+ruuvi_status_t bmi160_interface_buffer_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_imu_buffer_t* p_buffer = (ruuvi_imu_buffer_t*)data;
+  if(NULL == p_buffer->data) { return RUUVI_ERROR_NULL; }
+  if(!fifo_enabled) { return RUUVI_ERROR_INVALID_STATE; }
+
+  size_t max_samples = p_buffer->count;
+  size_t total = 0;
+  p_buffer->count = 0;
+
+  fifo_frame.data = fifo_raw;
+  fifo_frame.length = sizeof(fifo_raw);
+  fifo_frame.sensor_time = 0;
+  int8_t result = bmi160_get_fifo_data(&imu);
+
+  // Parse burst in chunks, extraction continues where previous call ended.
+  // Parse until end even if buffer is full to reach sensor time frame.
+  struct bmi160_sensor_data accel[BMI160_INTERFACE_EXTRACT_CHUNK];
+  struct bmi160_sensor_data gyro[BMI160_INTERFACE_EXTRACT_CHUNK];
+  uint8_t accel_frames = BMI160_INTERFACE_EXTRACT_CHUNK;
+  uint8_t gyro_frames = BMI160_INTERFACE_EXTRACT_CHUNK;
+  while(BMI160_OK == result && BMI160_INTERFACE_EXTRACT_CHUNK == accel_frames && BMI160_INTERFACE_EXTRACT_CHUNK == gyro_frames)
+  {
+    accel_frames = BMI160_INTERFACE_EXTRACT_CHUNK;
+    gyro_frames = BMI160_INTERFACE_EXTRACT_CHUNK;
+    result |= bmi160_extract_accel(accel, &accel_frames, &imu);
+    result |= bmi160_extract_gyro(gyro, &gyro_frames, &imu);
+    uint8_t pairs = (accel_frames < gyro_frames) ? accel_frames : gyro_frames;
+    for(size_t ii = 0; ii < pairs; ii++)
+    {
+      if(p_buffer->count < max_samples)
+      {
+        bmi160_convert(&accel[ii], &gyro[ii], &(p_buffer->data[p_buffer->count++]));
+      }
+      total++;
+    }
+  }
+
+  // Sensor time frame is present only if FIFO was read to the end, read sensor time register otherwise.
+  uint32_t sensortime = fifo_frame.sensor_time;
+  if(0 == sensortime)
+  {
+    uint8_t raw_time[3] = {0};
+    result |= bmi160_get_regs(BMI160_SENSOR_TIME_ADDR, raw_time, sizeof(raw_time), &imu);
+    sensortime = ((uint32_t)raw_time[2] << 16) | ((uint32_t)raw_time[1] << 8) | raw_time[0];
+  }
+  uint64_t last = bmi160_sensortime_extend(sensortime);
+  uint16_t hz = 0;
+  bmi160_interface_odr_get(&hz);
+  uint32_t period = (hz) ? (BMI160_INTERFACE_SENSORTIME_HZ / hz) : 0;
+  for(size_t ii = 0; ii < p_buffer->count; ii++)
+  {
+    uint64_t ticks_before_last = (uint64_t)(total - 1 - ii) * period;
+    uint64_t ticks = (last > ticks_before_last) ? last - ticks_before_last : 0;
+    p_buffer->data[ii].timestamp_ms = BMI160_INTERFACE_TICKS_TO_MS(ticks);
+  }
+
+  return (BMI160_OK == result) ? RUUVI_SUCCESS : RUUVI_ERROR_INTERNAL;
 }
 
-#endif
\ No newline at end of file
+#endif
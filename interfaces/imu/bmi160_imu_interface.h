@@ -1,5 +1,5 @@
 /**
- *  Implement ruuvi sensor abstraction functions for BME280.
+ *  Implement ruuvi sensor abstraction functions for BMI160.
  */
 
 #ifndef BMI160_INTERFACE_H
@@ -7,6 +7,17 @@
 #include "ruuvi_error.h"
 #include "ruuvi_sensor.h"
 #include "imu.h"
+#include <stdbool.h>
+
+// Interrupt numbers of on-chip engines for interrupt_set / interrupt_get.
+// ANY_MOTION and SIGNIFICANT_MOTION share the motion engine and are mutually exclusive.
+typedef enum {
+  BMI160_INTERFACE_INTERRUPT_ANY_MOTION         = 1,
+  BMI160_INTERFACE_INTERRUPT_NO_MOTION          = 2,
+  BMI160_INTERFACE_INTERRUPT_SIGNIFICANT_MOTION = 3,
+  BMI160_INTERFACE_INTERRUPT_STEP_DETECTOR      = 4
+}bmi160_interface_interrupt_t;
+#define BMI160_INTERFACE_INTERRUPT_COUNT 4
 
 ruuvi_status_t bmi160_interface_init(ruuvi_sensor_t* imu_sensor);
 ruuvi_status_t bmi160_interface_uninit(ruuvi_sensor_t* imu_sensor);
@@ -26,5 +37,19 @@ ruuvi_status_t bmi160_interface_data_get(void* data);
 
 ruuvi_status_t bmi160_interface_acceleration_get (void* data);
 ruuvi_status_t bmi160_interface_gyration_get     (void* data);
+ruuvi_status_t bmi160_interface_buffer_get       (void* data);
+
+// Common output data rate of accelerometer and gyroscope, 25 - 1600 Hz.
+ruuvi_status_t bmi160_interface_odr_set(const uint16_t hz);
+ruuvi_status_t bmi160_interface_odr_get(uint16_t* const hz);
+// Gyroscope range, scale_set controls accelerometer.
+ruuvi_status_t bmi160_interface_gyro_range_set(const uint16_t dps);
+ruuvi_status_t bmi160_interface_gyro_range_get(uint16_t* const dps);
+// Headered FIFO with paired accelerometer and gyroscope frames
+ruuvi_status_t bmi160_interface_fifo_use(const bool enable);
+// On-chip step counter
+ruuvi_status_t bmi160_interface_step_counter_use(const bool enable);
+ruuvi_status_t bmi160_interface_step_counter_get(uint16_t* const steps);
+ruuvi_status_t bmi160_interface_step_counter_reset(void);
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "ruuvi_error.h"
 #include "acceleration.h"
 #include "gyration.h"
+#include <stddef.h>
 
 #define IMU_INVALID RUUVI_FLOAT_INVALID
 
@@ -12,4 +13,10 @@ typedef struct {
   float timestamp_ms;
 }ruuvi_imu_data_t;
 
+// Buffer for buffer_get. Count is maximum number of samples as input, number of samples read as output.
+typedef struct {
+  size_t count;
+  ruuvi_imu_data_t* data;
+}ruuvi_imu_buffer_t;
+
 #endif
\ No newline at end of file
@@ -13,6 +13,13 @@
 #include "i2c.h"
 #include "yield.h"
 #include "magnetism.h"
+#include "pin_interrupt.h"
+#include <string.h>
+#if MAGNETISM_CALIBRATION
+#include "magnetism_calibration.h"
+#endif
+
+#define LIS2MDL_INTERFACE_SINGLE_TIMEOUT_MS 20 // Single measurement takes ~10 ms in high-resolution mode
 
 #define PLATFORM_LOG_MODULE_NAME lis2mdl_iface
 #if LIS2MDL_INTERFACE_LOG_ENABLED
@@ -27,6 +34,14 @@ PLATFORM_LOG_MODULE_REGISTER();
 static lis2mdl_ctx_t dev_ctx;
 static ruuvi_sensor_mode_t mode;
 static uint8_t handle = LIS2MDL_ADDRESS;
+static uint8_t drdy_pin;
+static bool drdy_enabled = false;
+#if MAGNETISM_CALIBRATION
+static magnetism_calibration_t calibration;
+static bool calibration_collecting = false;
+static int16_t calibration_offset[3];     // LSB, subtracted on-chip
+static int32_t calibration_matrix[3][3];  // Q14 soft-iron correction
+#endif
 
 /*
 *  Initialize mems driver interface.
@@ -86,7 +101,17 @@ ruuvi_status_t lis2mdl_interface_init(ruuvi_sensor_t* magnetic_sensor)
    */
   err_code |= lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_POWER_DOWN);
   mode = RUUVI_SENSOR_MODE_SLEEP;
-
+  drdy_enabled = false;
+#if MAGNETISM_CALIBRATION
+  // Reset cleared OFFSET registers
+  int16_t no_offset[3] = {0};
+  int32_t identity[3][3] = { { MAGNETISM_CALIBRATION_ONE, 0, 0 },
+                             { 0, MAGNETISM_CALIBRATION_ONE, 0 },
+                             { 0, 0, MAGNETISM_CALIBRATION_ONE } };
+  calibration_collecting = false;
+  memcpy(calibration_offset, no_offset, sizeof(calibration_offset));
+  memcpy(calibration_matrix, identity, sizeof(calibration_matrix));
+#endif
 
   if(RUUVI_SUCCESS == err_code)
   {
@@ -111,24 +136,39 @@ ruuvi_status_t lis2mdl_interface_init(ruuvi_sensor_t* magnetic_sensor)
   return err_code;
 
 }
-ruuvi_status_t lis2mdl_interface_uninit(ruuvi_sensor_t* acceleration_sensor)
+ruuvi_status_t lis2mdl_interface_uninit(ruuvi_sensor_t* magnetic_sensor)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  if(drdy_enabled) { err_code |= lis2mdl_interface_drdy_interrupt_use(false, drdy_pin, NULL); }
+  err_code |= lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_POWER_DOWN);
+  mode = RUUVI_SENSOR_MODE_SLEEP;
+  return err_code;
 }
 
+/**
+ * Set up samplerate of continuous mode. Samplerate is rounded up, MAX is 100 Hz.
+ * STOP powers down the sensor and puts it into sleep mode.
+ * Single samples are taken with RUUVI_SENSOR_MODE_SINGLE_* modes.
+ */
 ruuvi_status_t lis2mdl_interface_samplerate_set(ruuvi_sensor_samplerate_t* samplerate)
 {
   if (NULL == samplerate) { return RUUVI_ERROR_NULL; }
+  if (RUUVI_SENSOR_SAMPLERATE_SINGLE == *samplerate)    { return RUUVI_ERROR_NOT_SUPPORTED; }
+  if (RUUVI_SENSOR_SAMPLERATE_NO_CHANGE == *samplerate) { return RUUVI_SUCCESS; }
   ruuvi_status_t err_code = RUUVI_SUCCESS;
 
-  if (RUUVI_SENSOR_SAMPLERATE_STOP == *samplerate) { err_code |= lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_POWER_DOWN); }
-  else if (RUUVI_SENSOR_SAMPLERATE_MIN == *samplerate) { err_code |= lis2mdl_data_rate_set(&dev_ctx, LIS2MDL_ODR_10Hz); }
-  else if (RUUVI_SENSOR_SAMPLERATE_MAX == *samplerate) { err_code |= lis2mdl_data_rate_set(&dev_ctx, LIS2MDL_ODR_10Hz); }
-  else if (RUUVI_SENSOR_SAMPLERATE_NO_CHANGE == *samplerate) { return RUUVI_SUCCESS; }
+  if (RUUVI_SENSOR_SAMPLERATE_STOP == *samplerate)
+  {
+    mode = RUUVI_SENSOR_MODE_SLEEP;
+    return lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_POWER_DOWN);
+  }
+  else if (RUUVI_SENSOR_SAMPLERATE_MIN == *samplerate) { err_code |= lis2mdl_data_rate_set(&dev_ctx, LIS2MDL_ODR_10Hz);  }
+  else if (RUUVI_SENSOR_SAMPLERATE_MAX == *samplerate) { err_code |= lis2mdl_data_rate_set(&dev_ctx, LIS2MDL_ODR_100Hz); }
   else if (10  >= *samplerate) { err_code |= lis2mdl_data_rate_set(&dev_ctx, LIS2MDL_ODR_10Hz);  }
   else if (20  >= *samplerate) { err_code |= lis2mdl_data_rate_set(&dev_ctx, LIS2MDL_ODR_20Hz);  }
   else if (50  >= *samplerate) { err_code |= lis2mdl_data_rate_set(&dev_ctx, LIS2MDL_ODR_50Hz);  }
   else if (100 >= *samplerate) { err_code |= lis2mdl_data_rate_set(&dev_ctx, LIS2MDL_ODR_100Hz); }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
 
   if (RUUVI_SENSOR_MODE_CONTINOUS == mode) { err_code |= lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_CONTINUOUS_MODE); }
 
@@ -167,14 +207,33 @@ ruuvi_status_t lis2mdl_interface_samplerate_get(ruuvi_sensor_samplerate_t* sampl
   return RUUVI_SUCCESS;
 }
 
+/**
+ * LIS2MDL has 16-bit output in both power modes, low-power mode has roughly double the RMS noise.
+ * Resolution of 15 bits or less selects low-power mode, 16 bits selects high-resolution mode.
+ */
 ruuvi_status_t lis2mdl_interface_resolution_set(ruuvi_sensor_resolution_t* resolution)
 {
+  if (NULL == resolution) { return RUUVI_ERROR_NULL; }
+  if (RUUVI_SENSOR_RESOLUTION_NO_CHANGE == *resolution) { return RUUVI_SUCCESS; }
+
+  if (RUUVI_SENSOR_RESOLUTION_MIN == *resolution)      { return lis2mdl_power_mode_set(&dev_ctx, LIS2MDL_LOW_POWER); }
+  else if (RUUVI_SENSOR_RESOLUTION_MAX == *resolution) { return lis2mdl_power_mode_set(&dev_ctx, LIS2MDL_HIGH_RESOLUTION); }
+  else if (15 >= *resolution) { return lis2mdl_power_mode_set(&dev_ctx, LIS2MDL_LOW_POWER); }
+  else if (16 >= *resolution) { return lis2mdl_power_mode_set(&dev_ctx, LIS2MDL_HIGH_RESOLUTION); }
+
   return RUUVI_ERROR_NOT_SUPPORTED;
 }
 
 ruuvi_status_t lis2mdl_interface_resolution_get(ruuvi_sensor_resolution_t* resolution)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if (NULL == resolution) { return RUUVI_ERROR_NULL; }
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+
+  lis2mdl_lp_t power;
+  err_code |= lis2mdl_power_mode_get(&dev_ctx, &power);
+  *resolution = (LIS2MDL_LOW_POWER == power) ? 15 : 16;
+
+  return err_code;
 }
 
 ruuvi_status_t lis2mdl_interface_scale_set(ruuvi_sensor_scale_t* scale)
@@ -189,14 +248,49 @@ ruuvi_status_t lis2mdl_interface_scale_get(ruuvi_sensor_scale_t* scale)
   return RUUVI_SUCCESS;
 }
 
+/**
+ * RUUVI_SENSOR_DSP_LOW_PASS enables digital low-pass filter, bandwidth ODR/4. Parameter is ignored.
+ * RUUVI_SENSOR_DSP_LAST disables filter, bandwidth ODR/2.
+ */
 ruuvi_status_t lis2mdl_interface_dsp_set(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if (NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
+
+  if (RUUVI_SENSOR_DSP_LAST == *dsp)     { return lis2mdl_low_pass_bandwidth_set(&dev_ctx, LIS2MDL_ODR_DIV_2); }
+  if (RUUVI_SENSOR_DSP_LOW_PASS == *dsp) { return lis2mdl_low_pass_bandwidth_set(&dev_ctx, LIS2MDL_ODR_DIV_4); }
+
+  return RUUVI_ERROR_NOT_SUPPORTED;
 }
 
 ruuvi_status_t lis2mdl_interface_dsp_get(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
 {
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  if (NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+
+  lis2mdl_lpf_t bandwidth;
+  err_code |= lis2mdl_low_pass_bandwidth_get(&dev_ctx, &bandwidth);
+  *dsp = (LIS2MDL_ODR_DIV_4 == bandwidth) ? RUUVI_SENSOR_DSP_LOW_PASS : RUUVI_SENSOR_DSP_LAST;
+  *parameter = 1;
+
+  return err_code;
+}
+
+/**
+ * Trigger a single measurement. Stale data-ready flag is cleared first so that
+ * a blocking caller and the DRDY interrupt only see the new sample.
+ */
+static ruuvi_status_t lis2mdl_single_trigger(void)
+{
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  uint8_t drdy = 0;
+  err_code |= lis2mdl_mag_data_ready_get(&dev_ctx, &drdy);
+  if (drdy)
+  {
+    axis3bit16_t stale;
+    err_code |= lis2mdl_magnetic_raw_get(&dev_ctx, stale.u8bit);
+  }
+  err_code |= lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_SINGLE_TRIGGER);
+  return err_code;
 }
 
 ruuvi_status_t lis2mdl_interface_mode_set(ruuvi_sensor_mode_t* p_mode)
@@ -211,16 +305,25 @@ ruuvi_status_t lis2mdl_interface_mode_set(ruuvi_sensor_mode_t* p_mode)
     err_code |= lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_POWER_DOWN);
     break;
 
+  // Sensor returns to idle after single measurement, data ready is signaled on DRDY if enabled.
   case RUUVI_SENSOR_MODE_SINGLE_ASYNCHRONOUS:
     mode = RUUVI_SENSOR_MODE_SLEEP;
-    err_code |= lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_SINGLE_TRIGGER);
+    err_code |= lis2mdl_single_trigger();
     break;
 
   case RUUVI_SENSOR_MODE_SINGLE_BLOCKING:
+  {
     mode = RUUVI_SENSOR_MODE_SLEEP;
-    err_code |= lis2mdl_operating_mode_set(&dev_ctx, LIS2MDL_SINGLE_TRIGGER);
-    platform_delay_ms(10); //TODO: Verify delay
+    err_code |= lis2mdl_single_trigger();
+    uint8_t drdy = 0;
+    for (uint8_t waited = 0; !drdy && RUUVI_SUCCESS == err_code; waited++)
+    {
+      if (LIS2MDL_INTERFACE_SINGLE_TIMEOUT_MS <= waited) { return RUUVI_ERROR_TIMEOUT; }
+      platform_delay_ms(1);
+      err_code |= lis2mdl_mag_data_ready_get(&dev_ctx, &drdy);
+    }
     break;
+  }
 
   case RUUVI_SENSOR_MODE_CONTINOUS:
     mode = *p_mode;
@@ -262,9 +365,115 @@ ruuvi_status_t lis2mdl_interface_data_get(void* p_data)
   axis3bit16_t data_raw_magnetic;
   memset(data_raw_magnetic.u8bit, 0x00, 3 * sizeof(int16_t));
   err_code |= lis2mdl_magnetic_raw_get(&dev_ctx, data_raw_magnetic.u8bit);
+#if MAGNETISM_CALIBRATION
+  // Hard-iron offset is already removed by sensor, apply soft-iron correction.
+  if (calibration_collecting)
+  {
+    err_code |= magnetism_calibration_sample_add(&calibration, data_raw_magnetic.i16bit[0],
+                                                 data_raw_magnetic.i16bit[1], data_raw_magnetic.i16bit[2]);
+  }
+  int32_t raw[3] = { data_raw_magnetic.i16bit[0], data_raw_magnetic.i16bit[1], data_raw_magnetic.i16bit[2] };
+  int32_t corrected[3];
+  magnetism_calibration_apply(calibration_matrix, raw, corrected);
+  data->x_mg = LIS2MDL_FROM_LSB_TO_mG(corrected[0]);
+  data->y_mg = LIS2MDL_FROM_LSB_TO_mG(corrected[1]);
+  data->z_mg = LIS2MDL_FROM_LSB_TO_mG(corrected[2]);
+#else
   data->x_mg = LIS2MDL_FROM_LSB_TO_mG( data_raw_magnetic.i16bit[0]);
   data->y_mg = LIS2MDL_FROM_LSB_TO_mG( data_raw_magnetic.i16bit[1]);
   data->z_mg = LIS2MDL_FROM_LSB_TO_mG( data_raw_magnetic.i16bit[2]);
+#endif
+
+  return err_code;
+}
+
+#if MAGNETISM_CALIBRATION
+/**
+ * Start collecting calibration samples. Every data_get adds a sample to the fit,
+ * rotate the device through as many orientations as possible before finishing.
+ * Current calibration stays in use until calibration_finish succeeds.
+ */
+ruuvi_status_t lis2mdl_interface_calibration_start(void)
+{
+  magnetism_calibration_reset(&calibration);
+  calibration_collecting = true;
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Fit collected samples, write hard-iron offset to OFFSET registers and take soft-iron matrix into use.
+ * Samples were read with previous offset removed, so new offset is relative to it.
+ */
+ruuvi_status_t lis2mdl_interface_calibration_finish(void)
+{
+  if (!calibration_collecting) { return RUUVI_ERROR_INVALID_STATE; }
+  int16_t offset[3];
+  int32_t matrix[3][3];
+  ruuvi_status_t err_code = magnetism_calibration_solve(&calibration, offset, matrix);
+  if (RUUVI_ERROR_INVALID_STATE == err_code) { return err_code; } // Keep collecting
+  calibration_collecting = false;
+  if (RUUVI_SUCCESS != err_code) { return err_code; }
+
+  for (uint8_t ii = 0; ii < 3; ii++)
+  {
+    int32_t total = calibration_offset[ii] + offset[ii];
+    if (INT16_MAX < total || INT16_MIN > total) { return RUUVI_ERROR_INTERNAL; }
+    offset[ii] = (int16_t)total;
+  }
+  return lis2mdl_interface_calibration_set(offset, matrix);
+}
+
+/**
+ * Restore calibration, e.g. from flash.
+ * offset: hard-iron offset in LSB, 1.5 mG / LSB.
+ * matrix: Q14 soft-iron correction.
+ */
+ruuvi_status_t lis2mdl_interface_calibration_set(const int16_t offset[3], const int32_t matrix[3][3])
+{
+  if (NULL == offset || NULL == matrix) { return RUUVI_ERROR_NULL; }
+  axis3bit16_t registers;
+  memcpy(registers.i16bit, offset, sizeof(registers.i16bit));
+  ruuvi_status_t err_code = lis2mdl_mag_user_offset_set(&dev_ctx, registers.u8bit);
+  if (RUUVI_SUCCESS != err_code) { return err_code; }
+
+  memcpy(calibration_offset, offset, sizeof(calibration_offset));
+  memcpy(calibration_matrix, matrix, sizeof(calibration_matrix));
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t lis2mdl_interface_calibration_get(int16_t offset[3], int32_t matrix[3][3])
+{
+  if (NULL == offset || NULL == matrix) { return RUUVI_ERROR_NULL; }
+  memcpy(offset, calibration_offset, sizeof(calibration_offset));
+  memcpy(matrix, calibration_matrix, sizeof(calibration_matrix));
+  return RUUVI_SUCCESS;
+}
+#endif
+
+/**
+ * Route data-ready signal to INT/DRDY pin of LIS2MDL and register handler for it.
+ * pin: MCU pin connected to INT/DRDY, from boards.h
+ * handler: called in interrupt context on rising edge, i.e. once per sample in
+ *          continuous mode and once per RUUVI_SENSOR_MODE_SINGLE_ASYNCHRONOUS trigger.
+ */
+ruuvi_status_t lis2mdl_interface_drdy_interrupt_use(const bool enable, const uint8_t pin, pin_interrupt_fp handler)
+{
+  if (enable && NULL == handler) { return RUUVI_ERROR_NULL; }
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+
+  if (enable)
+  {
+    if (drdy_enabled) { err_code |= platform_pin_interrupt_disable(drdy_pin); }
+    err_code |= platform_pin_interrupt_enable(pin, RUUVI_GPIO_SLOPE_LOTOHI, RUUVI_GPIO_MODE_INPUT_NOPULL, handler);
+    err_code |= lis2mdl_drdy_on_pin_set(&dev_ctx, PROPERTY_ENABLE);
+    drdy_pin = pin;
+  }
+  else
+  {
+    err_code |= lis2mdl_drdy_on_pin_set(&dev_ctx, PROPERTY_DISABLE);
+    if (drdy_enabled) { err_code |= platform_pin_interrupt_disable(drdy_pin); }
+  }
+  drdy_enabled = enable && (RUUVI_SUCCESS == err_code);
 
   return err_code;
 }
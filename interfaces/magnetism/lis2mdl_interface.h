@@ -6,6 +6,8 @@
 #define LIS2MDL2_INTERFACE_H
 #include "ruuvi_error.h"
 #include "ruuvi_sensor.h"
+#include "pin_interrupt.h"
+#include <stdbool.h>
 
 ruuvi_status_t lis2mdl_interface_init(ruuvi_sensor_t* acceleration_sensor);
 ruuvi_status_t lis2mdl_interface_uninit(ruuvi_sensor_t* acceleration_sensor);
@@ -22,5 +24,14 @@ ruuvi_status_t lis2mdl_interface_mode_get(ruuvi_sensor_mode_t*);
 ruuvi_status_t lis2mdl_interface_interrupt_set(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
 ruuvi_status_t lis2mdl_interface_interrupt_get(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp);
 ruuvi_status_t lis2mdl_interface_data_get(void* data);
+ruuvi_status_t lis2mdl_interface_drdy_interrupt_use(const bool enable, const uint8_t pin, pin_interrupt_fp handler);
+
+/**
+ * Hard- and soft-iron calibration, see magnetism_calibration.h. Requires MAGNETISM_CALIBRATION.
+ */
+ruuvi_status_t lis2mdl_interface_calibration_start(void);
+ruuvi_status_t lis2mdl_interface_calibration_finish(void);
+ruuvi_status_t lis2mdl_interface_calibration_set(const int16_t offset[3], const int32_t matrix[3][3]);
+ruuvi_status_t lis2mdl_interface_calibration_get(int16_t offset[3], int32_t matrix[3][3]);
 
 #endif
\ No newline at end of file
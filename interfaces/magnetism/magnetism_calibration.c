@@ -0,0 +1,241 @@
+/**
+ * Magnetometer hard- and soft-iron calibration.
+ * Fitting runs in double precision as it is done rarely, applying the result is fixed-point.
+ */
+#include "application_config.h"
+#if MAGNETISM_CALIBRATION
+#include "ruuvi_error.h"
+#include "magnetism_calibration.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Samples are scaled down before fitting to keep 4th powers well within double precision.
+#define MAGNETISM_CALIBRATION_INPUT_SCALE 1024.0
+#define MAGNETISM_CALIBRATION_JACOBI_SWEEPS 16
+
+// Index of element (row, col), row <= col, in upper triangle of 9x9 matrix
+static inline uint8_t tri_index(const uint8_t row, const uint8_t col)
+{
+  return (row * MAGNETISM_CALIBRATION_PARAMETERS) - ((row * (row - 1)) / 2) + (col - row);
+}
+
+void magnetism_calibration_reset(magnetism_calibration_t* const cal)
+{
+  if(NULL == cal) { return; }
+  memset(cal, 0, sizeof(magnetism_calibration_t));
+}
+
+ruuvi_status_t magnetism_calibration_sample_add(magnetism_calibration_t* const cal, const int16_t x, const int16_t y, const int16_t z)
+{
+  if(NULL == cal) { return RUUVI_ERROR_NULL; }
+  if(0 < cal->count)
+  {
+    int32_t step = abs(x - cal->last[0]) + abs(y - cal->last[1]) + abs(z - cal->last[2]);
+    if(MAGNETISM_CALIBRATION_MIN_STEP > step) { return RUUVI_SUCCESS; }
+  }
+
+  double u = x / MAGNETISM_CALIBRATION_INPUT_SCALE;
+  double v = y / MAGNETISM_CALIBRATION_INPUT_SCALE;
+  double w = z / MAGNETISM_CALIBRATION_INPUT_SCALE;
+  const double phi[MAGNETISM_CALIBRATION_PARAMETERS] = { u * u, v * v, w * w,
+                                                         2 * u * v, 2 * u * w, 2 * v * w,
+                                                         2 * u, 2 * v, 2 * w };
+  uint8_t index = 0;
+  for(uint8_t row = 0; row < MAGNETISM_CALIBRATION_PARAMETERS; row++)
+  {
+    for(uint8_t col = row; col < MAGNETISM_CALIBRATION_PARAMETERS; col++)
+    {
+      cal->ata[index++] += phi[row] * phi[col];
+    }
+    cal->atb[row] += phi[row];
+  }
+
+  cal->last[0] = x;
+  cal->last[1] = y;
+  cal->last[2] = z;
+  cal->count++;
+  return RUUVI_SUCCESS;
+}
+
+// Solve 9x9 normal equations with Gaussian elimination and partial pivoting.
+static ruuvi_status_t normal_equations_solve(const magnetism_calibration_t* const cal, double theta[MAGNETISM_CALIBRATION_PARAMETERS])
+{
+  const uint8_t n = MAGNETISM_CALIBRATION_PARAMETERS;
+  double m[MAGNETISM_CALIBRATION_PARAMETERS][MAGNETISM_CALIBRATION_PARAMETERS + 1];
+  double scale = 0;
+  for(uint8_t row = 0; row < n; row++)
+  {
+    for(uint8_t col = 0; col < n; col++)
+    {
+      m[row][col] = (row <= col) ? cal->ata[tri_index(row, col)] : cal->ata[tri_index(col, row)];
+    }
+    m[row][n] = cal->atb[row];
+    if(scale < fabs(m[row][row])) { scale = fabs(m[row][row]); }
+  }
+  if(0 == scale) { return RUUVI_ERROR_INTERNAL; }
+
+  for(uint8_t pivot = 0; pivot < n; pivot++)
+  {
+    uint8_t best = pivot;
+    for(uint8_t row = pivot + 1; row < n; row++)
+    {
+      if(fabs(m[row][pivot]) > fabs(m[best][pivot])) { best = row; }
+    }
+    if(fabs(m[best][pivot]) < (scale * 1e-12)) { return RUUVI_ERROR_INTERNAL; }
+    if(best != pivot)
+    {
+      for(uint8_t col = pivot; col <= n; col++)
+      {
+        double tmp = m[pivot][col];
+        m[pivot][col] = m[best][col];
+        m[best][col] = tmp;
+      }
+    }
+    for(uint8_t row = pivot + 1; row < n; row++)
+    {
+      double factor = m[row][pivot] / m[pivot][pivot];
+      for(uint8_t col = pivot; col <= n; col++)
+      {
+        m[row][col] -= factor * m[pivot][col];
+      }
+    }
+  }
+
+  for(int8_t row = n - 1; row >= 0; row--)
+  {
+    double sum = m[row][n];
+    for(uint8_t col = row + 1; col < n; col++)
+    {
+      sum -= m[row][col] * theta[col];
+    }
+    theta[row] = sum / m[row][row];
+  }
+  return RUUVI_SUCCESS;
+}
+
+// Cyclic Jacobi eigendecomposition of symmetric 3x3 matrix. Eigenvalues are left on diagonal of a, eigenvectors in columns of v.
+static void jacobi_3x3(double a[3][3], double v[3][3])
+{
+  for(uint8_t ii = 0; ii < 3; ii++)
+  {
+    for(uint8_t jj = 0; jj < 3; jj++) { v[ii][jj] = (ii == jj) ? 1 : 0; }
+  }
+
+  for(uint8_t sweep = 0; sweep < MAGNETISM_CALIBRATION_JACOBI_SWEEPS; sweep++)
+  {
+    double off = (a[0][1] * a[0][1]) + (a[0][2] * a[0][2]) + (a[1][2] * a[1][2]);
+    double diag = (a[0][0] * a[0][0]) + (a[1][1] * a[1][1]) + (a[2][2] * a[2][2]);
+    if(off <= (diag * 1e-24)) { return; }
+
+    for(uint8_t p = 0; p < 2; p++)
+    {
+      for(uint8_t q = p + 1; q < 3; q++)
+      {
+        if(0 == a[p][q]) { continue; }
+        double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+        double t = 1 / (fabs(theta) + sqrt((theta * theta) + 1));
+        if(0 > theta) { t = -t; }
+        double c = 1 / sqrt((t * t) + 1);
+        double s = t * c;
+        for(uint8_t k = 0; k < 3; k++)
+        {
+          double akp = a[k][p];
+          double akq = a[k][q];
+          a[k][p] = (c * akp) - (s * akq);
+          a[k][q] = (s * akp) + (c * akq);
+        }
+        for(uint8_t k = 0; k < 3; k++)
+        {
+          double apk = a[p][k];
+          double aqk = a[q][k];
+          a[p][k] = (c * apk) - (s * aqk);
+          a[q][k] = (s * apk) + (c * aqk);
+        }
+        for(uint8_t k = 0; k < 3; k++)
+        {
+          double vkp = v[k][p];
+          double vkq = v[k][q];
+          v[k][p] = (c * vkp) - (s * vkq);
+          v[k][q] = (s * vkp) + (c * vkq);
+        }
+      }
+    }
+  }
+}
+
+ruuvi_status_t magnetism_calibration_solve(const magnetism_calibration_t* const cal, int16_t offset[3], int32_t matrix[3][3])
+{
+  if(NULL == cal || NULL == offset || NULL == matrix) { return RUUVI_ERROR_NULL; }
+  if(MAGNETISM_CALIBRATION_MIN_SAMPLES > cal->count) { return RUUVI_ERROR_INVALID_STATE; }
+
+  double theta[MAGNETISM_CALIBRATION_PARAMETERS];
+  ruuvi_status_t err_code = normal_equations_solve(cal, theta);
+  if(RUUVI_SUCCESS != err_code) { return err_code; }
+
+  // Quadratic form M and centre c = -M⁻¹g
+  double m[3][3] = { { theta[0], theta[3], theta[4] },
+                     { theta[3], theta[1], theta[5] },
+                     { theta[4], theta[5], theta[2] } };
+  const double g[3] = { theta[6], theta[7], theta[8] };
+  double cof[3][3];
+  cof[0][0] = (m[1][1] * m[2][2]) - (m[1][2] * m[2][1]);
+  cof[0][1] = (m[0][2] * m[2][1]) - (m[0][1] * m[2][2]);
+  cof[0][2] = (m[0][1] * m[1][2]) - (m[0][2] * m[1][1]);
+  cof[1][0] = (m[1][2] * m[2][0]) - (m[1][0] * m[2][2]);
+  cof[1][1] = (m[0][0] * m[2][2]) - (m[0][2] * m[2][0]);
+  cof[1][2] = (m[0][2] * m[1][0]) - (m[0][0] * m[1][2]);
+  cof[2][0] = (m[1][0] * m[2][1]) - (m[1][1] * m[2][0]);
+  cof[2][1] = (m[0][1] * m[2][0]) - (m[0][0] * m[2][1]);
+  cof[2][2] = (m[0][0] * m[1][1]) - (m[0][1] * m[1][0]);
+  double det = (m[0][0] * cof[0][0]) + (m[0][1] * cof[1][0]) + (m[0][2] * cof[2][0]);
+  if(0 >= det) { return RUUVI_ERROR_INTERNAL; }
+
+  for(uint8_t ii = 0; ii < 3; ii++)
+  {
+    double centre = -((cof[ii][0] * g[0]) + (cof[ii][1] * g[1]) + (cof[ii][2] * g[2])) / det;
+    double lsb = round(centre * MAGNETISM_CALIBRATION_INPUT_SCALE);
+    if(INT16_MAX < lsb || INT16_MIN > lsb) { return RUUVI_ERROR_INTERNAL; }
+    offset[ii] = (int16_t)lsb;
+  }
+
+  // Soft-iron correction is the symmetric square root of M, normalised to unit determinant.
+  double vec[3][3];
+  jacobi_3x3(m, vec);
+  double root[3];
+  double root_det = 1;
+  for(uint8_t ii = 0; ii < 3; ii++)
+  {
+    if(0 >= m[ii][ii]) { return RUUVI_ERROR_INTERNAL; }
+    root[ii] = sqrt(m[ii][ii]);
+    root_det *= root[ii];
+  }
+  double norm = cbrt(root_det);
+
+  for(uint8_t row = 0; row < 3; row++)
+  {
+    for(uint8_t col = 0; col < 3; col++)
+    {
+      double element = 0;
+      for(uint8_t k = 0; k < 3; k++)
+      {
+        element += vec[row][k] * root[k] * vec[col][k];
+      }
+      matrix[row][col] = (int32_t)lround((element / norm) * MAGNETISM_CALIBRATION_ONE);
+    }
+  }
+  return RUUVI_SUCCESS;
+}
+
+void magnetism_calibration_apply(const int32_t matrix[3][3], const int32_t in[3], int32_t out[3])
+{
+  for(uint8_t row = 0; row < 3; row++)
+  {
+    int64_t acc = (int64_t)matrix[row][0] * in[0]
+                + (int64_t)matrix[row][1] * in[1]
+                + (int64_t)matrix[row][2] * in[2];
+    out[row] = (int32_t)((acc + (MAGNETISM_CALIBRATION_ONE / 2)) >> MAGNETISM_CALIBRATION_Q);
+  }
+}
+
+#endif
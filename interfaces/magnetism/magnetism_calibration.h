@@ -0,0 +1,56 @@
+/**
+ * Online hard- and soft-iron calibration of a 3-axis magnetometer.
+ *
+ * Samples are fitted to an ellipsoid
+ *   Ax² + By² + Cz² + 2Dxy + 2Exz + 2Fyz + 2Gx + 2Hy + 2Iz = 1
+ * by accumulating the normal equations of the least-squares problem one sample
+ * at a time, so samples do not need to be stored.
+ *
+ * Result is a hard-iron offset in sensor LSB and a soft-iron correction matrix
+ * in Q14, corrected = matrix * (raw - offset). Matrix has unit determinant,
+ * so field magnitude is preserved on average.
+ */
+#ifndef MAGNETISM_CALIBRATION_H
+#define MAGNETISM_CALIBRATION_H
+#include "ruuvi_error.h"
+#include <stdint.h>
+
+#define MAGNETISM_CALIBRATION_PARAMETERS  9
+#define MAGNETISM_CALIBRATION_SUMS        45 // Upper triangle of 9x9 normal matrix
+#define MAGNETISM_CALIBRATION_MIN_SAMPLES 50
+#define MAGNETISM_CALIBRATION_MIN_STEP    20 // LSB, sum of axis differences to previous accepted sample
+#define MAGNETISM_CALIBRATION_Q           14
+#define MAGNETISM_CALIBRATION_ONE         (1 << MAGNETISM_CALIBRATION_Q)
+
+typedef struct
+{
+  double   ata[MAGNETISM_CALIBRATION_SUMS];       // Σ φφᵀ, upper triangle row by row
+  double   atb[MAGNETISM_CALIBRATION_PARAMETERS]; // Σ φ
+  int16_t  last[3];                               // Previous accepted sample
+  uint32_t count;                                 // Accepted samples
+}magnetism_calibration_t;
+
+/**
+ * Clear accumulated samples.
+ */
+void magnetism_calibration_reset(magnetism_calibration_t* const cal);
+
+/**
+ * Add a raw sample. Samples too close to the previous accepted sample are
+ * ignored so that holding the device still does not bias the fit.
+ */
+ruuvi_status_t magnetism_calibration_sample_add(magnetism_calibration_t* const cal, const int16_t x, const int16_t y, const int16_t z);
+
+/**
+ * Solve the fit.
+ * Returns RUUVI_ERROR_INVALID_STATE if there are fewer than MAGNETISM_CALIBRATION_MIN_SAMPLES samples,
+ * RUUVI_ERROR_INTERNAL if samples do not describe an ellipsoid, i.e. device was not rotated enough.
+ */
+ruuvi_status_t magnetism_calibration_solve(const magnetism_calibration_t* const cal, int16_t offset[3], int32_t matrix[3][3]);
+
+/**
+ * Apply Q14 soft-iron matrix to offset-corrected sample.
+ */
+void magnetism_calibration_apply(const int32_t matrix[3][3], const int32_t in[3], int32_t out[3]);
+
+#endif
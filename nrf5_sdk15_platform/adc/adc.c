@@ -1,11 +1,22 @@
+/**
+ * SAADC driver.
+ * Enabled channels are converted in scan mode. Continuous sampling is triggered by a TIMER through PPI
+ * and results are collected into two alternating blocks, so there is one interrupt per block instead of
+ * one per sample. Hardware oversampling uses burst mode so that it works with several channels.
+ *
+ * Requires SAADC, TIMER instance ADC_TIMER_INSTANCE and PPI drivers enabled in sdk_application_config.h
+ */
 #include "sdk_application_config.h"
 #if NRF5_SDK15_ADC
 
 #include "adc.h"
 #include "ruuvi_error.h"
 #include "ruuvi_sensor.h"
+#include "yield.h"
 
 #include "nrf_drv_saadc.h"
+#include "nrf_drv_timer.h"
+#include "nrf_drv_ppi.h"
 #include "sdk_errors.h"
 
 #define PLATFORM_LOG_MODULE_NAME adc
@@ -18,67 +29,539 @@
 #include "platform_log.h"
 PLATFORM_LOG_MODULE_REGISTER();
 
-#define ADC_REF_VOLTAGE_IN_MILLIVOLTS  600.0  //!< Reference voltage (in milli volts) used by ADC while doing conversion.
-#define ADC_RES_10BIT                  1024.0 //!< Maximum digital value for 10-bit ADC conversion.
-#define ADC_PRE_SCALING_COMPENSATION   6.0    //!< The ADC is configured to use VDD with 1/3 prescaling as input. And hence the result of conversion is to be multiplied by 3 to get the actual value of the battery voltage.
-#define ADC_RESULT_IN_MILLI_VOLTS(ADC_VALUE) \
-    ((((ADC_VALUE) *ADC_REF_VOLTAGE_IN_MILLIVOLTS) / ADC_RES_10BIT) * ADC_PRE_SCALING_COMPENSATION)
+#ifndef ADC_TIMER_INSTANCE
+#define ADC_TIMER_INSTANCE 1
+#endif
 
-static nrf_saadc_value_t     m_buffer_pool[2][1];
-static float voltage = ADC_INVALID;
+#ifndef ADC_BLOCK_SCANS_MAX
+#define ADC_BLOCK_SCANS_MAX 32
+#endif
+
+#define ADC_REF_VOLTAGE_IN_MILLIVOLTS  600.0f //!< Reference voltage (in milli volts) used by ADC while doing conversion.
+#define ADC_PRE_SCALING_COMPENSATION   6.0f   //!< Channels use 1/6 gain, so full scale is 3.6 V.
+#define ADC_VDDHDIV5_COMPENSATION      5.0f   //!< VDDH is divided by 5 before gain stage.
+#define ADC_RESULT_IN_MILLI_VOLTS(ADC_VALUE, RESOLUTION_BITS) \
+    ((((ADC_VALUE) * ADC_REF_VOLTAGE_IN_MILLIVOLTS) / (float)(1UL << (RESOLUTION_BITS))) * ADC_PRE_SCALING_COMPENSATION)
+#define ADC_CONVERSION_TIME_US         12     //!< 10 us acquisition + conversion, per channel and oversample.
+#define ADC_BLOCKING_TIMEOUT_MS        100
+#define ADC_DEFAULT_SCAN_RATE_HZ       10
+
+static const nrf_drv_timer_t m_timer = NRF_DRV_TIMER_INSTANCE(ADC_TIMER_INSTANCE);
+static nrf_ppi_channel_t m_ppi_channel;
+static nrf_saadc_value_t m_buffer_pool[2][ADC_BLOCK_SCANS_MAX * NRF_SAADC_CHANNEL_COUNT];
+
+static bool              initialized = false;
+static bool              saadc_initialized = false;
+static bool              channel_enabled[ADC_CHANNEL_COUNT];
+static adc_channel_t     scan_order[NRF_SAADC_CHANNEL_COUNT];
+static uint8_t           scan_channels = 0;
+static uint16_t          block_size = 0; // Samples, i.e. scans * scan_channels
+static uint16_t          block_scans = 1;
+static adc_block_handler_t block_handler = NULL;
+static uint32_t          scan_rate_hz = ADC_DEFAULT_SCAN_RATE_HZ;
+static uint8_t           resolution_bits = 10;
+static uint16_t          oversample_ratio = 1;
+static ruuvi_sensor_mode_t state_mode = RUUVI_SENSOR_MODE_SLEEP;
+static volatile bool     block_ready = false;
+static volatile float    latest_mv[ADC_CHANNEL_COUNT];
+static volatile bool     sample_pending = false; // Single scan in progress
+static volatile bool     droop_pending = false;  // Scan in progress is a loaded battery sample
+static volatile float    droop_min_mv = ADC_INVALID;
+
+static nrf_saadc_input_t adc_input(const adc_channel_t channel)
+{
+  switch(channel)
+  {
+    case AIN_0:       return NRF_SAADC_INPUT_AIN0;
+    case AIN_1:       return NRF_SAADC_INPUT_AIN1;
+    case AIN_2:       return NRF_SAADC_INPUT_AIN2;
+    case AIN_3:       return NRF_SAADC_INPUT_AIN3;
+    case AIN_4:       return NRF_SAADC_INPUT_AIN4;
+    case AIN_5:       return NRF_SAADC_INPUT_AIN5;
+    case AIN_6:       return NRF_SAADC_INPUT_AIN6;
+    case AIN_7:       return NRF_SAADC_INPUT_AIN7;
+#if defined(SAADC_CH_PSELP_PSELP_VDDHDIV5)
+    case AIN_8:       return NRF_SAADC_INPUT_VDDHDIV5;
+#endif
+    case AIN_BATTERY: return NRF_SAADC_INPUT_VDD;
+    default:          return NRF_SAADC_INPUT_DISABLED;
+  }
+}
+
+static nrf_saadc_resolution_t adc_resolution(void)
+{
+  switch(resolution_bits)
+  {
+    case 8:  return NRF_SAADC_RESOLUTION_8BIT;
+    case 12: return NRF_SAADC_RESOLUTION_12BIT;
+    case 14: return NRF_SAADC_RESOLUTION_14BIT;
+    default: return NRF_SAADC_RESOLUTION_10BIT;
+  }
+}
+
+// Oversample register value is log2 of ratio
+static nrf_saadc_oversample_t adc_oversample(void)
+{
+  uint8_t log2 = 0;
+  while((1U << log2) < oversample_ratio) { log2++; }
+  return (nrf_saadc_oversample_t)log2;
+}
+
+static uint32_t adc_scan_rate_max(void)
+{
+  uint32_t channels = 0;
+  for(uint8_t ii = 0; ii < ADC_CHANNEL_COUNT; ii++)
+  {
+    if(channel_enabled[ii]) { channels++; }
+  }
+  if(0 == channels) { channels = 1; }
+  return 1000000UL / (ADC_CONVERSION_TIME_US * channels * oversample_ratio);
+}
+
+static float adc_to_mv(const adc_channel_t channel, const float raw)
+{
+  float mv = ADC_RESULT_IN_MILLI_VOLTS(raw, resolution_bits);
+#if defined(SAADC_CH_PSELP_PSELP_VDDHDIV5)
+  if(AIN_8 == channel) { mv *= ADC_VDDHDIV5_COMPENSATION; }
+#endif
+  return mv;
+}
 
 static void saadc_callback(nrf_drv_saadc_evt_t const * p_event)
 {
   if (p_event->type == NRF_DRV_SAADC_EVT_DONE)
   {
-    ret_code_t err_code;
+    const nrf_saadc_value_t* samples = p_event->data.done.p_buffer;
+    const uint16_t size = p_event->data.done.size;
+    const size_t scans = size / scan_channels;
+
+    // Latest value is average of the block
+    for(uint8_t ii = 0; ii < scan_channels; ii++)
+    {
+      int32_t sum = 0;
+      for(size_t scan = 0; scan < scans; scan++)
+      {
+        sum += samples[(scan * scan_channels) + ii];
+      }
+      float mv = adc_to_mv(scan_order[ii], (float)sum / scans);
+      // Loaded battery sample is kept separate from idle voltage
+      if(droop_pending && AIN_BATTERY == scan_order[ii])
+      {
+        if(ADC_INVALID == droop_min_mv || mv < droop_min_mv) { droop_min_mv = mv; }
+      }
+      else { latest_mv[scan_order[ii]] = mv; }
+    }
+    droop_pending = false;
+    sample_pending = false;
 
-    // Setup second buffer
-    err_code = nrf_drv_saadc_buffer_convert(p_event->data.done.p_buffer, 1);
+    if(RUUVI_SENSOR_MODE_CONTINOUS == state_mode && NULL != block_handler)
+    {
+      block_handler(samples, scans, scan_order, scan_channels);
+    }
+
+    // Queue block again, driver alternates between the two buffers
+    ret_code_t err_code = nrf_drv_saadc_buffer_convert(p_event->data.done.p_buffer, size);
     APP_ERROR_CHECK(err_code);
 
-    PLATFORM_LOG_INFO("%d", ADC_RESULT_IN_MILLI_VOLTS(p_event->data.done.p_buffer[0]));
-    voltage = ADC_RESULT_IN_MILLI_VOLTS(p_event->data.done.p_buffer[0]);
+    block_ready = true;
+    PLATFORM_LOG_DEBUG("Block of %d scans", scans);
   }
 }
 
-// Support only battery reads for now
-ruuvi_status_t adc_init(ruuvi_sensor_t* adc)
+// Compare event triggers SAADC through PPI, timer interrupt is never enabled
+static void adc_timer_handler(nrf_timer_event_t event_type, void* p_context)
+{
+}
+
+static void adc_timer_stop(void)
+{
+  nrf_drv_ppi_channel_disable(m_ppi_channel);
+  nrf_drv_timer_disable(&m_timer);
+}
+
+static ret_code_t adc_timer_start(void)
+{
+  uint32_t ticks = nrf_drv_timer_us_to_ticks(&m_timer, 1000000UL / scan_rate_hz);
+  nrf_drv_timer_clear(&m_timer);
+  nrf_drv_timer_extended_compare(&m_timer, NRF_TIMER_CC_CHANNEL0, ticks, NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK, false);
+  nrf_drv_timer_enable(&m_timer);
+  return nrf_drv_ppi_channel_enable(m_ppi_channel);
+}
+
+/**
+ * Apply settings: SAADC is reinitialized with enabled channels and buffers are queued again.
+ * Low-power mode of the driver is used outside continuous mode, it is not compatible with PPI-triggered sampling.
+ */
+static ruuvi_status_t adc_configure(void)
 {
   ret_code_t err_code = NRF_SUCCESS;
-  nrf_saadc_channel_config_t channel_config =
-    NRF_DRV_SAADC_DEFAULT_CHANNEL_CONFIG_SE(NRF_SAADC_INPUT_VDD);
+  bool continuous = (RUUVI_SENSOR_MODE_CONTINOUS == state_mode);
 
-  //Init SAADC with default configuration
-  err_code |= nrf_drv_saadc_init(NULL, saadc_callback);
-  APP_ERROR_CHECK(err_code);
+  adc_timer_stop();
+  if(saadc_initialized) { nrf_drv_saadc_uninit(); }
+  // Scan in progress, if any, is aborted
+  sample_pending = false;
+  droop_pending = false;
 
-  //Use only channel 0
-  err_code |= nrf_drv_saadc_channel_init(0, &channel_config);
-  APP_ERROR_CHECK(err_code);
+  nrf_drv_saadc_config_t config = NRF_DRV_SAADC_DEFAULT_CONFIG;
+  config.resolution     = adc_resolution();
+  config.oversample     = adc_oversample();
+  config.low_power_mode = !continuous;
+  err_code |= nrf_drv_saadc_init(&config, saadc_callback);
+  saadc_initialized = (NRF_SUCCESS == err_code);
 
-  // Prepare first buffer
-  err_code |= nrf_drv_saadc_buffer_convert(m_buffer_pool[0], 1);
-  APP_ERROR_CHECK(err_code);
+  scan_channels = 0;
+  for(uint8_t channel = 0; channel < ADC_CHANNEL_COUNT && NRF_SUCCESS == err_code; channel++)
+  {
+    if(!channel_enabled[channel]) { continue; }
+    nrf_saadc_channel_config_t channel_config =
+      NRF_DRV_SAADC_DEFAULT_CHANNEL_CONFIG_SE(adc_input(channel));
+    channel_config.burst = (1 < oversample_ratio) ? NRF_SAADC_BURST_ENABLED : NRF_SAADC_BURST_DISABLED;
+    err_code |= nrf_drv_saadc_channel_init(scan_channels, &channel_config);
+    scan_order[scan_channels++] = (adc_channel_t)channel;
+  }
 
-  // Prepare second buffer
-  err_code |= nrf_drv_saadc_buffer_convert(m_buffer_pool[1], 1);
-  APP_ERROR_CHECK(err_code);
+  block_size = scan_channels * (continuous ? block_scans : 1);
+  if(0 < block_size && NRF_SUCCESS == err_code)
+  {
+    // Prepare first buffer
+    err_code |= nrf_drv_saadc_buffer_convert(m_buffer_pool[0], block_size);
+    // Prepare second buffer
+    err_code |= nrf_drv_saadc_buffer_convert(m_buffer_pool[1], block_size);
+    if(continuous) { err_code |= adc_timer_start(); }
+  }
 
   return platform_to_ruuvi_error(&err_code);
 }
 
-// Start sampling given channel
+// Battery channel is enabled by default. Sensor interface is set up if adc is not NULL.
+ruuvi_status_t adc_init(ruuvi_sensor_t* adc)
+{
+  ret_code_t err_code = NRF_SUCCESS;
+  if(initialized) { return RUUVI_ERROR_INVALID_STATE; }
+
+  nrf_drv_timer_config_t timer_config = NRF_DRV_TIMER_DEFAULT_CONFIG;
+  timer_config.frequency = NRF_TIMER_FREQ_1MHz;
+  timer_config.bit_width = NRF_TIMER_BIT_WIDTH_32;
+  err_code |= nrf_drv_timer_init(&m_timer, &timer_config, adc_timer_handler);
+
+  // PPI may be initialized by another module already
+  ret_code_t ppi_status = nrf_drv_ppi_init();
+  if(NRF_ERROR_MODULE_ALREADY_INITIALIZED != ppi_status) { err_code |= ppi_status; }
+  err_code |= nrf_drv_ppi_channel_alloc(&m_ppi_channel);
+  err_code |= nrf_drv_ppi_channel_assign(m_ppi_channel,
+                                         nrf_drv_timer_event_address_get(&m_timer, NRF_TIMER_EVENT_COMPARE0),
+                                         nrf_drv_saadc_sample_task_get());
+  ruuvi_status_t status = platform_to_ruuvi_error(&err_code);
+  if(RUUVI_SUCCESS != status) { return status; }
+
+  for(uint8_t ii = 0; ii < ADC_CHANNEL_COUNT; ii++)
+  {
+    channel_enabled[ii] = false;
+    latest_mv[ii] = ADC_INVALID;
+  }
+  channel_enabled[AIN_BATTERY] = true;
+  state_mode = RUUVI_SENSOR_MODE_SLEEP;
+  initialized = true;
+  status |= adc_configure();
+
+  if(RUUVI_SUCCESS == status && NULL != adc)
+  {
+    adc->init           = adc_init;
+    adc->uninit         = adc_uninit;
+    adc->samplerate_set = adc_samplerate_set;
+    adc->samplerate_get = adc_samplerate_get;
+    adc->resolution_set = adc_resolution_set;
+    adc->resolution_get = adc_resolution_get;
+    adc->scale_set      = adc_scale_set;
+    adc->scale_get      = adc_scale_get;
+    adc->dsp_set        = adc_dsp_set;
+    adc->dsp_get        = adc_dsp_get;
+    adc->mode_set       = adc_mode_set;
+    adc->mode_get       = adc_mode_get;
+    adc->interrupt_set  = adc_interrupt_set;
+    adc->interrupt_get  = adc_interrupt_get;
+    adc->data_get       = adc_data_get;
+  }
+  return status;
+}
+
+ruuvi_status_t adc_uninit(ruuvi_sensor_t* adc)
+{
+  if(!initialized) { return RUUVI_SUCCESS; }
+  adc_timer_stop();
+  if(saadc_initialized) { nrf_drv_saadc_uninit(); }
+  saadc_initialized = false;
+  nrf_drv_ppi_channel_disable(m_ppi_channel);
+  nrf_drv_ppi_channel_free(m_ppi_channel);
+  nrf_drv_timer_uninit(&m_timer);
+  state_mode = RUUVI_SENSOR_MODE_SLEEP;
+  initialized = false;
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t adc_channel_use(const adc_channel_t channel, const bool enable)
+{
+  if(ADC_CHANNEL_COUNT <= channel) { return RUUVI_ERROR_INVALID_PARAM; }
+  if(!initialized) { return RUUVI_ERROR_INVALID_STATE; }
+  if(NRF_SAADC_INPUT_DISABLED == adc_input(channel)) { return RUUVI_ERROR_NOT_SUPPORTED; }
+  if(enable == channel_enabled[channel]) { return RUUVI_SUCCESS; }
+  if(enable && NRF_SAADC_CHANNEL_COUNT <= scan_channels) { return RUUVI_ERROR_NO_MEM; }
+
+  channel_enabled[channel] = enable;
+  latest_mv[channel] = ADC_INVALID;
+  // Scan got slower, keep timer within what SAADC can do
+  if(scan_rate_hz > adc_scan_rate_max()) { scan_rate_hz = adc_scan_rate_max(); }
+  return adc_configure();
+}
+
+ruuvi_status_t adc_scan_rate_set(const uint32_t rate_hz)
+{
+  if(0 == rate_hz) { return RUUVI_ERROR_INVALID_PARAM; }
+  if(adc_scan_rate_max() < rate_hz) { return RUUVI_ERROR_NOT_SUPPORTED; }
+  scan_rate_hz = rate_hz;
+  if(RUUVI_SENSOR_MODE_CONTINOUS == state_mode) { return adc_configure(); }
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t adc_scan_rate_get(uint32_t* const rate_hz)
+{
+  if(NULL == rate_hz) { return RUUVI_ERROR_NULL; }
+  *rate_hz = scan_rate_hz;
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t adc_block_handler_set(const adc_block_handler_t handler, const uint16_t scans)
+{
+  if(0 == scans || ADC_BLOCK_SCANS_MAX < scans) { return RUUVI_ERROR_INVALID_PARAM; }
+  block_handler = handler;
+  block_scans = scans;
+  if(RUUVI_SENSOR_MODE_CONTINOUS == state_mode) { return adc_configure(); }
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Samplerate is scan rate of continuous mode. Rates above 250 Hz are set with adc_scan_rate_set.
+ */
+ruuvi_status_t adc_samplerate_set(ruuvi_sensor_samplerate_t* samplerate)
+{
+  if(NULL == samplerate) { return RUUVI_ERROR_NULL; }
+  if(RUUVI_SENSOR_SAMPLERATE_NO_CHANGE == *samplerate) { return RUUVI_SUCCESS; }
+  if(RUUVI_SENSOR_SAMPLERATE_SINGLE == *samplerate)    { return RUUVI_ERROR_NOT_SUPPORTED; }
+  if(RUUVI_SENSOR_SAMPLERATE_STOP == *samplerate)
+  {
+    ruuvi_sensor_mode_t mode = RUUVI_SENSOR_MODE_SLEEP;
+    return adc_mode_set(&mode);
+  }
+  if(RUUVI_SENSOR_SAMPLERATE_MIN == *samplerate) { return adc_scan_rate_set(1); }
+  if(RUUVI_SENSOR_SAMPLERATE_MAX == *samplerate) { return adc_scan_rate_set(adc_scan_rate_max()); }
+  return adc_scan_rate_set(*samplerate);
+}
+
+ruuvi_status_t adc_samplerate_get(ruuvi_sensor_samplerate_t* samplerate)
+{
+  if(NULL == samplerate) { return RUUVI_ERROR_NULL; }
+  if(RUUVI_SENSOR_SAMPLERATE_SINGLE <= scan_rate_hz) { *samplerate = RUUVI_SENSOR_SAMPLERATE_NOT_SUPPORTED; }
+  else { *samplerate = scan_rate_hz; }
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * Resolution is rounded up to 8, 10, 12 or 14 bits. 14 bits is meaningful only with oversampling.
+ */
+ruuvi_status_t adc_resolution_set(ruuvi_sensor_resolution_t* resolution)
+{
+  if(NULL == resolution) { return RUUVI_ERROR_NULL; }
+  if(RUUVI_SENSOR_RESOLUTION_NO_CHANGE == *resolution) { return RUUVI_SUCCESS; }
+
+  if(RUUVI_SENSOR_RESOLUTION_MIN == *resolution)      { resolution_bits = 8;  }
+  else if(RUUVI_SENSOR_RESOLUTION_MAX == *resolution) { resolution_bits = 14; }
+  else if(8  >= *resolution) { resolution_bits = 8;  }
+  else if(10 >= *resolution) { resolution_bits = 10; }
+  else if(12 >= *resolution) { resolution_bits = 12; }
+  else if(14 >= *resolution) { resolution_bits = 14; }
+  else { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  return adc_configure();
+}
+
+ruuvi_status_t adc_resolution_get(ruuvi_sensor_resolution_t* resolution)
+{
+  if(NULL == resolution) { return RUUVI_ERROR_NULL; }
+  *resolution = resolution_bits;
+  return RUUVI_SUCCESS;
+}
+
+// All channels have fixed 3.6 V full scale
+ruuvi_status_t adc_scale_set(ruuvi_sensor_scale_t* scale)
+{
+  if(NULL == scale) { return RUUVI_ERROR_NULL; }
+  if(RUUVI_SENSOR_SCALE_NO_CHANGE == *scale) { return RUUVI_SUCCESS; }
+  return RUUVI_ERROR_NOT_SUPPORTED;
+}
+
+ruuvi_status_t adc_scale_get(ruuvi_sensor_scale_t* scale)
+{
+  if(NULL == scale) { return RUUVI_ERROR_NULL; }
+  *scale = 4;
+  return RUUVI_SUCCESS;
+}
+
+/**
+ * RUUVI_SENSOR_DSP_OS: hardware oversampling, parameter is ratio 2, 4, ... 256.
+ * RUUVI_SENSOR_DSP_LAST: no oversampling.
+ */
+ruuvi_status_t adc_dsp_set(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
+{
+  if(NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
+  uint16_t ratio = 1;
+
+  if(RUUVI_SENSOR_DSP_OS == *dsp)
+  {
+    // Parameter 0 stands for 256, as it does not fit in uint8_t
+    ratio = (0 == *parameter) ? 256 : *parameter;
+    if(1 >= ratio || (ratio & (ratio - 1))) { return RUUVI_ERROR_NOT_SUPPORTED; }
+  }
+  else if(RUUVI_SENSOR_DSP_LAST != *dsp) { return RUUVI_ERROR_NOT_SUPPORTED; }
+
+  oversample_ratio = ratio;
+  if(scan_rate_hz > adc_scan_rate_max()) { scan_rate_hz = adc_scan_rate_max(); }
+  return adc_configure();
+}
+
+ruuvi_status_t adc_dsp_get(ruuvi_sensor_dsp_function_t* dsp, uint8_t* parameter)
+{
+  if(NULL == dsp || NULL == parameter) { return RUUVI_ERROR_NULL; }
+  *dsp = (1 < oversample_ratio) ? RUUVI_SENSOR_DSP_OS : RUUVI_SENSOR_DSP_LAST;
+  *parameter = (uint8_t)oversample_ratio;
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t adc_mode_set(ruuvi_sensor_mode_t* mode)
+{
+  if(NULL == mode) { return RUUVI_ERROR_NULL; }
+  if(!initialized) { return RUUVI_ERROR_INVALID_STATE; }
+  ruuvi_status_t err_code = RUUVI_SUCCESS;
+  bool was_continuous = (RUUVI_SENSOR_MODE_CONTINOUS == state_mode);
+
+  switch(*mode)
+  {
+    case RUUVI_SENSOR_MODE_SLEEP:
+      state_mode = RUUVI_SENSOR_MODE_SLEEP;
+      if(was_continuous) { err_code |= adc_configure(); }
+      break;
+
+    case RUUVI_SENSOR_MODE_SINGLE_ASYNCHRONOUS:
+    case RUUVI_SENSOR_MODE_SINGLE_BLOCKING:
+    {
+      if(0 == scan_channels) { return RUUVI_ERROR_INVALID_STATE; }
+      // Loaded battery sample in progress would be taken as this one
+      if(droop_pending) { return RUUVI_ERROR_BUSY; }
+      state_mode = RUUVI_SENSOR_MODE_SLEEP;
+      if(was_continuous) { err_code |= adc_configure(); }
+      block_ready = false;
+      sample_pending = true;
+      ret_code_t nrf_code = nrf_drv_saadc_sample();
+      if(NRF_SUCCESS != nrf_code) { sample_pending = false; }
+      err_code |= platform_to_ruuvi_error(&nrf_code);
+      if(RUUVI_SENSOR_MODE_SINGLE_ASYNCHRONOUS == *mode) { break; }
+      for(uint32_t waited = 0; !block_ready && RUUVI_SUCCESS == err_code; waited++)
+      {
+        if(ADC_BLOCKING_TIMEOUT_MS <= waited) { return RUUVI_ERROR_TIMEOUT; }
+        platform_delay_ms(1);
+      }
+      break;
+    }
+
+    case RUUVI_SENSOR_MODE_CONTINOUS:
+      if(0 == scan_channels) { return RUUVI_ERROR_INVALID_STATE; }
+      state_mode = RUUVI_SENSOR_MODE_CONTINOUS;
+      if(!was_continuous) { err_code |= adc_configure(); }
+      break;
+
+    default:
+      return RUUVI_ERROR_INVALID_PARAM;
+  }
+  return err_code;
+}
+
+ruuvi_status_t adc_mode_get(ruuvi_sensor_mode_t* mode)
+{
+  if(NULL == mode) { return RUUVI_ERROR_NULL; }
+  *mode = state_mode;
+  return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t adc_interrupt_set(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp)
+{
+  return RUUVI_ERROR_NOT_IMPLEMENTED;
+}
+
+ruuvi_status_t adc_interrupt_get(uint8_t number, float* threshold, ruuvi_sensor_trigger_t* trigger, ruuvi_sensor_dsp_function_t* dsp)
+{
+  return RUUVI_ERROR_NOT_IMPLEMENTED;
+}
+
+ruuvi_status_t adc_data_get(void* data)
+{
+  if(NULL == data) { return RUUVI_ERROR_NULL; }
+  ruuvi_adc_data_t* p_data = (ruuvi_adc_data_t*)data;
+  for(uint8_t ii = 0; ii < ADC_CHANNEL_COUNT; ii++)
+  {
+    p_data->channel_mv[ii] = latest_mv[ii];
+  }
+  return RUUVI_SUCCESS;
+}
+
+// Start a single scan of all enabled channels
 ruuvi_status_t adc_sample_asynchronous(adc_channel_t channel)
 {
+  if(ADC_CHANNEL_COUNT <= channel) { return RUUVI_ERROR_INVALID_PARAM; }
+  if(RUUVI_SENSOR_MODE_CONTINOUS == state_mode) { return RUUVI_ERROR_INVALID_STATE; }
+  if(droop_pending) { return RUUVI_ERROR_BUSY; }
+  ruuvi_status_t status = adc_channel_use(channel, true);
+  if(RUUVI_SUCCESS != status) { return status; }
+
+  sample_pending = true;
   ret_code_t err_code = nrf_drv_saadc_sample();
+  if(NRF_SUCCESS != err_code) { sample_pending = false; }
   return platform_to_ruuvi_error(&err_code);
 }
 
-// read latest data from given channel - TODO return battery voltage for now
+/**
+ * Sample battery now, from a wakeup which happens anyway: e.g. radio notification right after TX, while supply
+ * capacitor is still discharged. Neither timer nor extra interrupts are used, SAADC completes within the same wakeup.
+ * Result is kept as a minimum until adc_battery_loaded_reset, regular samples give idle voltage.
+ * Not available in continuous mode. Returns RUUVI_ERROR_BUSY if a scan is in progress.
+ */
+ruuvi_status_t adc_battery_loaded_sample(void)
+{
+  if(!initialized || !channel_enabled[AIN_BATTERY]) { return RUUVI_ERROR_INVALID_STATE; }
+  if(RUUVI_SENSOR_MODE_CONTINOUS == state_mode)     { return RUUVI_ERROR_INVALID_STATE; }
+  if(sample_pending || droop_pending)               { return RUUVI_ERROR_BUSY; }
+
+  droop_pending = true;
+  ret_code_t err_code = nrf_drv_saadc_sample();
+  if(NRF_SUCCESS != err_code) { droop_pending = false; }
+  return platform_to_ruuvi_error(&err_code);
+}
+
+// Minimum battery voltage under load since last reset, in millivolts. ADC_INVALID if there is no sample yet.
+float adc_battery_loaded_get(void)
+{
+  return droop_min_mv;
+}
+
+void adc_battery_loaded_reset(void)
+{
+  droop_min_mv = ADC_INVALID;
+}
+
+// read latest data from given channel, in millivolts
 float adc_get_data(adc_channel_t channel)
 {
-  return voltage;
+  if(ADC_CHANNEL_COUNT <= channel) { return ADC_INVALID; }
+  return latest_mv[channel];
 }
 
-#endif
\ No newline at end of file
+#endif
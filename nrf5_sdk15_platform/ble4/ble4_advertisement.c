@@ -3,8 +3,11 @@
 
 #include "ble4_advertisement.h"
 #include "ruuvi_error.h"
-#include "ringbuffer.h"
+#include "communication_queue.h"
 #include "communication.h"
+#if NRF5_SDK15_ADC
+#include "adc.h"
+#endif
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -34,10 +37,56 @@ PLATFORM_LOG_MODULE_REGISTER();
 typedef struct {
     uint8_t advertisement[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
     uint16_t adv_len;
+    uint8_t data_format; // First byte of payload, messages of same format replace each other in rotation
+    uint8_t repeat;      // Advertising events after first one, UINT8_MAX for forever
+    uint8_t weight;      // Relative share of advertising events
+} ble_advdata_storage_t;
+
+/** Rotation entry, one per data format. Owned by queue consumer **/
+typedef struct {
+    ble_advdata_storage_t data;
+    bool    in_use;
+    bool    fresh;      // Data has changed since entry was last on air
+    int16_t credit;     // Smooth weighted round robin
+} ble_advdata_rotation_t;
+
+typedef struct {
+    uint8_t data_format;
+    uint8_t weight;     // 0: unused
+} ble_advdata_weight_t;
+
+/** Advertisement set given to SoftDevice, one is on air while the other is prepared **/
+typedef struct {
+    ble_advdata_storage_t data;
     uint8_t response[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
     uint16_t rsp_len;
-    bool repeat;   // If true, this element will be put back to FIFO after send
-} ble_advdata_storage_t;
+    uint8_t response_generation; // Scan response is stale if this differs from m_scan_response_generation
+} ble_advdata_set_t;
+
+// Flags AD structure and header of manufacturer specific AD structure, payload follows
+#define ADV_FLAGS_LENGTH         3
+#define ADV_MANUF_HEADER_LENGTH  4
+#define ADV_TEMPLATE_LENGTH      (ADV_FLAGS_LENGTH + ADV_MANUF_HEADER_LENGTH)
+#define ADV_MANUF_LENGTH_OFFSET  ADV_FLAGS_LENGTH
+#define ADV_PAYLOAD_MAX_LENGTH   (BLE_GAP_ADV_SET_DATA_SIZE_MAX - ADV_TEMPLATE_LENGTH)
+// Scan response keeps room for at least two characters of name next to manufacturer data
+#define ADV_RSP_NAME_MIN_LENGTH     4
+#define ADV_RSP_PAYLOAD_MAX_LENGTH  (BLE_GAP_ADV_SET_DATA_SIZE_MAX - ADV_MANUF_HEADER_LENGTH - ADV_RSP_NAME_MIN_LENGTH)
+
+/** Detailed payload of scan response, produced on scan request **/
+typedef struct {
+    uint8_t payload[ADV_RSP_PAYLOAD_MAX_LENGTH];
+    uint8_t length;     // 0: name only
+} ble_advdata_detail_t;
+
+/** Profile converted to SoftDevice values **/
+typedef struct {
+    ble4_advertisement_profile_t profile;
+    uint32_t interval;  // 0.625 ms units
+    int8_t   tx_power;
+    uint8_t  type;      // BLE_GAP_ADV_TYPE_*
+    bool     valid;
+} ble4_advertisement_prepared_t;
 
 typedef struct {
     int16_t advertisement_interval_ms;
@@ -53,16 +102,47 @@ static ble_uuid_t m_adv_uuids[] =                                          /**<
 
 // TODO: Define somewhere else. SDK_APPLICATION_CONFIG?
 #define MAXIMUM_ADVERTISEMENTS 5
+#define RADIO_NOTIFICATION_DISTANCE     NRF_RADIO_NOTIFICATION_DISTANCE_800US
 static ble_gap_adv_params_t   m_adv_params;                                  /**< Parameters to be passed to the stack when starting advertising. */
 static uint8_t                m_adv_handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET; /**< Advertising handle used to identify an advertising set. */
 static bool                   m_advertisement_is_init = false;               /**< Flag for initialization **/
-static bool                   m_advertising = false;                         /**< Flag for advertising in process **/
+static volatile bool          m_advertising = false;                         /**< Flag for advertising in process **/
+static volatile bool          m_adv_params_pending = false;                  /**< Parameters wait for next safe point **/
+static volatile bool          m_adv_resume = false;                          /**< Restart failed in radio notification **/
+static volatile bool          m_connected = false;                           /**< Radio events belong to connection **/
+static volatile ret_code_t    m_adv_error = NRF_SUCCESS;                     /**< Latched in radio notification **/
 static bool                   m_scan_response_uuid = false;                  /**< Advertise NUS in scan response **/
 static ruuvi_communication_fp m_after_tx_cb = NULL;                          /**< Called after data tx **/
+static ruuvi_communication_fp m_before_tx_cb = NULL;                         /**< Called ahead of advertising event **/
+static ruuvi_communication_xfer_fp m_on_scan_request_cb = NULL;              /**< Produces detailed scan response **/
+#if NRF5_SDK15_ADC
+static bool                   m_battery_loaded_sample = false;               /**< Sample battery after TX **/
+#endif
 
 static ble4_advertisement_state_t m_adv_state;
-static uint8_t      advertisements[sizeof(ble_advdata_storage_t) * MAXIMUM_ADVERTISEMENTS];
-static ringbuffer_t               advertisement_buffer;
+static ble4_advertisement_prepared_t m_profiles[BLE4_ADVERTISEMENT_PROFILES];
+static ble_advdata_storage_t      advertisements[MAXIMUM_ADVERTISEMENTS];
+static communication_queue_t      advertisement_buffer;
+
+// Encoded once, re-encoded only after name, NUS UUID or manufacturer ID changes.
+// Each advertisement set keeps its own scan response, it is encoded again only if generation has changed.
+static uint8_t          m_adv_template[ADV_TEMPLATE_LENGTH];
+static bool             m_adv_template_valid = false;
+static volatile uint8_t m_scan_response_generation = 1;
+
+// Written by scan request handler into the buffer which is not current, read by scan_response_encode
+static ble_advdata_detail_t m_scan_detail[2];
+static volatile uint8_t     m_scan_detail_current = 0;
+
+// Ping-pong sets, only the one SoftDevice is not using is written
+static ble_advdata_set_t m_adv_set[2];
+static uint8_t           m_adv_set_active = 0;
+
+// Formats interleave on air in proportion to their weights, see rotation_pick
+static ble_advdata_rotation_t  m_rotation[MAXIMUM_ADVERTISEMENTS];
+static ble_advdata_rotation_t* m_rotation_on_air = NULL;
+static volatile bool           m_rotation_flush = false;
+static ble_advdata_weight_t    m_weights[MAXIMUM_ADVERTISEMENTS]; // Written by producer only
 
 static ble_gap_adv_data_t m_adv_data =
 {
@@ -79,101 +159,507 @@ static ble_gap_adv_data_t m_adv_data =
     }
 };
 
-// Update BLE settings, takes effect immidiately
-static ruuvi_status_t update_settings(void)
+static ret_code_t advertisement_update(void);
+
+/**
+ * Report error latched in radio notification to thread context. If restart with new parameters
+ * failed there, advertising has stopped and it is started again here.
+ */
+static ret_code_t advertisement_recover(void)
 {
-    if (!m_advertisement_is_init) { return RUUVI_ERROR_INVALID_STATE; }
-    ret_code_t err_code = NRF_SUCCESS;
-    // Stop advertising for setting update
-    if (m_advertising)
-    {
-        err_code |= sd_ble_gap_adv_stop(m_adv_handle);
-    }
-    err_code |= sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data, &m_adv_params);
-    if (m_advertising)
+    ret_code_t err_code = m_adv_error;
+    m_adv_error = NRF_SUCCESS;
+    // Advertising is started again by ble4_advertisement_restart after connection
+    if (m_adv_resume && !m_connected)
     {
-        err_code = sd_ble_gap_adv_start(m_adv_handle, BLE_CONN_CFG_TAG_DEFAULT);
+        // Second parameter is a handle identifying advertising set, support only one
+        ret_code_t start_code = sd_ble_gap_adv_start(m_adv_handle, BLE_CONN_CFG_TAG_DEFAULT);
+        if (NRF_SUCCESS == start_code)
+        {
+            m_adv_resume = false;
+            m_advertising = true;
+        }
+        else { err_code = start_code; }
     }
+    return err_code;
+}
+
+// Update BLE settings, takes effect immediately if not advertising, otherwise after next advertising event
+static ruuvi_status_t update_settings(void)
+{
+    if (!m_advertisement_is_init) { return RUUVI_ERROR_INVALID_STATE; }
+    ret_code_t err_code = advertisement_recover();
+    m_adv_params_pending = true;
+    if (!m_advertising) { err_code |= advertisement_update(); }
     return platform_to_ruuvi_error(&err_code);
 }
-// Functions for setting up advertisement constants
-// Each change takes effect immediately
-ruuvi_status_t ble4_advertisement_set_interval(int16_t ms)
+// Interval in 0.625 ms units
+static ruuvi_status_t interval_convert(const int16_t ms, uint32_t* const interval)
 {
     if (100 > ms || 10001 < ms) { return RUUVI_ERROR_INVALID_PARAM; }
-    m_adv_state.advertisement_interval_ms = ms;
-    m_adv_params.interval = MSEC_TO_UNITS(m_adv_state.advertisement_interval_ms, UNIT_0_625_MS);
-    return update_settings();
+    *interval = MSEC_TO_UNITS(ms, UNIT_0_625_MS);
+    return RUUVI_SUCCESS;
 }
 
 // TODO: HW-specific TX powers
 // Supported tx_power values: -40dBm, -20dBm, -16dBm, -12dBm, -8dBm, -4dBm, 0dBm and +4dBm.
-ruuvi_status_t ble4_advertisement_set_power(int8_t dbm)
+static ruuvi_status_t power_convert(const int8_t dbm, int8_t* const tx_power)
 {
-    int8_t  tx_power = 0;
-    ret_code_t err_code = NRF_SUCCESS;
-    if (dbm <= -40) { tx_power = -40; }
-    else if (dbm <= -20) { tx_power = -20; }
-    else if (dbm <= -16) { tx_power = -16; }
-    else if (dbm <= -12) { tx_power = -12; }
-    else if (dbm <= -8 ) { tx_power = -8; }
-    else if (dbm <= -4 ) { tx_power = -4; }
-    else if (dbm <= 0  ) { tx_power = 0; }
-    else if (dbm <= 4  ) { tx_power = 4; }
+    if (dbm <= -40) { *tx_power = -40; }
+    else if (dbm <= -20) { *tx_power = -20; }
+    else if (dbm <= -16) { *tx_power = -16; }
+    else if (dbm <= -12) { *tx_power = -12; }
+    else if (dbm <= -8 ) { *tx_power = -8; }
+    else if (dbm <= -4 ) { *tx_power = -4; }
+    else if (dbm <= 0  ) { *tx_power = 0; }
+    else if (dbm <= 4  ) { *tx_power = 4; }
     else { return RUUVI_ERROR_INVALID_PARAM; }
-    err_code = sd_ble_gap_tx_power_set (BLE_GAP_TX_POWER_ROLE_ADV,
-                                        m_adv_handle,
-                                        tx_power
-                                       );
-    return platform_to_ruuvi_error(&err_code);
+    return RUUVI_SUCCESS;
 }
 
-ruuvi_status_t ble4_advertisement_set_type(ble4_advertisement_type_t advertisement_type)
+static ruuvi_status_t type_convert(const ble4_advertisement_type_t advertisement_type, uint8_t* const type)
 {
-    ret_code_t err_code = NRF_SUCCESS;
     switch (advertisement_type)
     {
     case NON_CONNECTABLE_NON_SCANNABLE:
-        m_adv_params.properties.type = BLE_GAP_ADV_TYPE_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
-        m_adv_params.p_peer_addr     = NULL;    // Undirected advertisement.
+        *type = BLE_GAP_ADV_TYPE_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
         break;
 
     case NON_CONNECTABLE_SCANNABLE:
-        m_adv_params.properties.type = BLE_GAP_ADV_TYPE_NONCONNECTABLE_SCANNABLE_UNDIRECTED;
-        m_adv_params.p_peer_addr     = NULL;    // Undirected advertisement.
+        *type = BLE_GAP_ADV_TYPE_NONCONNECTABLE_SCANNABLE_UNDIRECTED;
         break;
 
     case CONNECTABLE_SCANNABLE:
-        m_adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED;
-        m_adv_params.p_peer_addr     = NULL;    // Undirected advertisement.
+        *type = BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED;
         break;
 
     default:
-        err_code |= RUUVI_ERROR_INVALID_PARAM;
-        break;
+        return RUUVI_ERROR_INVALID_PARAM;
     }
-    if (NRF_SUCCESS == err_code)
+    return RUUVI_SUCCESS;
+}
+
+// Functions for setting up advertisement constants
+// Each change takes effect immediately
+ruuvi_status_t ble4_advertisement_set_interval(int16_t ms)
+{
+    uint32_t interval;
+    if (RUUVI_SUCCESS != interval_convert(ms, &interval)) { return RUUVI_ERROR_INVALID_PARAM; }
+    m_adv_state.advertisement_interval_ms = ms;
+    m_adv_params.interval = interval;
+    return update_settings();
+}
+
+ruuvi_status_t ble4_advertisement_set_power(int8_t dbm)
+{
+    int8_t  tx_power = 0;
+    ret_code_t err_code = NRF_SUCCESS;
+    if (RUUVI_SUCCESS != power_convert(dbm, &tx_power)) { return RUUVI_ERROR_INVALID_PARAM; }
+    err_code = sd_ble_gap_tx_power_set (BLE_GAP_TX_POWER_ROLE_ADV,
+                                        m_adv_handle,
+                                        tx_power
+                                       );
+    if (NRF_SUCCESS == err_code) { m_adv_state.advertisement_power_dbm = tx_power; }
+    return platform_to_ruuvi_error(&err_code);
+}
+
+ruuvi_status_t ble4_advertisement_set_type(ble4_advertisement_type_t advertisement_type)
+{
+    uint8_t type;
+    if (RUUVI_SUCCESS != type_convert(advertisement_type, &type)) { return RUUVI_ERROR_INVALID_PARAM; }
+    m_adv_params.properties.type = type;
+    m_adv_params.p_peer_addr     = NULL;    // Undirected advertisement.
+    m_adv_state.advertisement_type = advertisement_type;
+    return update_settings();
+}
+
+/**
+ * Profiles are converted to SoftDevice values when they are set, so selecting one only compares and applies.
+ * TX power of advertising set changes in one call without touching advertising. Interval and type
+ * change together in one restart between advertising events, and only if they differ from current ones.
+ */
+ruuvi_status_t ble4_advertisement_profile_set(uint8_t index, const ble4_advertisement_profile_t* profile)
+{
+    if (NULL == profile) { return RUUVI_ERROR_NULL; }
+    if (BLE4_ADVERTISEMENT_PROFILES <= index) { return RUUVI_ERROR_INVALID_PARAM; }
+    ble4_advertisement_prepared_t prepared = {0};
+    ruuvi_status_t err_code = RUUVI_SUCCESS;
+    err_code |= interval_convert(profile->interval_ms, &prepared.interval);
+    err_code |= power_convert(profile->power_dbm, &prepared.tx_power);
+    err_code |= type_convert(profile->type, &prepared.type);
+    if (RUUVI_SUCCESS != err_code) { return RUUVI_ERROR_INVALID_PARAM; }
+    prepared.profile = *profile;
+    prepared.valid = true;
+    m_profiles[index] = prepared;
+    return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t ble4_advertisement_profile_select(uint8_t index)
+{
+    if (BLE4_ADVERTISEMENT_PROFILES <= index || !m_profiles[index].valid) { return RUUVI_ERROR_INVALID_PARAM; }
+    const ble4_advertisement_prepared_t* p_profile = &m_profiles[index];
+    ret_code_t err_code = NRF_SUCCESS;
+    if (p_profile->tx_power != m_adv_state.advertisement_power_dbm)
     {
-        m_adv_state.advertisement_type = advertisement_type;
-        return update_settings();
+        err_code = sd_ble_gap_tx_power_set(BLE_GAP_TX_POWER_ROLE_ADV, m_adv_handle, p_profile->tx_power);
+        if (NRF_SUCCESS != err_code) { return platform_to_ruuvi_error(&err_code); }
+        m_adv_state.advertisement_power_dbm = p_profile->tx_power;
     }
-    return platform_to_ruuvi_error(&err_code);;
+    m_adv_state.advertisement_interval_ms = p_profile->profile.interval_ms;
+    m_adv_state.advertisement_type = p_profile->profile.type;
+    if (p_profile->interval == m_adv_params.interval && p_profile->type == m_adv_params.properties.type) { return RUUVI_SUCCESS; }
+    m_adv_params.interval        = p_profile->interval;
+    m_adv_params.properties.type = p_profile->type;
+    m_adv_params.p_peer_addr     = NULL;    // Undirected advertisement.
+    return update_settings();
 }
+
 ruuvi_status_t ble4_advertisement_set_manufacturer_id(uint16_t id)
 {
     m_adv_state.manufacturer_id = id;
+    m_adv_template_valid = false;
     return RUUVI_SUCCESS;
 }
 
 /**
- * Should scan response include uuid of NUS? Takes affect after next message_put
+ * Should scan response include uuid of NUS? Takes effect on next advertising event, or next message_put if not advertising
  */
 ruuvi_status_t ble4_advertisement_scan_response_nus_advertise(bool advertise)
 {
     m_scan_response_uuid = advertise;
+    ble4_advertisement_scan_response_invalidate();
+    return RUUVI_SUCCESS;
+}
+
+ruuvi_status_t ble4_advertisement_set_weight(uint8_t data_format, uint8_t weight)
+{
+    if (0 == weight) { return RUUVI_ERROR_INVALID_PARAM; }
+    ble_advdata_weight_t* p_free = NULL;
+    for (size_t ii = 0; ii < MAXIMUM_ADVERTISEMENTS; ii++)
+    {
+        if (0 != m_weights[ii].weight && data_format == m_weights[ii].data_format)
+        {
+            m_weights[ii].weight = weight;
+            return RUUVI_SUCCESS;
+        }
+        if (NULL == p_free && 0 == m_weights[ii].weight) { p_free = &m_weights[ii]; }
+    }
+    if (NULL == p_free) { return RUUVI_ERROR_NO_MEM; }
+    p_free->data_format = data_format;
+    p_free->weight = weight;
     return RUUVI_SUCCESS;
 }
 
+static uint8_t weight_get(const uint8_t data_format)
+{
+    for (size_t ii = 0; ii < MAXIMUM_ADVERTISEMENTS; ii++)
+    {
+        if (0 != m_weights[ii].weight && data_format == m_weights[ii].data_format) { return m_weights[ii].weight; }
+    }
+    return 1;
+}
+
+void ble4_advertisement_scan_response_invalidate(void)
+{
+    // Generation 0 is reserved for sets which were never encoded
+    m_scan_response_generation = (UINT8_MAX == m_scan_response_generation) ? 1 : (m_scan_response_generation + 1);
+}
+
+// Flags and manufacturer data header with company identifier, length of manufacturer data is patched per message
+static void advertisement_template_encode(void)
+{
+    m_adv_template[0] = ADV_FLAGS_LENGTH - 1;
+    m_adv_template[1] = BLE_GAP_AD_TYPE_FLAGS;
+    m_adv_template[2] = BLE_GAP_ADV_FLAG_BR_EDR_NOT_SUPPORTED;
+    m_adv_template[ADV_MANUF_LENGTH_OFFSET]     = ADV_MANUF_HEADER_LENGTH - 1;
+    m_adv_template[ADV_MANUF_LENGTH_OFFSET + 1] = BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA;
+    m_adv_template[ADV_MANUF_LENGTH_OFFSET + 2] = m_adv_state.manufacturer_id & 0xFF;
+    m_adv_template[ADV_MANUF_LENGTH_OFFSET + 3] = m_adv_state.manufacturer_id >> 8;
+    m_adv_template_valid = true;
+}
+
+/**
+ * Encode name and optionally NUS UUID into scan response of a set SoftDevice is not using.
+ * Detailed payload from last scan request follows as manufacturer data, name is shortened to make room for it.
+ * If name and UUID leave no room, payload is left out.
+ */
+static ret_code_t scan_response_encode(ble_advdata_set_t* const p_set)
+{
+    ble_advdata_t rspdata = {0};
+    uint8_t generation = m_scan_response_generation;
+    const ble_advdata_detail_t* p_detail = &m_scan_detail[m_scan_detail_current];
+    uint16_t manuf_len = (0 < p_detail->length) ? (ADV_MANUF_HEADER_LENGTH + p_detail->length) : 0;
+    p_set->rsp_len = sizeof(p_set->response) - manuf_len;
+    rspdata.name_type = BLE_ADVDATA_FULL_NAME;
+    if (m_scan_response_uuid)
+    {
+        rspdata.uuids_complete.uuid_cnt = sizeof(m_adv_uuids) / sizeof(m_adv_uuids[0]);
+        rspdata.uuids_complete.p_uuids  = m_adv_uuids;
+    }
+    ret_code_t err_code = ble_advdata_encode(&rspdata, p_set->response, &p_set->rsp_len);
+    if (NRF_SUCCESS != err_code && 0 < manuf_len)
+    {
+        manuf_len = 0;
+        p_set->rsp_len = sizeof(p_set->response);
+        err_code = ble_advdata_encode(&rspdata, p_set->response, &p_set->rsp_len);
+    }
+    if (NRF_SUCCESS == err_code && 0 < manuf_len)
+    {
+        if (!m_adv_template_valid) { advertisement_template_encode(); }
+        uint8_t* p_manuf = p_set->response + p_set->rsp_len;
+        memcpy(p_manuf, m_adv_template + ADV_MANUF_LENGTH_OFFSET, ADV_MANUF_HEADER_LENGTH);
+        p_manuf[0] += p_detail->length;
+        memcpy(p_manuf + ADV_MANUF_HEADER_LENGTH, p_detail->payload, p_detail->length);
+        p_set->rsp_len += manuf_len;
+    }
+    PLATFORM_LOG_DEBUG("RSP data status: 0x%X", err_code);
+    p_set->response_generation = (NRF_SUCCESS == err_code) ? generation : 0;
+    return err_code;
+}
+
+// Advertising event of entry on air is over, drop entry once its repeats are used
+static void rotation_account(void)
+{
+    ble_advdata_rotation_t* p_entry = m_rotation_on_air;
+    if (NULL == p_entry || UINT8_MAX == p_entry->data.repeat) { return; }
+    if (0 < p_entry->data.repeat)
+    {
+        p_entry->data.repeat--;
+        return;
+    }
+    p_entry->in_use = false;
+    m_rotation_on_air = NULL;
+}
+
+// Move queued messages into rotation, replacing entry of same format or the one with fewest repeats left
+static void rotation_collect(void)
+{
+    if (m_rotation_flush)
+    {
+        m_rotation_flush = false;
+        for (size_t ii = 0; ii < MAXIMUM_ADVERTISEMENTS; ii++) { m_rotation[ii].in_use = false; }
+        m_rotation_on_air = NULL;
+    }
+    const ble_advdata_storage_t* p_data;
+    while (NULL != (p_data = communication_queue_peek(&advertisement_buffer)))
+    {
+        ble_advdata_rotation_t* p_entry = NULL;
+        for (size_t ii = 0; ii < MAXIMUM_ADVERTISEMENTS && NULL == p_entry; ii++)
+        {
+            if (m_rotation[ii].in_use && p_data->data_format == m_rotation[ii].data.data_format) { p_entry = &m_rotation[ii]; }
+        }
+        for (size_t ii = 0; ii < MAXIMUM_ADVERTISEMENTS && NULL == p_entry; ii++)
+        {
+            if (!m_rotation[ii].in_use) { p_entry = &m_rotation[ii]; }
+        }
+        if (NULL == p_entry)
+        {
+            p_entry = &m_rotation[0];
+            for (size_t ii = 1; ii < MAXIMUM_ADVERTISEMENTS; ii++)
+            {
+                if (m_rotation[ii].data.repeat < p_entry->data.repeat) { p_entry = &m_rotation[ii]; }
+            }
+        }
+        if (p_entry->data.data_format != p_data->data_format || !p_entry->in_use) { p_entry->credit = 0; }
+        memcpy(&(p_entry->data), p_data, sizeof(ble_advdata_storage_t));
+        p_entry->in_use = true;
+        p_entry->fresh = true;
+        communication_queue_release(&advertisement_buffer);
+    }
+}
+
+/**
+ * Smooth weighted round robin: every entry gains its weight in credit, entry with most credit goes on air
+ * and pays back total weight. Formats with weights 3 and 1 go on air as A A B A A A B A ...
+ * without bursts of the same format.
+ */
+static ble_advdata_rotation_t* rotation_pick(void)
+{
+    ble_advdata_rotation_t* p_pick = NULL;
+    int16_t total = 0;
+    for (size_t ii = 0; ii < MAXIMUM_ADVERTISEMENTS; ii++)
+    {
+        ble_advdata_rotation_t* p_entry = &m_rotation[ii];
+        if (!p_entry->in_use) { continue; }
+        p_entry->credit += p_entry->data.weight;
+        total += p_entry->data.weight;
+        if (NULL == p_pick || p_entry->credit > p_pick->credit) { p_pick = p_entry; }
+    }
+    if (NULL != p_pick) { p_pick->credit -= total; }
+    return p_pick;
+}
+
+/**
+ * Consumer of advertisement queue. Queued messages are moved into rotation, next entry of rotation and
+ * current scan response are prepared in the set SoftDevice is not using, and the sets are swapped with
+ * one configure call. If the entry on air stays and has not changed, nothing is configured.
+ * If rotation is empty, last data on air repeats.
+ *
+ * Called from thread context while not advertising and from radio notification after each advertising event
+ * while advertising. SoftDevice then takes new buffers into use on next event and the old set can be reused.
+ * Parameters of a running advertising set can not be changed, so pending parameters restart advertising
+ * in the same idle window and no advertising event is missed. Each SoftDevice call of the restart is checked
+ * on its own: if configure fails, advertising resumes with the set and parameters SoftDevice already has and
+ * parameters stay pending, if start fails, advertising is left stopped for advertisement_recover.
+ */
+static ret_code_t advertisement_update(void)
+{
+    ret_code_t err_code = NRF_SUCCESS;
+    if (m_advertising) { rotation_account(); }
+    rotation_collect();
+    ble_advdata_rotation_t* p_pick = rotation_pick();
+    ble_advdata_set_t* p_active = &m_adv_set[m_adv_set_active];
+    bool data_changed = (NULL != p_pick) && (p_pick != m_rotation_on_air || p_pick->fresh);
+    bool response_stale = p_active->response_generation != m_scan_response_generation;
+    bool params_pending = m_adv_params_pending;
+    if (!data_changed && !response_stale && !params_pending) { return NRF_SUCCESS; }
+
+    uint8_t next = m_adv_set_active;
+    if (data_changed || response_stale)
+    {
+        next ^= 1;
+        ble_advdata_set_t* p_next = &m_adv_set[next];
+        const ble_advdata_storage_t* p_data = data_changed ? &(p_pick->data) : &(p_active->data);
+        memcpy(&(p_next->data), p_data, sizeof(ble_advdata_storage_t));
+        if (p_next->response_generation != m_scan_response_generation) { err_code |= scan_response_encode(p_next); }
+        if (NRF_SUCCESS != err_code) { return err_code; }
+    }
+
+    ble_gap_adv_data_t previous = m_adv_data;
+    m_adv_data.adv_data.p_data      = m_adv_set[next].data.advertisement;
+    m_adv_data.adv_data.len         = m_adv_set[next].data.adv_len;
+    m_adv_data.scan_rsp_data.p_data = m_adv_set[next].response;
+    m_adv_data.scan_rsp_data.len    = m_adv_set[next].rsp_len;
+    bool configured = false;
+    if (!m_advertising)
+    {
+        err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data, &m_adv_params);
+        configured = (NRF_SUCCESS == err_code);
+    }
+    else if (params_pending)
+    {
+        err_code = sd_ble_gap_adv_stop(m_adv_handle);
+        if (NRF_SUCCESS == err_code)
+        {
+            err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data, &m_adv_params);
+            configured = (NRF_SUCCESS == err_code);
+            ret_code_t start_code = sd_ble_gap_adv_start(m_adv_handle, BLE_CONN_CFG_TAG_DEFAULT);
+            if (NRF_SUCCESS != start_code)
+            {
+                m_advertising = false;
+                m_adv_resume = true;
+                err_code = start_code;
+            }
+        }
+    }
+    else
+    {
+        err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data, NULL);
+        configured = (NRF_SUCCESS == err_code);
+    }
+    PLATFORM_LOG_DEBUG("Configure status: 0x%X", err_code);
+
+    // SoftDevice keeps using previous set unless configure succeeded
+    if (!configured)
+    {
+        m_adv_data = previous;
+        return err_code;
+    }
+    m_adv_set_active = next;
+    if (params_pending) { m_adv_params_pending = false; }
+    if (data_changed)
+    {
+        p_pick->fresh = false;
+        m_rotation_on_air = p_pick;
+    }
+    return err_code;
+}
+
+/**
+ * Sample battery voltage under radio load on each radio event, see adc_battery_loaded_get.
+ * Sample is taken in radio notification right after the radio event, while supply capacitor has not
+ * recovered from TX yet, so it needs no timer or wakeup of its own.
+ */
+ruuvi_status_t ble4_advertisement_battery_loaded_sample(bool enable)
+{
+#if NRF5_SDK15_ADC
+    m_battery_loaded_sample = enable;
+    return RUUVI_SUCCESS;
+#else
+    return RUUVI_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * Sample sensors just in time: callback starts an asynchronous read and returns, completion encodes the data
+ * and calls message_put. Message is committed while SoftDevice uses the current set and goes on air
+ * in the next advertising event, so data on air is at most one interval old without a sampling timer.
+ */
+ruuvi_status_t ble4_advertisement_set_before_tx(ruuvi_communication_fp cb)
+{
+    m_before_tx_cb = cb;
+    return RUUVI_SUCCESS;
+}
+
+/**
+ * Detailed scan response on demand. SoftDevice answers a scan request before it is reported,
+ * so payload produced for a request is in the responses from the following advertising event on.
+ * A gateway which scans actively gets fresh details on every request but the first one,
+ * passive listeners cost nothing since nothing is produced without requests.
+ */
+ruuvi_status_t ble4_advertisement_set_on_scan_request(ruuvi_communication_xfer_fp cb)
+{
+    if (!m_advertisement_is_init) { return RUUVI_ERROR_INVALID_STATE; }
+    m_on_scan_request_cb = cb;
+    m_adv_params.scan_req_notification = (NULL != cb);
+    if (NULL == cb)
+    {
+        uint8_t next = m_scan_detail_current ^ 1;
+        m_scan_detail[next].length = 0;
+        m_scan_detail_current = next;
+        ble4_advertisement_scan_response_invalidate();
+    }
+    return update_settings();
+}
+
+/**
+ * SoftDevice stops advertising when a central connects. Radio notifications during connection come from
+ * connection events, so advertising is marked stopped and rotation does not spend repeats on them.
+ */
+static void ble_adv_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    switch (p_ble_evt->header.evt_id)
+    {
+    case BLE_GAP_EVT_CONNECTED:
+        if (BLE_GAP_ROLE_PERIPH == p_ble_evt->evt.gap_evt.params.connected.role)
+        {
+            m_connected = true;
+            m_advertising = false;
+        }
+        return;
+
+    case BLE_GAP_EVT_DISCONNECTED:
+        m_connected = false;
+        return;
+
+    default:
+        break;
+    }
+    ruuvi_communication_xfer_fp cb = m_on_scan_request_cb;
+    if (BLE_GAP_EVT_SCAN_REQ_REPORT != p_ble_evt->header.evt_id || NULL == cb) { return; }
+    // Buffer being written is not read by scan_response_encode until it becomes current
+    uint8_t next = m_scan_detail_current ^ 1;
+    ble_advdata_detail_t* p_detail = &m_scan_detail[next];
+    ruuvi_communication_message_t msg = {0};
+    msg.payload = p_detail->payload;
+    msg.payload_length = sizeof(p_detail->payload);
+    if (RUUVI_SUCCESS != cb(&msg) || sizeof(p_detail->payload) < msg.payload_length) { return; }
+    p_detail->length = (uint8_t)msg.payload_length;
+    m_scan_detail_current = next;
+    // Scan response is encoded again into the idle set after this advertising event
+    ble4_advertisement_scan_response_invalidate();
+}
+
 /*
  * Stop advertising.
  */
@@ -189,13 +675,9 @@ ruuvi_status_t ble4_advertisement_uninit(ruuvi_communication_channel_t* channel)
  */
 static ruuvi_status_t ble4_advertisement_process_asynchronous(void)
 {
-    ret_code_t err_code = NRF_SUCCESS;
-    if (!m_advertising)
-    {
-        // Second parameter is a handle identifying advertising set, support only one
-        err_code = sd_ble_gap_adv_start(m_adv_handle, BLE_CONN_CFG_TAG_DEFAULT);
-        if (NRF_SUCCESS == err_code) { m_advertising = true; }
-    }
+    // First start goes the same way as restart after failure in radio notification
+    if (!m_advertising) { m_adv_resume = true; }
+    ret_code_t err_code = advertisement_recover();
     return platform_to_ruuvi_error(&err_code);
 }
 
@@ -204,7 +686,18 @@ static ruuvi_status_t ble4_advertisement_process_asynchronous(void)
  */
 void ble4_advertisement_restart(void)
 {
-    sd_ble_gap_adv_start(m_adv_handle, BLE_CONN_CFG_TAG_DEFAULT);
+    ret_code_t err_code = sd_ble_gap_adv_start(m_adv_handle, BLE_CONN_CFG_TAG_DEFAULT);
+    if (NRF_SUCCESS == err_code)
+    {
+        m_adv_resume = false;
+        m_advertising = true;
+    }
+    else
+    {
+        // Retried from thread context, see advertisement_recover
+        m_adv_resume = true;
+        m_adv_error = err_code;
+    }
 }
 
 // we have to wait for TX windows
@@ -224,74 +717,47 @@ static ruuvi_status_t ble4_advertisement_is_init(void)
  */
 static ruuvi_status_t ble4_advertisement_flush_tx(void)
 {
-    ble_advdata_storage_t data;
-    while (!ringbuffer_empty(&advertisement_buffer))
-    {
-        ringbuffer_popqueue(&advertisement_buffer, &data);
-    }
+    // Data on air is in advertisement set and repeats, queued messages and rotation are dropped.
+    // Thread context can not preempt radio notification, flushing from producer side is safe.
+    // Rotation belongs to consumer, it is cleared on next update.
+    communication_queue_flush(&advertisement_buffer);
+    m_rotation_flush = true;
     return RUUVI_SUCCESS;
 }
 
 /*
- * Put data to TX buffer. TODO: Handle data being emptied from buffer
+ * Encode data directly into next TX buffer slot. Data goes on air immediately if not advertising,
+ * otherwise after next advertising event. Message replaces earlier one of same data format in rotation
+ * and is advertised on 1 + repeat events of its format, forever if repeat is UINT8_MAX.
+ * While advertising this may be called from interrupt context, e.g. sensor read completion, as long as
+ * messages are put from one context at a time.
  */
 static ruuvi_status_t ble4_advertisement_message_put(ruuvi_communication_message_t* msg)
 {
     if (NULL == msg) { return RUUVI_ERROR_NULL; }
     if (!m_advertisement_is_init) { return RUUVI_ERROR_INVALID_STATE; }
-    if (BLE_GAP_ADV_SET_DATA_SIZE_MAX < msg->payload_length) { return RUUVI_ERROR_INVALID_LENGTH; }
-    if (ringbuffer_full(&advertisement_buffer)) { return RUUVI_ERROR_NO_MEM; }
+    if (ADV_PAYLOAD_MAX_LENGTH < msg->payload_length) { return RUUVI_ERROR_INVALID_LENGTH; }
+    ble_advdata_storage_t* p_data = communication_queue_reserve(&advertisement_buffer);
+    if (NULL == p_data) { return RUUVI_ERROR_NO_MEM; }
     PLATFORM_LOG_HEXDUMP_DEBUG(msg->payload, msg->payload_length);
 
-    ble_advdata_storage_t data = {0};
-    data.adv_len = sizeof(data.advertisement);
-    data.rsp_len = sizeof(data.response);
-    ble_advdata_t advdata = {0};
-    ble_advdata_t rspdata = {0};
-    uint8_t       flags = BLE_GAP_ADV_FLAG_BR_EDR_NOT_SUPPORTED;
-    ble_advdata_manuf_data_t manuf_specific_data;
-    ret_code_t err_code = NRF_SUCCESS;
-    //Payload will be encoded and copied to separate buffer
-    manuf_specific_data.data.p_data = msg->payload;
-    manuf_specific_data.data.size   = msg->payload_length;
-    manuf_specific_data.company_identifier = m_adv_state.manufacturer_id;
-
-    advdata.flags                 = flags;
-    advdata.p_manuf_specific_data = &manuf_specific_data;
-    // Encode data
-    err_code |= ble_advdata_encode(&advdata, data.advertisement, &data.adv_len);
-    PLATFORM_LOG_DEBUG("ADV data status: 0x%X", err_code);
-
-    // Scan response
-    rspdata.name_type = BLE_ADVDATA_FULL_NAME;
-    if (m_scan_response_uuid)
-    {
-        rspdata.uuids_complete.uuid_cnt = sizeof(m_adv_uuids) / sizeof(m_adv_uuids[0]);
-        rspdata.uuids_complete.p_uuids  = m_adv_uuids;
-    }
-    err_code |= ble_advdata_encode(&rspdata, data.response, &data.rsp_len);
-    PLATFORM_LOG_DEBUG("RSP data status: 0x%X", err_code);
-    // Store data
-    ringbuffer_push(&advertisement_buffer, &data);
-
-    //Setup pointers to data
-    size_t index = ringbuffer_get_count(&advertisement_buffer) - 1;
-    PLATFORM_LOG_INFO("Advertising at slot %d", index);
-    ble_advdata_storage_t* p_data = ringbuffer_peek_at(&advertisement_buffer, index);
-    m_adv_data.adv_data.p_data      = p_data->advertisement;
-    m_adv_data.adv_data.len         = p_data->adv_len;
-    m_adv_data.scan_rsp_data.p_data = p_data->response;
-    m_adv_data.scan_rsp_data.len    = p_data->rsp_len;
-    PLATFORM_LOG_DEBUG("Set up advertisement data with length of %d and response %d", m_adv_data.adv_data.len, m_adv_data.scan_rsp_data.len);
-    PLATFORM_LOG_HEXDUMP_DEBUG(m_adv_data.adv_data.p_data, m_adv_data.adv_data.len);
-    PLATFORM_LOG_HEXDUMP_DEBUG(m_adv_data.scan_rsp_data.p_data, m_adv_data.scan_rsp_data.len);
-
-    // Configure advertisement, do not allow parameter update if already advertising.
-    ble_gap_adv_params_t* p_adv_params = &m_adv_params;
-    if (m_advertising) { p_adv_params = NULL; }
-    err_code |= sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data, p_adv_params);
-    PLATFORM_LOG_DEBUG("Configure status: 0x%X", err_code);
-
+    ret_code_t err_code = advertisement_recover();
+    if (!m_adv_template_valid) { advertisement_template_encode(); }
+
+    // Only payload and its length change between messages
+    memcpy(p_data->advertisement, m_adv_template, ADV_TEMPLATE_LENGTH);
+    p_data->advertisement[ADV_MANUF_LENGTH_OFFSET] += (uint8_t)msg->payload_length;
+    memcpy(p_data->advertisement + ADV_TEMPLATE_LENGTH, msg->payload, msg->payload_length);
+    p_data->adv_len = ADV_TEMPLATE_LENGTH + msg->payload_length;
+    p_data->data_format = (0 < msg->payload_length) ? msg->payload[0] : 0;
+    p_data->repeat = msg->repeat;
+    p_data->weight = weight_get(p_data->data_format);
+    PLATFORM_LOG_INFO("Queued at slot %d", (int)(p_data - advertisements));
+    PLATFORM_LOG_HEXDUMP_DEBUG(p_data->advertisement, p_data->adv_len);
+    communication_queue_commit(&advertisement_buffer);
+
+    // Radio notification puts data on air while advertising
+    if (!m_advertising) { err_code |= advertisement_update(); }
     return platform_to_ruuvi_error(&err_code);
 }
 
@@ -328,21 +794,42 @@ static ruuvi_status_t ble4_advertisement_set_on_disconnect(ruuvi_communication_f
     return RUUVI_ERROR_NOT_SUPPORTED;
 }
 
+// Radio activity is an advertising event only while advertising runs and no central is connected
+static bool advertising_running(void)
+{
+    return m_advertising && !m_connected;
+}
+
 /**
  * Gets called right before and after radio activity.
  */
 static void ble_on_radio_active_evt(bool radio_active)
 {
     PLATFORM_LOG_DEBUG("Radio event: %d", radio_active);
+#if NRF5_SDK15_ADC
+    // Radio has just stopped and supply is still drooping, sample is taken on this wakeup.
+    if (!radio_active && m_battery_loaded_sample)
+    {
+        adc_battery_loaded_sample();
+    }
+#endif
+    // Sensor read runs in parallel with advertising event, result is queued for the next one.
+    // Connection events do not trigger reads, sampling stops while connected.
+    if (radio_active && advertising_running() && NULL != m_before_tx_cb)
+    {
+        m_before_tx_cb();
+    }
     if (!radio_active)
     {
-        // Note: this will trigger on GATT event too!
-        // Todo: Schedule pop
-        ble_advdata_storage_t remove;
-        ringbuffer_popqueue(&advertisement_buffer, &remove);
-        
-        // Put the element back in if it was to be repeated
-        if(remove.repeat) { ringbuffer_push(&advertisement_buffer, &remove); }
+        // Note: this will trigger on GATT event too! Those are skipped while connected.
+        // Advertising repeats the data on air until a new message is queued.
+        // This ISR only releases and message_put only reserves, so queue needs no critical section.
+        // Errors are reported by next call from thread context
+        if (advertising_running())
+        {
+            ret_code_t err_code = advertisement_update();
+            if (NRF_SUCCESS != err_code) { m_adv_error = err_code; }
+        }
         if(NULL != m_after_tx_cb) 
         {
         m_after_tx_cb();
@@ -358,7 +845,8 @@ ruuvi_status_t ble4_advertisement_init(ruuvi_communication_channel_t* channel)
     ret_code_t err_code = NRF_SUCCESS;
     if (!m_advertisement_is_init)
     {
-        ringbuffer_init(&advertisement_buffer, MAXIMUM_ADVERTISEMENTS, sizeof(ble_advdata_storage_t), &advertisements);
+        ruuvi_status_t status = communication_queue_init(&advertisement_buffer, advertisements, sizeof(ble_advdata_storage_t), MAXIMUM_ADVERTISEMENTS);
+        if (RUUVI_SUCCESS != status) { return status; }
     }
     // Initialize advertising parameters (used when starting advertising).
     memset(&m_adv_params, 0, sizeof(m_adv_params));
@@ -367,11 +855,15 @@ ruuvi_status_t ble4_advertisement_init(ruuvi_communication_channel_t* channel)
     m_adv_params.properties.type = BLE_GAP_ADV_TYPE_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
     m_adv_params.p_peer_addr     = NULL;    // Undirected advertisement.
     m_adv_params.interval        = APP_ADV_INTERVAL;
+    m_adv_params.scan_req_notification = (NULL != m_on_scan_request_cb);
 
     err_code |= ble_radio_notification_init (APP_IRQ_PRIORITY_LOW,
-                NRF_RADIO_NOTIFICATION_DISTANCE_800US ,
+                RADIO_NOTIFICATION_DISTANCE,
                 ble_on_radio_active_evt);
 
+    // Connection state, and scan requests after ble4_advertisement_set_on_scan_request
+    NRF_SDH_BLE_OBSERVER(m_adv_observer, APP_BLE_OBSERVER_PRIO, ble_adv_evt_handler, NULL);
+
     channel->init   = ble4_advertisement_init;
     channel->uninit = ble4_advertisement_uninit;
     // Can advertise after init
@@ -8,7 +8,7 @@
 #include "ble4_advertisement.h"
 #include "communication.h"
 #include "ruuvi_error.h"
-#include "ringbuffer.h"
+#include "communication_queue.h"
 #include "boards.h" //Device information Service data
 #include "timer.h"
 
@@ -41,7 +41,7 @@ PLATFORM_LOG_MODULE_REGISTER();
 typedef struct {
   uint8_t  data[BLE_NUS_MAX_DATA_LEN];
   uint8_t  data_len;
-  bool     repeat;   // If true, this element will be put back to FIFO after send
+  uint8_t  repeat;   // Times to send again after next send, UINT8_MAX for forever
 } ble_gattdata_storage_t;
 
 NRF_BLE_GATT_DEF(m_gatt);                                                            /**< GATT module instance. */
@@ -49,10 +49,13 @@ NRF_BLE_QWR_DEF(m_qwr);
 BLE_NUS_DEF(m_nus, NRF_SDH_BLE_TOTAL_LINK_COUNT);                                    /**< BLE NUS service instance. */
 static uint16_t       m_conn_handle          = BLE_CONN_HANDLE_INVALID;              /**< Handle of the current connection. */
 
-static uint8_t        incoming[sizeof(ble_gattdata_storage_t) * BLE4_MAXIMUM_GATT_MESSAGES];
-static uint8_t        outgoing[sizeof(ble_gattdata_storage_t) * BLE4_MAXIMUM_GATT_MESSAGES];
-static ringbuffer_t   incoming_buffer;
-static ringbuffer_t   outgoing_buffer;
+static ble_gattdata_storage_t incoming[BLE4_MAXIMUM_GATT_MESSAGES];
+static ble_gattdata_storage_t outgoing[BLE4_MAXIMUM_GATT_MESSAGES];
+static ble_gattdata_storage_t repeated[BLE4_MAXIMUM_GATT_MESSAGES];
+static communication_queue_t  incoming_buffer;
+static communication_queue_t  outgoing_buffer;
+static communication_queue_t  repeated_buffer;   // Both ends are owned by TX processing, not by message_put
+static bool                   repeat_turn = false;
 static bool           gatt_is_init = false;
 /**@brief Function for the GAP initialization.
  *
@@ -148,17 +151,19 @@ static void nus_data_handler(ble_nus_evt_t * p_evt)
   {
 
     PLATFORM_LOG_INFO("Received data from BLE NUS.");
-    if (ringbuffer_full(&incoming_buffer))
+    // SoftDevice event context is the only producer of incoming queue
+    ble_gattdata_storage_t* p_msg = communication_queue_reserve(&incoming_buffer);
+    if (NULL == p_msg || sizeof(p_msg->data) < p_evt->params.rx_data.length)
     {
       PLATFORM_LOG_ERROR("Could not store incoming data");
       return;
     }
     //PLATFORM_LOG_HEXDUMP_DEBUG(p_evt->params.rx_data.p_data, p_evt->params.rx_data.length);
 
-    ble_gattdata_storage_t msg;
-    memcpy(msg.data, p_evt->params.rx_data.p_data, p_evt->params.rx_data.length);
-    msg.data_len = p_evt->params.rx_data.length;
-    ringbuffer_push(&incoming_buffer, &msg);
+    memcpy(p_msg->data, p_evt->params.rx_data.p_data, p_evt->params.rx_data.length);
+    p_msg->data_len = p_evt->params.rx_data.length;
+    p_msg->repeat = 0;
+    communication_queue_commit(&incoming_buffer);
   }
 }
 
@@ -448,8 +453,9 @@ ruuvi_status_t ble4_gatt_init(void)
 
   if (!gatt_is_init)
   {
-    ringbuffer_init(&incoming_buffer, BLE4_MAXIMUM_GATT_MESSAGES, sizeof(ble_gattdata_storage_t), &incoming);
-    ringbuffer_init(&outgoing_buffer, BLE4_MAXIMUM_GATT_MESSAGES, sizeof(ble_gattdata_storage_t), &outgoing);
+    communication_queue_init(&incoming_buffer, incoming, sizeof(ble_gattdata_storage_t), BLE4_MAXIMUM_GATT_MESSAGES);
+    communication_queue_init(&outgoing_buffer, outgoing, sizeof(ble_gattdata_storage_t), BLE4_MAXIMUM_GATT_MESSAGES);
+    communication_queue_init(&repeated_buffer, repeated, sizeof(ble_gattdata_storage_t), BLE4_MAXIMUM_GATT_MESSAGES);
   }
 
   // Register a handler for BLE events.
@@ -526,6 +532,52 @@ bool ble4_nus_is_connected(void)
   return true;
 }
 
+/**
+ * Next message to send. Repeated messages take turns with new messages,
+ * so that a message repeated forever does not block messages queued after it.
+ */
+static ble_gattdata_storage_t* ble4_nus_next(void)
+{
+  ble_gattdata_storage_t* p_msg = NULL;
+  if (repeat_turn || communication_queue_empty(&outgoing_buffer))
+  {
+    p_msg = communication_queue_peek(&repeated_buffer);
+  }
+  if (NULL == p_msg) { p_msg = communication_queue_peek(&outgoing_buffer); }
+  return p_msg;
+}
+
+/**
+ * Release sent message. Message which still has repeats left is moved to back of repeated queue.
+ * Queue of repeated messages is reserved and released by TX processing only, so outgoing queue stays
+ * single producer. If repeated queue is full, new message counts down at front of outgoing queue
+ * and takes turns with repeated messages. Returns true if sent message is to be repeated or was a repeat.
+ */
+static bool ble4_nus_sent(ble_gattdata_storage_t* const p_msg)
+{
+  bool from_repeated = (p_msg == communication_queue_peek(&repeated_buffer));
+  communication_queue_t* const source = from_repeated ? &repeated_buffer : &outgoing_buffer;
+  repeat_turn = !from_repeated;
+  if (0 == p_msg->repeat)
+  {
+    communication_queue_release(source);
+    return from_repeated;
+  }
+  ble_gattdata_storage_t msg = *p_msg;
+  if (UINT8_MAX != msg.repeat) { msg.repeat--; }
+  if (from_repeated) { communication_queue_release(source); }
+  ble_gattdata_storage_t* p_repeat = communication_queue_reserve(&repeated_buffer);
+  if (NULL == p_repeat)
+  {
+    p_msg->repeat = msg.repeat;
+    return true;
+  }
+  *p_repeat = msg;
+  communication_queue_commit(&repeated_buffer);
+  if (!from_repeated) { communication_queue_release(source); }
+  return true;
+}
+
 /**
  *  Queue messages from buffer into SD buffer
  */
@@ -535,26 +587,19 @@ ruuvi_status_t ble4_nus_process_asynchronous(void)
   ble_gattdata_storage_t* p_msg;
 
   //While there remains data, and data was queued successfully
-  while (NRF_SUCCESS == err_code && ringbuffer_get_count(&outgoing_buffer))
+  while (NRF_SUCCESS == err_code && NULL != (p_msg = ble4_nus_next()))
   {
-    PLATFORM_LOG_INFO("Trying to asynchronously send message, %d messages remaining ", ringbuffer_get_count(&outgoing_buffer));
-    // Get pointer to data
-    p_msg = ringbuffer_peek_at(&outgoing_buffer, 0);
-    // Queue DATA to SD
+    PLATFORM_LOG_INFO("Trying to asynchronously send message, %d messages remaining ", communication_queue_count(&outgoing_buffer));
+    // Queue DATA to SD, SD copies it out of the slot
     uint16_t data_len = p_msg->data_len;
     err_code = ble_nus_data_send(&m_nus, p_msg->data, &data_len, m_conn_handle);
     if (NRF_SUCCESS == err_code)
     {
-      // TODO: optimize unnecessary memory copy out?
-      ringbuffer_popqueue(&outgoing_buffer, p_msg);
-      PLATFORM_LOG_INFO("Message sent, %d messages remaining", ringbuffer_get_count(&outgoing_buffer));
-      // Put message back to queue if it is repeated.
+      // Repeated message is sent again on its next turn.
       // It's not a bug to allow saturation of tx channel, this can
       // be used to test throughput.
-      if (p_msg->repeat)
-      {
-        ringbuffer_push(&outgoing_buffer, p_msg);
-      }
+      ble4_nus_sent(p_msg);
+      PLATFORM_LOG_INFO("Message sent, %d messages remaining", communication_queue_count(&outgoing_buffer));
     }
     else { PLATFORM_LOG_INFO("Failed to send message, %d", err_code); }
   }
@@ -567,27 +612,19 @@ ruuvi_status_t ble4_nus_process_synchronous(void)
   ble_gattdata_storage_t* p_msg;
 
   //While there remains data
-  while (ringbuffer_get_count(&outgoing_buffer))
+  while (NULL != (p_msg = ble4_nus_next()))
   {
-    // Get pointer to data
-    p_msg = ringbuffer_peek_at(&outgoing_buffer, 0);
     // Queue DATA to SD
     uint16_t data_len = p_msg->data_len;
     err_code = ble_nus_data_send(&m_nus, p_msg->data, &data_len, m_conn_handle);
     PLATFORM_LOG_INFO("Trying to synchronously send message");
     if (NRF_SUCCESS == err_code)
     {
-      // TODO: optimize unnecessary memory copy out?
-      ringbuffer_popqueue(&outgoing_buffer, p_msg);
       PLATFORM_LOG_INFO("Message is queued");
-      // Put message back to queue if it is repeated.
+      // Repeated message stays in queue.
       // Because this is a synchronous function, return
-      // after putting message back to avoid getting stuck in eternal loop
-      if (p_msg->repeat)
-      {
-        ringbuffer_push(&outgoing_buffer, p_msg);
-        return RUUVI_SUCCESS;
-      }
+      // after sending a repeated message to avoid getting stuck in eternal loop
+      if (ble4_nus_sent(p_msg)) { return RUUVI_SUCCESS; }
     }
   }
   return RUUVI_SUCCESS;
@@ -596,47 +633,45 @@ ruuvi_status_t ble4_nus_process_synchronous(void)
 // Drop outgoing buffer
 ruuvi_status_t ble4_nus_flush_tx(void)
 {
-  ble_gattdata_storage_t msg;
-  while (ringbuffer_get_count(&outgoing_buffer)) { ringbuffer_popqueue(&outgoing_buffer, &msg); }
+  communication_queue_flush(&outgoing_buffer);
+  communication_queue_flush(&repeated_buffer);
   return RUUVI_SUCCESS;
 }
 
 // Drop incoming buffer
 ruuvi_status_t ble4_nus_flush_rx(void)
 {
-  ble_gattdata_storage_t msg;
-  while (ringbuffer_get_count(&incoming_buffer)) { ringbuffer_popqueue(&incoming_buffer, &msg); }
+  communication_queue_flush(&incoming_buffer);
   return RUUVI_SUCCESS;
 }
 
-// Copy message into ringbuffer. Note: this has two memcpy opsm optimize one out?
+// Copy message directly into queue slot
 ruuvi_status_t ble4_nus_message_put(ruuvi_communication_message_t* msg)
 {
   if (NULL == msg || NULL == msg->payload)        { return RUUVI_ERROR_NULL; }
   if (msg->payload_length > BLE_NUS_MAX_DATA_LEN) { return RUUVI_ERROR_INVALID_LENGTH; }
-  if (ringbuffer_full(&outgoing_buffer))          { return RUUVI_ERROR_NO_MEM; }
+  ble_gattdata_storage_t* p_msg = communication_queue_reserve(&outgoing_buffer);
+  if (NULL == p_msg)                              { return RUUVI_ERROR_NO_MEM; }
 
-  ble_gattdata_storage_t gatt_msg;
-  memcpy(gatt_msg.data, msg->payload, msg->payload_length);
-  gatt_msg.data_len = msg->payload_length;
-  gatt_msg.repeat = msg->repeat;
+  memcpy(p_msg->data, msg->payload, msg->payload_length);
+  p_msg->data_len = msg->payload_length;
+  p_msg->repeat = msg->repeat;
+  communication_queue_commit(&outgoing_buffer);
 
-  ringbuffer_push(&outgoing_buffer, &gatt_msg);
-
-  return RUUVI_ERROR_NOT_IMPLEMENTED;
+  return RUUVI_SUCCESS;
 }
 
 ruuvi_status_t ble4_nus_message_get(ruuvi_communication_message_t* msg)
 {
   if (NULL == msg || NULL == msg->payload)        { return RUUVI_ERROR_NULL; }
   if (msg->payload_length < BLE_NUS_MAX_DATA_LEN) { return RUUVI_ERROR_INVALID_LENGTH; }
-  if (ringbuffer_empty(&incoming_buffer))         { return RUUVI_ERROR_NOT_FOUND; }
+  ble_gattdata_storage_t* p_msg = communication_queue_peek(&incoming_buffer);
+  if (NULL == p_msg)                              { return RUUVI_ERROR_NOT_FOUND; }
 
-  ble_gattdata_storage_t gatt_msg;
-  ringbuffer_popqueue(&incoming_buffer, &gatt_msg);
   PLATFORM_LOG_INFO("Retrieving message");
-  memcpy(msg->payload, gatt_msg.data, gatt_msg.data_len);
-  msg->payload_length = gatt_msg.data_len;
+  memcpy(msg->payload, p_msg->data, p_msg->data_len);
+  msg->payload_length = p_msg->data_len;
+  communication_queue_release(&incoming_buffer);
 
   return RUUVI_SUCCESS;
 }
@@ -2,6 +2,7 @@
 #if NRF5_SDK15_BLE4_STACK
 
 #include "ble4_stack.h"
+#include "ble4_advertisement.h"
 #include "ruuvi_error.h"
 
 #include <stdbool.h>
@@ -73,6 +74,7 @@ ruuvi_status_t ble4_set_name(uint8_t* name, uint8_t name_length, bool include_se
         len += 4;
     }
     ret_code_t err_code = sd_ble_gap_device_name_set (&security, (uint8_t*)name_serial, len);
+    if (NRF_SUCCESS == err_code) { ble4_advertisement_scan_response_invalidate(); }
     return platform_to_ruuvi_error(&err_code);
 }
 
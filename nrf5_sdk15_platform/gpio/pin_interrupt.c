@@ -96,4 +96,15 @@ ruuvi_status_t platform_pin_interrupt_enable(uint8_t pin, ruuvi_gpio_slope_t slo
   return platform_to_ruuvi_error(&err_code);
 }
 
+/**
+ *  Disable interrupt on pin and release the GPIOTE channel.
+ */
+ruuvi_status_t platform_pin_interrupt_disable(uint8_t pin)
+{
+  nrf_drv_gpiote_in_event_disable(pin);
+  nrf_drv_gpiote_in_uninit(pin);
+  pin_event_handlers[pin] = NULL;
+  return RUUVI_SUCCESS;
+}
+
 #endif
\ No newline at end of file
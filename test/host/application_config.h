@@ -0,0 +1,12 @@
+/**
+ * Host build of platform independent modules for tests and benchmarks.
+ */
+#ifndef APPLICATION_CONFIG_H
+#define APPLICATION_CONFIG_H
+
+#define DSP_ENGINE              1
+#define COMMUNICATION_QUEUE     1
+#define COMMUNICATION_DEADBAND  1
+#define COMMUNICATION_INTERVAL  1
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * Send-on-delta filter against hand-computed field values.
+ *
+ * Signed 1- and 2-byte fields must be sign extended, so that a change from -1 to 1 is 2 and not 254.
+ * Little-endian fields must be read in their own byte order. Bytes outside fields, and bytes of a field
+ * cut by end of payload, are compared exactly. Drift is measured from last sent message, not last put.
+ * max_skips must force a message through, and a failed message_put must not become baseline.
+ */
+#include "ruuvi_error.h"
+#include "communication.h"
+#include "communication_deadband.h"
+#include <stdio.h>
+#include <string.h>
+
+static int            puts_count;
+static ruuvi_status_t put_status = RUUVI_SUCCESS;
+
+static ruuvi_status_t message_put(ruuvi_communication_message_t* msg)
+{
+  (void)msg;
+  if(RUUVI_SUCCESS == put_status) { puts_count++; }
+  return put_status;
+}
+
+// Changed-check of payload b against baseline a
+static bool changed(communication_deadband_t* const filter, const uint8_t* const a, const uint8_t* const b, const size_t length)
+{
+  uint8_t first[COMMUNICATION_DEADBAND_PAYLOAD_MAX];
+  uint8_t second[COMMUNICATION_DEADBAND_PAYLOAD_MAX];
+  memcpy(first, a, length);
+  memcpy(second, b, length);
+  ruuvi_communication_channel_t channel = {0};
+  channel.message_put = message_put;
+  ruuvi_communication_message_t msg = {.payload_length = length, .repeat = 0, .payload = first};
+  communication_deadband_reset(filter);
+  communication_deadband_put(filter, &channel, &msg);
+  msg.payload = second;
+  return communication_deadband_changed(filter, &msg);
+}
+
+static int expect(const char* const name, const bool got, const bool expected)
+{
+  printf("%-36s %s\n", name, (got == expected) ? "ok" : "FAILED");
+  return (got == expected) ? 0 : 1;
+}
+
+static int fields(void)
+{
+  int failures = 0;
+  communication_deadband_t filter;
+  const communication_deadband_field_t layout[] =
+  {
+    {.offset = 0, .size = 1, .is_signed = true,  .little_endian = false, .deadband = 2},
+    {.offset = 1, .size = 2, .is_signed = true,  .little_endian = false, .deadband = 4},
+    {.offset = 3, .size = 2, .is_signed = false, .little_endian = true,  .deadband = 1},
+    {.offset = 5, .size = 4, .is_signed = true,  .little_endian = true,  .deadband = 10},
+    {.offset = 9, .size = 1, .is_signed = false, .little_endian = false, .deadband = COMMUNICATION_DEADBAND_IGNORE},
+    {.offset = 11, .size = 2, .is_signed = false, .little_endian = false, .deadband = 100}
+  };
+  if(RUUVI_SUCCESS != communication_deadband_init(&filter, layout, sizeof(layout) / sizeof(layout[0]), 0)) { return 1; }
+  // int8 -1, int16 BE -2, uint16 LE 255, int32 LE -5, ignored, unfielded byte, uint16 BE 1000
+  const uint8_t base[] = {0xFF, 0xFF, 0xFE, 0xFF, 0x00, 0xFB, 0xFF, 0xFF, 0xFF, 0x00, 0x42, 0x03, 0xE8};
+  uint8_t next[sizeof(base)];
+
+  memcpy(next, base, sizeof(base));
+  failures += expect("identical", changed(&filter, base, next, sizeof(base)), false);
+  next[0] = 0x01;   // -1 -> 1
+  failures += expect("int8 -1 to 1 within 2", changed(&filter, base, next, sizeof(base)), false);
+  next[0] = 0x02;   // -1 -> 2
+  failures += expect("int8 -1 to 2 over 2", changed(&filter, base, next, sizeof(base)), true);
+  memcpy(next, base, sizeof(base));
+  next[1] = 0x00; next[2] = 0x02;  // -2 -> 2
+  failures += expect("int16 -2 to 2 within 4", changed(&filter, base, next, sizeof(base)), false);
+  next[2] = 0x03;   // -2 -> 3
+  failures += expect("int16 -2 to 3 over 4", changed(&filter, base, next, sizeof(base)), true);
+  memcpy(next, base, sizeof(base));
+  next[3] = 0x00; next[4] = 0x01;  // LE 255 -> 256
+  failures += expect("uint16 LE 255 to 256 within 1", changed(&filter, base, next, sizeof(base)), false);
+  next[3] = 0x01;   // LE 255 -> 257
+  failures += expect("uint16 LE 255 to 257 over 1", changed(&filter, base, next, sizeof(base)), true);
+  memcpy(next, base, sizeof(base));
+  next[5] = 0x05; next[6] = 0x00; next[7] = 0x00; next[8] = 0x00;  // LE -5 -> 5
+  failures += expect("int32 LE -5 to 5 within 10", changed(&filter, base, next, sizeof(base)), false);
+  next[5] = 0x06;   // -5 -> 6
+  failures += expect("int32 LE -5 to 6 over 10", changed(&filter, base, next, sizeof(base)), true);
+  memcpy(next, base, sizeof(base));
+  next[9] = 0xFF;
+  failures += expect("ignored field", changed(&filter, base, next, sizeof(base)), false);
+  memcpy(next, base, sizeof(base));
+  next[10] = 0x43;
+  failures += expect("byte outside fields", changed(&filter, base, next, sizeof(base)), true);
+  memcpy(next, base, sizeof(base));
+  next[12] = 0xE9;
+  failures += expect("uint16 BE within 100", changed(&filter, base, next, sizeof(base)), false);
+  // Payload ends in the middle of last field, its first byte is compared exactly
+  failures += expect("cut field, same byte", changed(&filter, base, next, sizeof(base) - 1), false);
+  next[11] = 0x04;
+  failures += expect("cut field, changed byte", changed(&filter, base, next, sizeof(base) - 1), true);
+  memcpy(next, base, sizeof(base));
+  changed(&filter, base, next, sizeof(base));
+  ruuvi_communication_message_t shorter = {.payload_length = sizeof(base) - 2, .repeat = 0, .payload = next};
+  failures += expect("length differs", communication_deadband_changed(&filter, &shorter), true);
+  return failures;
+}
+
+static int heartbeat(void)
+{
+  int failures = 0;
+  communication_deadband_t filter;
+  const communication_deadband_field_t layout[] = {{.offset = 0, .size = 2, .is_signed = false, .little_endian = false, .deadband = 10}};
+  if(RUUVI_SUCCESS != communication_deadband_init(&filter, layout, 1, 3)) { return 1; }
+  ruuvi_communication_channel_t channel = {0};
+  channel.message_put = message_put;
+  uint8_t payload[2] = {0, 0};
+  ruuvi_communication_message_t msg = {.payload_length = sizeof(payload), .repeat = 0, .payload = payload};
+
+  // First message, then every fourth one with max_skips 3
+  puts_count = 0;
+  for(int ii = 0; ii < 9; ii++) { communication_deadband_put(&filter, &channel, &msg); }
+  failures += expect("max_skips 3 of 9 identical: 3 sent", 3 == puts_count, true);
+
+  // Drift of 4 per message is sent when it exceeds 10 from last sent, i.e. every third message
+  communication_deadband_init(&filter, layout, 1, 0);
+  puts_count = 0;
+  for(int ii = 0; ii < 10; ii++)
+  {
+    payload[1] = (uint8_t)(4 * ii);
+    communication_deadband_put(&filter, &channel, &msg);
+  }
+  failures += expect("drift 4 per message: 4 sent", 4 == puts_count, true);
+
+  // Failed put does not become baseline, same message is tried again
+  communication_deadband_reset(&filter);
+  put_status = RUUVI_ERROR_NO_MEM;
+  bool failed = (RUUVI_ERROR_NO_MEM == communication_deadband_put(&filter, &channel, &msg));
+  put_status = RUUVI_SUCCESS;
+  puts_count = 0;
+  communication_deadband_put(&filter, &channel, &msg);
+  failures += expect("failed put is retried", failed && 1 == puts_count, true);
+  return failures;
+}
+
+int main(void)
+{
+  int failures = 0;
+  failures += fields();
+  failures += heartbeat();
+  printf("%s\n", (0 == failures) ? "communication deadband: ok" : "communication deadband: FAILED");
+  return (0 == failures) ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+/**
+ * Adaptive interval against a recorded sequence of set_interval calls.
+ *
+ * Volatile data must drive interval to min_ms and calm data back to max_ms, which requires
+ * score to decay all the way to fall_threshold, also when it is 0. Interval must not
+ * oscillate between the thresholds, and motion must drop it to min_ms on next update.
+ */
+#include "ruuvi_error.h"
+#include "communication_interval.h"
+#include <stdio.h>
+
+#define MIN_MS 100
+#define MAX_MS 6400
+
+static int16_t applied;
+static int     calls;
+
+static ruuvi_status_t set_interval(int16_t ms)
+{
+  applied = ms;
+  calls++;
+  return RUUVI_SUCCESS;
+}
+
+// Updates with given data until interval reaches target, -1 if it does not within limit
+static int settle(communication_interval_t* const controller, const bool changed, const int16_t target, const int limit)
+{
+  for(int ii = 1; ii <= limit; ii++)
+  {
+    if(RUUVI_SUCCESS != communication_interval_update(controller, changed)) { return -1; }
+    if(target == applied) { return ii; }
+  }
+  return -1;
+}
+
+static int thresholds(const uint8_t rise, const uint8_t fall)
+{
+  int failures = 0;
+  communication_interval_t controller;
+  communication_interval_config_t config = {MIN_MS, MAX_MS, rise, fall, 2, set_interval};
+  if(RUUVI_SUCCESS != communication_interval_init(&controller, &config) || MIN_MS != applied) { return 1; }
+
+  int volatile_updates = settle(&controller, true, MIN_MS, 100);
+  int calm_updates = settle(&controller, false, MAX_MS, 500);
+  printf("rise %3d fall %3d: max after %d calm updates, score %d\n", rise, fall, calm_updates, controller.score);
+  if(0 > volatile_updates || 0 > calm_updates || fall < controller.score) { failures++; }
+
+  // Changes in every other measurement keep score between the thresholds
+  calls = 0;
+  for(int ii = 0; ii < 200; ii++) { communication_interval_update(&controller, ii & 1); }
+  printf("rise %3d fall %3d: %d interval changes on alternating data, score %d\n", rise, fall, calls, controller.score);
+  if(controller.score < rise && controller.score > fall && 0 != calls) { failures++; }
+
+  communication_interval_activity(&controller);
+  communication_interval_update(&controller, false);
+  if(MIN_MS != applied) { failures++; }
+  return failures;
+}
+
+int main(void)
+{
+  int failures = 0;
+  failures += thresholds(128, 0);
+  failures += thresholds(192, 32);
+  printf("%s\n", (0 == failures) ? "communication interval: ok" : "communication interval: FAILED");
+  return (0 == failures) ? 0 : 1;
+}
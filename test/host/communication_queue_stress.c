@@ -0,0 +1,84 @@
+/**
+ * Two-thread stress test of communication_queue, producer and consumer on separate threads.
+ *
+ * Producer writes each message directly into reserved slot and commits it, consumer checks
+ * sequence number and contents in place before release. A slot which becomes visible before
+ * its contents, or is reused before release, shows up as a wrong or torn message.
+ * Odd capacity checks that full and empty are told apart with indices over 2 * capacity.
+ */
+#include "ruuvi_error.h"
+#include "communication_queue.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#define MESSAGES 2000000u
+#define CAPACITY 5
+#define WORDS    7
+
+typedef struct
+{
+  uint32_t seq;
+  uint32_t data[WORDS];
+  uint32_t check;
+}message_t;
+
+static message_t             storage[CAPACITY];
+static communication_queue_t queue;
+
+static void* producer(void* arg)
+{
+  (void)arg;
+  for(uint32_t seq = 0; seq < MESSAGES;)
+  {
+    message_t* p_msg = communication_queue_reserve(&queue);
+    if(NULL == p_msg) { sched_yield(); continue; }
+    p_msg->seq = seq;
+    for(uint32_t ii = 0; ii < WORDS; ii++) { p_msg->data[ii] = seq * (ii + 1); }
+    p_msg->check = seq ^ 0xA5A5A5A5u;
+    communication_queue_commit(&queue);
+    seq++;
+  }
+  return NULL;
+}
+
+static int consume(void)
+{
+  size_t max_count = 0;
+  for(uint32_t seq = 0; seq < MESSAGES;)
+  {
+    message_t* p_msg = communication_queue_peek(&queue);
+    if(NULL == p_msg) { sched_yield(); continue; }
+    size_t count = communication_queue_count(&queue);
+    if(count > max_count) { max_count = count; }
+    if(CAPACITY < count || seq != p_msg->seq || (seq ^ 0xA5A5A5A5u) != p_msg->check)
+    {
+      printf("FAIL at %u: got %u, count %zu\n", seq, p_msg->seq, count);
+      return 1;
+    }
+    for(uint32_t ii = 0; ii < WORDS; ii++)
+    {
+      if(seq * (ii + 1) != p_msg->data[ii])
+      {
+        printf("FAIL at %u: torn message\n", seq);
+        return 1;
+      }
+    }
+    communication_queue_release(&queue);
+    seq++;
+  }
+  printf("%u messages through %d slots, max count %zu\n", MESSAGES, CAPACITY, max_count);
+  return 0;
+}
+
+int main(void)
+{
+  pthread_t thread;
+  if(RUUVI_SUCCESS != communication_queue_init(&queue, storage, sizeof(message_t), CAPACITY)) { return 1; }
+  if(0 != pthread_create(&thread, NULL, producer, NULL)) { return 1; }
+  int failures = consume();
+  pthread_join(thread, NULL);
+  if(!communication_queue_empty(&queue)) { failures++; }
+  printf("%s\n", (0 == failures) ? "communication queue: ok" : "communication queue: FAILED");
+  return (0 == failures) ? 0 : 1;
+}
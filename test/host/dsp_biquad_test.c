@@ -0,0 +1,128 @@
+/**
+ * Frequency response of fixed-point Butterworth cascades against double-precision reference.
+ *
+ * Reference is the same bilinear design evaluated in double on the unit circle.
+ * Gain of the fixed-point filter is measured by fitting a sinusoid to steady-state output,
+ * so coefficient quantization to Q2.30 and state precision show up as gain error.
+ * Low cutoffs relative to samplerate put a1 close to -2, which is the case Q2.30 is for.
+ * Step response must settle exactly on the input, which relies on error feedback.
+ */
+#include "ruuvi_error.h"
+#include "dsp_biquad.h"
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+
+#define SAMPLES       40000
+#define AMPLITUDE     8000.0
+#define MAX_GAIN_ERROR 0.002  // Absolute, gain 1 in passband
+
+static int32_t x[SAMPLES];
+static int16_t x16[SAMPLES];
+
+static double reference_gain(const int stages, const int highpass, const double fc, const double fs, const double f)
+{
+  double complex z = cexp(I * 2 * M_PI * f / fs);
+  double complex h = 1;
+  for(int kk = 0; kk < stages; kk++)
+  {
+    double q = 1 / (2 * cos(((2 * kk + 1) * M_PI) / (4 * stages)));
+    double w0 = 2 * M_PI * fc / fs;
+    double cosw = cos(w0);
+    double alpha = sin(w0) / (2 * q);
+    double b0 = highpass ? (1 + cosw) / 2 : (1 - cosw) / 2;
+    double b1 = highpass ? -(1 + cosw) : (1 - cosw);
+    h *= (b0 + (b1 / z) + (b0 / (z * z))) / ((1 + alpha) + ((-2 * cosw) / z) + ((1 - alpha) / (z * z)));
+  }
+  return cabs(h);
+}
+
+// Amplitude of sinusoid of frequency f in second half of y, least squares over whole periods
+static double measured_gain(const double* const y, const double f, const double fs)
+{
+  size_t start = SAMPLES / 2;
+  size_t period = (size_t)lround(fs / f);
+  size_t n = ((SAMPLES - start) / period) * period;
+  if(0 == n) { n = SAMPLES - start; }
+  double re = 0;
+  double im = 0;
+  for(size_t ii = start; ii < start + n; ii++)
+  {
+    re += y[ii] * cos(2 * M_PI * f * ii / fs);
+    im += y[ii] * sin(2 * M_PI * f * ii / fs);
+  }
+  return 2 * sqrt((re * re) + (im * im)) / n / AMPLITUDE;
+}
+
+static double y[SAMPLES];
+
+static int response(const int stages, const int highpass, const double fc, const double fs, const int q15)
+{
+  int failures = 0;
+  double worst = 0;
+  for(double f = fs / 400; f < fs / 2; f *= 1.5)
+  {
+    dsp_biquad_t coeffs[DSP_BIQUAD_STAGES_MAX];
+    dsp_biquad_state_t state[DSP_BIQUAD_STAGES_MAX];
+    dsp_biquad_butterworth(coeffs, stages, highpass, fc, fs);
+    dsp_biquad_reset(state, stages);
+    for(size_t ii = 0; ii < SAMPLES; ii++)
+    {
+      x[ii] = (int32_t)lrint(AMPLITUDE * sin(2 * M_PI * f * ii / fs));
+      x16[ii] = (int16_t)x[ii];
+    }
+    if(q15)
+    {
+      dsp_biquad_cascade_q15_block(coeffs, state, stages, x16, x16, SAMPLES);
+      for(size_t ii = 0; ii < SAMPLES; ii++) { y[ii] = x16[ii]; }
+    }
+    else
+    {
+      dsp_biquad_cascade_q31_block(coeffs, state, stages, x, x, SAMPLES);
+      for(size_t ii = 0; ii < SAMPLES; ii++) { y[ii] = x[ii]; }
+    }
+    double error = fabs(measured_gain(y, f, fs) - reference_gain(stages, highpass, fc, fs, f));
+    if(error > worst) { worst = error; }
+    if(MAX_GAIN_ERROR < error)
+    {
+      printf("FAIL %s %d stages fc %.1f fs %.0f f %.3f: gain error %.5f\n", highpass ? "HP" : "LP", stages, fc, fs, f, error);
+      failures++;
+    }
+  }
+  printf("%s %s %d stages fc %5.1f Hz fs %4.0f Hz: worst gain error %.6f\n", q15 ? "q15" : "q31",
+         highpass ? "HP" : "LP", stages, fc, fs, worst);
+  return failures;
+}
+
+// Step into low-pass with low cutoff must settle on input exactly
+static int step(const double fc, const double fs, const int32_t level)
+{
+  dsp_biquad_t coeffs[2];
+  dsp_biquad_state_t state[2];
+  dsp_biquad_butterworth(coeffs, 2, false, fc, fs);
+  dsp_biquad_reset(state, 2);
+  int32_t out = 0;
+  for(size_t ii = 0; ii < SAMPLES; ii++) { out = dsp_biquad_cascade_q31(coeffs, state, 2, level); }
+  dsp_biquad_prime(coeffs, state, 2, -level);
+  int32_t primed = dsp_biquad_cascade_q31(coeffs, state, 2, -level);
+  printf("step %d into LP fc %.2f Hz fs %.0f Hz: settled %d, primed %d\n", level, fc, fs, out, primed);
+  return (level == out && -level == primed) ? 0 : 1;
+}
+
+int main(void)
+{
+  int failures = 0;
+  for(int highpass = 0; highpass < 2; highpass++)
+  {
+    for(int stages = 1; stages <= DSP_BIQUAD_STAGES_MAX; stages++)
+    {
+      failures += response(stages, highpass, 1, 400, 0);
+      failures += response(stages, highpass, 10, 100, 0);
+    }
+    failures += response(2, highpass, 10, 100, 1);
+  }
+  failures += step(0.5, 400, 1000);
+  failures += step(0.5, 1600, 7);
+  printf("%s\n", (0 == failures) ? "dsp biquad: ok" : "dsp biquad: FAILED");
+  return (0 == failures) ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/**
+ * Reductions of dsp_buffer_get on block kernels against scalar per-sample processing.
+ *
+ * 60 s of 3-axis accelerometer data at 400 Hz with invalid samples and a few values which
+ * do not fit int16 around their block. Outputs of block path must equal sample by sample
+ * dsp_process exactly, with blocks aligned to buffer and after one leftover sample.
+ */
+#include "ruuvi_error.h"
+#include "ruuvi_sensor.h"
+#include "dsp.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLERATE 400
+#define SAMPLES    (60 * SAMPLERATE)
+#define AXES       3
+#define ROUNDS     20
+
+static float  source[SAMPLES * AXES];
+static float  work[SAMPLES * AXES];
+static size_t source_count;
+static size_t source_offset;
+
+static ruuvi_status_t buffer_get(void* const buffer)
+{
+  dsp_buffer_t* p_buffer = buffer;
+  size_t count = (source_count < p_buffer->count) ? source_count : p_buffer->count;
+  memcpy(p_buffer->data, source + (source_offset * AXES), count * AXES * sizeof(float));
+  p_buffer->count = count;
+  return RUUVI_SUCCESS;
+}
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+static void generate(void)
+{
+  srand(1);
+  for(size_t ii = 0; ii < SAMPLES; ii++)
+  {
+    float t = (float)ii / SAMPLERATE;
+    source[(ii * AXES) + 0] = 12.0f + (300.0f * sinf(2 * M_PI * 3.1f * t)) + (rand() % 100) * 0.37f;
+    source[(ii * AXES) + 1] = -980.0f + (rand() % 2000) * 0.013f;
+    source[(ii * AXES) + 2] = (40.0f * sinf(2 * M_PI * 0.2f * t)) + (rand() % 7) - 3;
+  }
+  for(size_t ii = 0; ii < SAMPLES; ii += 997) { source[(ii * AXES) + 1] = RUUVI_FLOAT_INVALID; }
+  for(size_t ii = 5; ii < SAMPLES; ii += 1499) { source[(ii * AXES) + 2] = NAN; }
+  for(size_t ii = 11; ii < SAMPLES; ii += 2003) { source[(ii * AXES) + 0] = 1.0e6f; }
+}
+
+// Scalar reference: every sample converted and pushed through dsp_process
+static size_t reference(dsp_t* const dsp, const float* const in, const size_t count, float* const out, const float* const scale)
+{
+  size_t outputs = 0;
+  for(size_t ii = 0; ii < count; ii++)
+  {
+    int32_t fixed[AXES];
+    int32_t result[AXES];
+    uint8_t valid = 0;
+    for(uint8_t ch = 0; ch < AXES; ch++)
+    {
+      float value = in[(ii * AXES) + ch];
+      if(RUUVI_FLOAT_INVALID == value || isnan(value)) { continue; }
+      fixed[ch] = (int32_t)lrintf(value * scale[ch]);
+      valid |= 1U << ch;
+    }
+    if(!dsp_process(dsp, fixed, valid, result)) { continue; }
+    for(uint8_t ch = 0; ch < AXES; ch++)
+    {
+      out[(outputs * AXES) + ch] = (INT32_MIN == result[ch]) ? RUUVI_FLOAT_INVALID : (result[ch] / scale[ch]);
+    }
+    outputs++;
+  }
+  return outputs;
+}
+
+// Buffer through dsp_buffer_get, first offset samples in a separate call
+static size_t block(dsp_t* const dsp, const size_t offset)
+{
+  dsp_buffer_t buffer = { .count = SAMPLES, .data = work };
+  size_t outputs = 0;
+  if(0 < offset)
+  {
+    source_offset = 0;
+    source_count = offset;
+    dsp_buffer_get(dsp, &buffer);
+    outputs = buffer.count;
+  }
+  buffer.count = SAMPLES - offset;
+  buffer.data = work + (outputs * AXES);
+  source_offset = offset;
+  source_count = SAMPLES - offset;
+  dsp_buffer_get(dsp, &buffer);
+  return outputs + buffer.count;
+}
+
+int main(void)
+{
+  static float expected[SAMPLES * AXES];
+  const float scale[AXES] = {4, 4, 100};
+  const ruuvi_sensor_dsp_function_t functions[] = {RUUVI_SENSOR_DSP_MIN, RUUVI_SENSOR_DSP_MAX, RUUVI_SENSOR_DSP_AVERAGE, RUUVI_SENSOR_DSP_STDEV};
+  const char* names[] = {"MIN", "MAX", "AVERAGE", "STDEV"};
+  const uint8_t parameters[] = {4, 16, 100, 255};
+  ruuvi_sensor_t sensor = {0};
+  sensor.buffer_get = buffer_get;
+  generate();
+
+  int failures = 0;
+  printf("%-8s %5s %14s %14s %8s\n", "function", "n", "per-sample us", "block us", "speedup");
+  for(size_t ff = 0; ff < sizeof(functions) / sizeof(functions[0]); ff++)
+  {
+    for(size_t pp = 0; pp < sizeof(parameters) / sizeof(parameters[0]); pp++)
+    {
+      dsp_t dsp;
+      ruuvi_sensor_dsp_function_t function = functions[ff];
+      uint8_t parameter = parameters[pp];
+      dsp_init(&dsp, &sensor, AXES, AXES * sizeof(float), scale);
+      if(RUUVI_SUCCESS != dsp_set(&dsp, &function, &parameter)) { printf("dsp_set failed\n"); return 1; }
+
+      // Exact match, aligned and with a leftover sample from previous call
+      dsp_reset(&dsp);
+      size_t n_ref = reference(&dsp, source, SAMPLES, expected, scale);
+      for(size_t offset = 0; offset < 2; offset++)
+      {
+        dsp_reset(&dsp);
+        size_t n_block = block(&dsp, offset);
+        if(n_ref != n_block || 0 != memcmp(expected, work, n_ref * AXES * sizeof(float)))
+        {
+          printf("FAIL %s %d offset %zu: %zu vs %zu outputs\n", names[ff], parameter, offset, n_ref, n_block);
+          failures++;
+        }
+      }
+
+      double start = now_us();
+      for(int round = 0; round < ROUNDS; round++)
+      {
+        dsp_reset(&dsp);
+        reference(&dsp, source, SAMPLES, expected, scale);
+      }
+      double scalar = (now_us() - start) / ROUNDS;
+      start = now_us();
+      for(int round = 0; round < ROUNDS; round++)
+      {
+        dsp_reset(&dsp);
+        block(&dsp, 0);
+      }
+      double blocks = (now_us() - start) / ROUNDS;
+      printf("%-8s %5d %14.1f %14.1f %7.2fx\n", names[ff], parameter, scalar, blocks, scalar / blocks);
+    }
+  }
+  printf("%s\n", (0 == failures) ? "dsp block: ok" : "dsp block: FAILED");
+  return (0 == failures) ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/**
+ * Radix-4 Q15 FFT against naive double-precision DFT of the same quantized input.
+ *
+ * dsp_fft_q15 scales by 1 / n, so reference is DFT / n and error is in LSB of Q15 output.
+ * Both are timed on 256, 512 and 1024 points. Summary of a two-tone accelerometer block
+ * must find both tones and RMS of the signal.
+ */
+#include "ruuvi_error.h"
+#include "dsp_fft.h"
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_ERROR_LSB 4.0
+#define ROUNDS        200
+
+static dsp_fft_complex_t work[DSP_FFT_SIZE_MAX];
+static int32_t           input[DSP_FFT_SIZE_MAX];
+static double            dft_re[DSP_FFT_SIZE_MAX];
+static double            dft_im[DSP_FFT_SIZE_MAX];
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+static void dft(const size_t n)
+{
+  for(size_t k = 0; k < n; k++)
+  {
+    double re = 0;
+    double im = 0;
+    for(size_t ii = 0; ii < n; ii++)
+    {
+      double angle = 2 * M_PI * (double)((k * ii) % n) / n;
+      re += input[ii] * cos(angle);
+      im -= input[ii] * sin(angle);
+    }
+    dft_re[k] = re / n;
+    dft_im[k] = im / n;
+  }
+}
+
+static int transform(const size_t n)
+{
+  for(size_t ii = 0; ii < n; ii++)
+  {
+    double value = (12000 * sin(2 * M_PI * 37.3 * ii / n)) + (3000 * cos(2 * M_PI * 101 * ii / n)) + ((ii % 7) * 100);
+    input[ii] = (int32_t)lrint(value);
+  }
+
+  double start = now_us();
+  for(int round = 0; round < ROUNDS; round++)
+  {
+    for(size_t ii = 0; ii < n; ii++)
+    {
+      work[ii].re = (int16_t)input[ii];
+      work[ii].im = 0;
+    }
+    dsp_fft_q15(work, n);
+  }
+  double fft_us = (now_us() - start) / ROUNDS;
+
+  start = now_us();
+  dft(n);
+  double dft_us = now_us() - start;
+
+  double worst = 0;
+  for(size_t k = 0; k < n; k++)
+  {
+    const dsp_fft_complex_t* bin = &work[dsp_fft_bin(k, n)];
+    double error = hypot(bin->re - dft_re[k], bin->im - dft_im[k]);
+    if(error > worst) { worst = error; }
+  }
+  printf("n %4zu: max error %.2f LSB, fft %8.1f us, dft %10.1f us, %6.0fx\n", n, worst, fft_us, dft_us, dft_us / fft_us);
+  return (MAX_ERROR_LSB >= worst) ? 0 : 1;
+}
+
+static int summary(void)
+{
+  static float acc[3 * DSP_FFT_SIZE_MAX];
+  const float samplerate = 1600;
+  for(size_t ii = 0; ii < DSP_FFT_SIZE_MAX; ii++)
+  {
+    acc[3 * ii] = 1000 + (50 * sinf(2 * M_PI * 120.0f * ii / samplerate)) + (20 * sinf(2 * M_PI * 333.3f * ii / samplerate));
+    acc[(3 * ii) + 1] = 0;
+    acc[(3 * ii) + 2] = 0;
+  }
+  int failures = 0;
+  double rms = sqrt(((50.0 * 50.0) + (20.0 * 20.0)) / 2);
+  for(int window = DSP_FFT_WINDOW_RECTANGULAR; window <= DSP_FFT_WINDOW_HANN; window++)
+  {
+    dsp_fft_summary_t result;
+    if(RUUVI_SUCCESS != dsp_fft_summary(acc, DSP_FFT_SIZE_MAX, 3, samplerate, window, 2, work, &result)) { return 1; }
+    printf("window %d: rms %.2f (%.2f), crest %.2f, peaks %.1f Hz %.1f, %.1f Hz %.1f\n", window, result.rms, rms, result.crest,
+           result.peak[0].frequency, result.peak[0].amplitude, result.peak[1].frequency, result.peak[1].amplitude);
+    if(2 != result.peaks || 0.02 < fabs(result.rms - rms) / rms) { failures++; }
+    else if(1.0 < fabs(result.peak[0].frequency - 120.0f) || 1.0 < fabs(result.peak[1].frequency - 333.3f)) { failures++; }
+    else if(5.0 < fabs(result.peak[0].amplitude - 50) || 5.0 < fabs(result.peak[1].amplitude - 20)) { failures++; }
+  }
+  return failures;
+}
+
+int main(void)
+{
+  int failures = 0;
+  for(size_t n = 256; n <= DSP_FFT_SIZE_MAX; n *= 2) { failures += transform(n); }
+  failures += summary();
+  printf("%s\n", (0 == failures) ? "dsp fft: ok" : "dsp fft: FAILED");
+  return (0 == failures) ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/**
+ * Sliding window median against a sorted copy of the window, and IMPULSE re-centering.
+ *
+ * Every window size 1 ... DSP_MEDIAN_WINDOW_MAX gets random samples with duplicates and int16 extremes,
+ * median must equal the middle of the sorted window after each push, also while window is filling.
+ * dsp_median_offset must keep heaps valid, including saturation. IMPULSE must follow a step and a ramp
+ * which leave int16 range around the first sample, with output exactly equal to median of the input.
+ * A step of d beyond int16 is tracked by moving reference at most INT16_MAX per window, so output
+ * must rise monotonically and settle within d / INT16_MAX + 2 windows.
+ */
+#include "ruuvi_error.h"
+#include "dsp.h"
+#include "dsp_median.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PUSHES 2000
+
+static dsp_median_node_t arena[DSP_MEDIAN_WINDOW_MAX];
+static int32_t           history[PUSHES * 4];
+
+static int compare(const void* a, const void* b)
+{
+  int32_t x = *(const int32_t*)a;
+  int32_t y = *(const int32_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Median of last window values of history up to index, rounded down mean of middle two
+static int64_t reference(const int32_t* const values, const size_t count, const size_t window)
+{
+  static int32_t sorted[PUSHES * 4];
+  size_t n = (count < window) ? count : window;
+  memcpy(sorted, values + count - n, n * sizeof(int32_t));
+  qsort(sorted, n, sizeof(int32_t), compare);
+  if(n & 1) { return sorted[n / 2]; }
+  int64_t sum = (int64_t)sorted[(n / 2) - 1] + sorted[n / 2];
+  return (sum >= 0) ? (sum / 2) : ((sum - 1) / 2);
+}
+
+static int16_t sample(void)
+{
+  switch(rand() % 8)
+  {
+    case 0:  return INT16_MIN;
+    case 1:  return INT16_MAX;
+    case 2:  return (int16_t)(rand() % 5);      // Duplicates
+    default: return (int16_t)((rand() % 65536) - 32768);
+  }
+}
+
+static int16_t saturate(const int32_t value)
+{
+  if(INT16_MAX < value) { return INT16_MAX; }
+  if(INT16_MIN > value) { return INT16_MIN; }
+  return (int16_t)value;
+}
+
+static int sorted_window(void)
+{
+  int failures = 0;
+  dsp_median_t median;
+  for(size_t window = 1; window <= DSP_MEDIAN_WINDOW_MAX; window++)
+  {
+    if(RUUVI_SUCCESS != dsp_median_init(&median, arena, (uint8_t)window)) { return 1; }
+    size_t count = 0;
+    for(size_t ii = 0; ii < PUSHES; ii++)
+    {
+      // Offset in the middle of the run, large enough to saturate some samples
+      if(PUSHES / 2 == ii)
+      {
+        int32_t offset = (rand() % 2) ? 20000 : -20000;
+        dsp_median_offset(&median, offset);
+        for(size_t kk = 0; kk < count; kk++) { history[kk] = saturate(history[kk] + offset); }
+        if(reference(history, count, window) != dsp_median_get(&median))
+        {
+          printf("FAIL window %zu: median after offset %d\n", window, offset);
+          failures++;
+          break;
+        }
+      }
+      history[count++] = sample();
+      int16_t got = dsp_median_push(&median, (int16_t)history[count - 1]);
+      int64_t expected = reference(history, count, window);
+      if(expected != got || got != dsp_median_get(&median))
+      {
+        printf("FAIL window %zu push %zu: median %d, expected %lld\n", window, ii, got, (long long)expected);
+        failures++;
+        break;
+      }
+    }
+  }
+  printf("sorted window 1 ... %d, %d pushes each: %s\n", DSP_MEDIAN_WINDOW_MAX, PUSHES, failures ? "FAILED" : "match");
+  return failures;
+}
+
+// IMPULSE output must be median of last window inputs once window is full, except for settle samples from start
+static int impulse(const char* const name, const uint8_t window, const int32_t* const in, const size_t count,
+                   const size_t start, const size_t settle)
+{
+  dsp_t dsp;
+  const float scale = 1;
+  ruuvi_sensor_dsp_function_t function = RUUVI_SENSOR_DSP_IMPULSE;
+  uint8_t parameter = window;
+  if(RUUVI_SUCCESS != dsp_init(&dsp, NULL, 1, sizeof(float), &scale)) { return 1; }
+  if(RUUVI_SUCCESS != dsp_set(&dsp, &function, &parameter)) { return 1; }
+  size_t mismatches = 0;
+  int32_t out = 0;
+  int32_t previous = INT32_MIN;
+  for(size_t ii = 0; ii < count; ii++)
+  {
+    dsp_process(&dsp, &in[ii], 1, &out);
+    if(ii >= start && ii < start + settle)
+    {
+      if(out < previous) { mismatches++; }
+      previous = out;
+    }
+    else if(reference(in, ii + 1, window) != out) { mismatches++; }
+  }
+  printf("impulse %-5s window %3d: %zu mismatches, last %d expected %lld\n", name, window, mismatches, out,
+         (long long)reference(in, count, window));
+  return (0 == mismatches) ? 0 : 1;
+}
+
+static int recentering(void)
+{
+  int failures = 0;
+  const size_t count = PUSHES * 4;
+  const uint8_t windows[] = {1, 2, 7, DSP_IMPULSE_WINDOW_MAX};
+  for(size_t ww = 0; ww < sizeof(windows); ww++)
+  {
+    // Step of 10^6 from first sample, far beyond int16
+    for(size_t ii = 0; ii < count; ii++) { history[ii] = (ii < count / 4) ? -1000 : 1000000; }
+    size_t settle = (((1000000 + 1000) / INT16_MAX) + 2) * windows[ww];
+    failures += impulse("step", windows[ww], history, count, count / 4, settle);
+    // Ramp which crosses int16 range many times over, up and down
+    for(size_t ii = 0; ii < count; ii++)
+    {
+      int32_t ramp = (int32_t)ii * 500;
+      history[ii] = (ii < count / 2) ? ramp : ((int32_t)count * 500) - ramp;
+    }
+    failures += impulse("ramp", windows[ww], history, count, 0, 0);
+  }
+  return failures;
+}
+
+int main(void)
+{
+  int failures = 0;
+  srand(1);
+  failures += sorted_window();
+  failures += recentering();
+  printf("%s\n", (0 == failures) ? "dsp median: ok" : "dsp median: FAILED");
+  return (0 == failures) ? 0 : 1;
+}